@@ -0,0 +1,14 @@
+#!/bin/bash
+# the binary bench/run.sh has jitro run: it answers every "!ping" so the
+# outbound path is exercised too, and quits when the replay says it's done
+
+while read -r network line; do
+	case "$line" in
+		*"PRIVMSG #bench :!replay-done"*)
+			echo "$network QUIT :replayed"
+			;;
+		*"!ping"*)
+			echo "$network PRIVMSG #bench :pong"
+			;;
+	esac
+done
@@ -0,0 +1,186 @@
+// replay stands in for an IRC server to drive jitro with a fixed workload:
+// it registers the one client that connects, then sends it every line of
+// what jitro logged (as jitro-log prints it) or, without that, a made up mix of channel
+// traffic, and ends with a "!replay-done" which bench/bot.sh answers with
+// a QUIT. It says how long that took and how much came back.
+//
+//     replay <port> [log | -] [lines]
+#include <string>
+using std::string;
+#include <vector>
+using std::vector;
+#include <iostream>
+using std::cout;
+using std::cerr;
+using std::endl;
+#include <fstream>
+using std::ifstream;
+#include <chrono>
+using std::chrono::steady_clock;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static int listenOn(int port);
+int listenOn(int port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+			|| listen(fd, 1) != 0) {
+		perror("replay: listen");
+		exit(1);
+	}
+	return fd;
+}
+
+static void sendAll(int fd, const string &data);
+void sendAll(int fd, const string &data) {
+	for(size_t at = 0; at < data.length(); ) {
+		ssize_t n = write(fd, data.data() + at, data.length() - at);
+		if(n <= 0) {
+			perror("replay: write");
+			exit(1);
+		}
+		at += n;
+	}
+}
+
+// read lines off fd into buf until one starts with what (or EOF), counting
+// the PRIVMSGs seen on the way
+static bool readUntil(int fd, string &buf, string what, size_t &privmsgs);
+bool readUntil(int fd, string &buf, string what, size_t &privmsgs) {
+	while(true) {
+		size_t nl;
+		while((nl = buf.find('\n')) != string::npos) {
+			string line = buf.substr(0, nl);
+			buf.erase(0, nl + 1);
+			if(line.compare(0, 8, "PRIVMSG ") == 0)
+				privmsgs++;
+			if(!what.empty() && line.compare(0, what.length(), what) == 0)
+				return true;
+		}
+		char chunk[65536];
+		ssize_t n = read(fd, chunk, sizeof(chunk));
+		if(n <= 0)
+			return false;
+		buf.append(chunk, n);
+	}
+}
+
+// logged lines are "<time> <network> <line>"
+static vector<string> loadLog(string path);
+vector<string> loadLog(string path) {
+	vector<string> lines;
+	ifstream in(path);
+	string line;
+	while(getline(in, line)) {
+		size_t first = line.find(' '), second = line.find(' ', first + 1);
+		if(second == string::npos)
+			continue;
+		lines.push_back(line.substr(second + 1));
+	}
+	return lines;
+}
+
+static vector<string> synthesize(size_t count);
+vector<string> synthesize(size_t count) {
+	static const char *words[] = { "the", "relay", "is", "quick", "and",
+		"nobody", "notices", "é", "日本", "!ping", "ACTION", "lag" };
+	vector<string> lines;
+	unsigned seed = 12345;
+	for(size_t i = 0; i < count; ++i) {
+		seed = seed * 1103515245 + 12345;
+		string nick = "user" + std::to_string(seed % 97),
+			chan = (seed >> 8) % 2 ? "#bench" : "#Bench",
+			prefix = ":" + nick + "!u@host" + std::to_string(seed % 13);
+		switch((seed >> 16) % 20) {
+			case 0:
+				lines.push_back(prefix + " JOIN " + chan);
+				break;
+			case 1:
+				lines.push_back(prefix + " PART " + chan + " :bye");
+				break;
+			case 2:
+				lines.push_back(prefix + " NICK " + nick + "_");
+				break;
+			case 3:
+				lines.push_back(":srv MODE " + chan + " +o " + nick);
+				break;
+			case 4:
+				lines.push_back("@time=2024-01-01T00:00:00.000Z " + prefix
+						+ " NOTICE " + chan + " :notice " + std::to_string(i));
+				break;
+			default: {
+				string text;
+				for(unsigned w = 0; w < 3 + (seed >> 4) % 20; ++w)
+					text += string(w ? " " : "") + words[(seed >> w) % 12];
+				lines.push_back(prefix + " PRIVMSG " + chan + " :" + text);
+				break;
+			}
+		}
+	}
+	return lines;
+}
+
+int main(int argc, char **argv) {
+	if(argc < 2) {
+		cerr << "usage: " << argv[0] << " <port> [log | -] [lines]"
+			<< endl;
+		return 1;
+	}
+	int port = atoi(argv[1]);
+	string log = argc > 2 ? argv[2] : "-";
+	size_t count = argc > 3 ? strtoul(argv[3], nullptr, 10) : 100000;
+	vector<string> workload = log == "-" ? synthesize(count) : loadLog(log);
+
+	int server = listenOn(port);
+	int fd = accept(server, nullptr, nullptr);
+	if(fd < 0) {
+		perror("replay: accept");
+		return 1;
+	}
+	string buf;
+	size_t acks = 0;
+	if(!readUntil(fd, buf, "USER ", acks))
+		return 1;
+	sendAll(fd, ":srv 001 bench :Welcome\r\n"
+			":srv 005 bench CASEMAPPING=rfc1459 CHANTYPES=# PREFIX=(ov)@+"
+			" :are supported\r\n:srv 376 bench :End of MOTD\r\n");
+	if(!readUntil(fd, buf, "JOIN ", acks))
+		return 1;
+	sendAll(fd, ":bench!u@h JOIN #bench\r\n");
+
+	auto start = steady_clock::now();
+	string out;
+	for(auto &line : workload) {
+		out += line + "\r\n";
+		if(out.length() > 65536) {
+			sendAll(fd, out);
+			out.clear();
+		}
+	}
+	out += ":bench!u@h PRIVMSG #bench :!replay-done\r\n";
+	sendAll(fd, out);
+
+	// the bot quits once it's seen everything, which closes jitro
+	readUntil(fd, buf, "QUIT", acks);
+	long ms = duration_cast<milliseconds>(steady_clock::now() - start).count();
+	cout << "replay: " << workload.size() << " lines in " << ms << "ms ("
+		<< (ms ? workload.size() * 1000 / ms : 0) << " lines/s), "
+		<< acks << " PRIVMSGs back" << endl;
+	close(fd);
+	close(server);
+	return 0;
+}
@@ -0,0 +1,25 @@
+#!/bin/bash
+# Replay a workload through jitro and say how fast it went:
+#
+#     bench/run.sh [jitro] [log | -] [lines]
+#
+# jitro is run from bench/, so it reads bench/jitro.conf and leaves its
+# logs there. Its own chatter on stderr goes to bench/jitro.err.
+
+jitro=$(realpath "${1:-$(dirname "$0")/../jitro}")
+log=${2:--}
+lines=${3:-100000}
+[[ $log != - ]] && log=$(realpath "$log")
+cd "$(dirname "$0")" || exit 1
+
+./replay 16667 "$log" "$lines" &
+replay=$!
+# give it a moment to listen
+sleep 0.2
+"$jitro" 2> jitro.err
+status=$?
+# a jitro that never got to the end leaves the replay waiting
+[[ $status != 0 ]] && kill $replay
+wait $replay
+rm -rf logs
+exit $status
@@ -0,0 +1,92 @@
+#include "broadcast.hpp"
+using std::string;
+using std::vector;
+
+#include <algorithm>
+using std::min;
+#include <utility>
+
+static size_t roundCapacity(size_t capacity);
+size_t roundCapacity(size_t capacity) {
+	size_t size = 16;
+	while(size < capacity)
+		size <<= 1;
+	return size;
+}
+
+Broadcast::Broadcast(size_t capacity) : _ring(roundCapacity(capacity)) { }
+
+void Broadcast::resize(size_t capacity) {
+	capacity = roundCapacity(capacity);
+	if(capacity == _ring.size())
+		return;
+	// move over the most recent messages, which are all anybody still wants
+	vector<Message> ring(capacity);
+	uint64_t keep = min((uint64_t)min(capacity, _ring.size()), _head);
+	for(uint64_t at = _head - keep; at < _head; ++at)
+		ring[at & (capacity - 1)] = std::move(_ring[at & (_ring.size() - 1)]);
+	_ring.swap(ring);
+	for(auto &cursor : _cursors)
+		if(cursor._active && _head - cursor._at > keep) {
+			cursor._dropped += _head - keep - cursor._at;
+			cursor._at = _head - keep;
+		}
+}
+size_t Broadcast::capacity() const {
+	return _ring.size();
+}
+
+void Broadcast::publish(string network, string line) {
+	// the slot we're about to reuse is lost to whoever hasn't read it
+	for(auto &cursor : _cursors)
+		if(cursor._active && _head - cursor._at >= _ring.size()) {
+			cursor._at++;
+			cursor._dropped++;
+		}
+
+	Message &msg = _ring[_head & (_ring.size() - 1)];
+	msg._prefixed = network + " " + line;
+	msg._msg = IRCMessage::parse(line);
+	msg._network.swap(network);
+	msg._line.swap(line);
+	_head++;
+}
+
+Broadcast::Reader Broadcast::subscribe() {
+	Reader reader = 0;
+	while(reader < _cursors.size() && _cursors[reader]._active)
+		reader++;
+	if(reader == _cursors.size())
+		_cursors.emplace_back();
+	_cursors[reader] = Cursor();
+	_cursors[reader]._at = _head;
+	_cursors[reader]._active = true;
+	return reader;
+}
+void Broadcast::unsubscribe(Reader &reader) {
+	if(reader < _cursors.size())
+		_cursors[reader]._active = false;
+	reader = None;
+}
+
+const Broadcast::Message *Broadcast::next(Reader reader) {
+	Cursor &cursor = _cursors[reader];
+	if(cursor._at == _head)
+		return nullptr;
+	return &_ring[cursor._at++ & (_ring.size() - 1)];
+}
+vector<const Broadcast::Message *> Broadcast::unread(Reader reader) const {
+	vector<const Message *> out;
+	for(uint64_t at = _cursors[reader]._at; at < _head; ++at)
+		out.push_back(&_ring[at & (_ring.size() - 1)]);
+	return out;
+}
+size_t Broadcast::lag(Reader reader) const {
+	return _head - _cursors[reader]._at;
+}
+uint64_t Broadcast::dropped(Reader reader) const {
+	return _cursors[reader]._dropped;
+}
+void Broadcast::skip(Reader reader) {
+	_cursors[reader]._at = _head;
+}
@@ -0,0 +1,72 @@
+#ifndef BROADCAST_HPP
+#define BROADCAST_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "ircmessage.hpp"
+
+// Broadcast is the one copy of what the networks said that every binary and
+// endpoint reads from, each with a cursor of its own. A line is stored once
+// however many readers there are, in a ring of a fixed number of messages;
+// a reader which falls a whole ring behind loses the oldest of what it
+// hadn't read yet, which it can tell from dropped().
+struct Broadcast {
+	typedef size_t Reader;
+	static const Reader None = (size_t)-1;
+
+	// a message is never changed once published
+	struct Message {
+		std::string _network{};
+		std::string _line{};
+		// "<network> <line>", as line based binaries are sent it
+		std::string _prefixed{};
+		// parsed, as framed binaries are sent it
+		IRCMessage _msg{};
+	};
+
+	// capacity is rounded up to a power of two
+	Broadcast(size_t capacity = 4096);
+
+	Broadcast(const Broadcast &rhs) = delete;
+	Broadcast &operator=(const Broadcast &rhs) = delete;
+
+	// Change the ring's size, keeping what every reader has yet to read
+	// that still fits
+	void resize(size_t capacity);
+	size_t capacity() const;
+
+	void publish(std::string network, std::string line);
+
+	// A new reader starts at what is published next
+	Reader subscribe();
+	void unsubscribe(Reader &reader);
+
+	// The reader's next message, or nullptr once it's caught up. The
+	// message stays put until something else is published.
+	const Message *next(Reader reader);
+	// everything next() would give, without moving the reader along
+	std::vector<const Message *> unread(Reader reader) const;
+	// Messages the reader has yet to read, and how many it lost for being
+	// too far behind
+	size_t lag(Reader reader) const;
+	uint64_t dropped(Reader reader) const;
+	// forget everything the reader has yet to read
+	void skip(Reader reader);
+
+	protected:
+		struct Cursor {
+			// total published when the reader gets to it
+			uint64_t _at{0};
+			uint64_t _dropped{0};
+			bool _active{false};
+		};
+
+	protected:
+		std::vector<Message> _ring{};
+		// total ever published, the next one going in _ring[_head & mask]
+		uint64_t _head{0};
+		std::vector<Cursor> _cursors{};
+};
+
+#endif // BROADCAST_HPP
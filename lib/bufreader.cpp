@@ -10,6 +10,7 @@ using std::endl;
 #include <fcntl.h>
 #include <cassert>
 
+#include "tls.hpp"
 #include "util.hpp"
 using util::endsWith;
 using util::contains;
@@ -23,6 +24,9 @@ void BufReader::setup(int nFD, string nSplit) {
 	_eof = false;
 	setBlocking(false);
 }
+void BufReader::tls(Tls *tls) {
+	_tls = tls;
+}
 
 bool BufReader::canRead() {
 	if(contains(_buf, _split))
@@ -32,6 +36,9 @@ bool BufReader::canRead() {
 		return true;
 	return false;
 }
+bool BufReader::hasLine() const {
+	return _buf.find(_split) != string::npos;
+}
 string BufReader::read() {
 	if(_split.empty()) {
 		cerr << "BufReader::read: split empty" << endl;
@@ -50,23 +57,31 @@ string BufReader::read() {
 	return msg;
 }
 
+string BufReader::take() {
+	tryRead();
+	string data;
+	data.swap(_buf);
+	return data;
+}
+
 void BufReader::tryRead() {
 	if(_eof)
 		return;
 
 	char tbuf[readSize] = { 0 };
-	ssize_t ramount = ::read(_fd, tbuf, readSize);
-	if((ramount < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+	ssize_t ramount = _tls ? _tls->read(tbuf, readSize)
+		: ::read(_fd, tbuf, readSize);
+	if((ramount < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)
+				|| (errno == EINTR)))
 		return;
+	// anything else (ECONNRESET, say) means there is no more to come
 	if(ramount < 0) {
 		perror("BufReader::tryRead");
-		return;
+		ramount = 0;
 	}
 
-	string ttbuf(tbuf);
-	if(ttbuf.length() >= (size_t)ramount)
-		ttbuf = ttbuf.substr(0, ramount);
-	_buf += ttbuf;
+	// the data may not be text, so don't stop at a NUL
+	_buf.append(tbuf, ramount);
 
 	if(ramount == 0) {
 		if(!endsWith(_buf, _split)) {
@@ -90,9 +105,13 @@ int BufReader::setBlocking(bool blocking) {
 bool BufReader::eof() const {
 	return _eof;
 }
+string BufReader::buffered() const {
+	return _buf;
+}
 
 void BufReader::clear() {
 	_fd = -1;
+	_tls = nullptr;
 	_split = "";
 	_buf.clear();
 	_eof = false;
@@ -3,17 +3,27 @@
 
 #include <string>
 
+struct Tls;
+
 // BufReader provides buffered read support from a file descriptor.
 struct BufReader {
 	void setup(int nFD, std::string nSplit);
+	// read through tls instead of straight off the descriptor
+	void tls(Tls *tls);
 
 	bool canRead();
+	// whether a whole line is buffered, without reading any more
+	bool hasLine() const;
 	std::string read();
+	// Take everything buffered so far regardless of split, for binary data
+	std::string take();
 
 	// Switch a BufReader into blocking read mode (default is nonblocking)
 	int setBlocking(bool blocking);
 
 	bool eof() const;
+	// what has been read but not yet consumed
+	std::string buffered() const;
 
 	void clear();
 
@@ -25,6 +35,7 @@ struct BufReader {
 
 	protected:
 		int _fd{-1};
+		Tls *_tls{nullptr};
 		std::string _split{"\r\n"};
 		std::string _buf{};
 		bool _eof{true};
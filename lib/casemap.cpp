@@ -0,0 +1,106 @@
+#include "casemap.hpp"
+using std::string;
+
+string toString(CaseMapping cm) {
+	switch(cm) {
+		case CaseMapping::ASCII: return "ascii";
+		case CaseMapping::RFC1459: return "rfc1459";
+		case CaseMapping::StrictRFC1459: return "strict-rfc1459";
+		default: case CaseMapping::INVALID: return "INVALID";
+	}
+}
+CaseMapping toCaseMapping(string name) {
+	if(name == "ascii") return CaseMapping::ASCII;
+	if(name == "rfc1459") return CaseMapping::RFC1459;
+	if(name == "strict-rfc1459") return CaseMapping::StrictRFC1459;
+	return CaseMapping::INVALID;
+}
+
+string foldCase(string str, CaseMapping cm) {
+	// rfc1459 treats []\^ as the upper case forms of {}|~
+	char last = (cm == CaseMapping::RFC1459) ? '^'
+		: (cm == CaseMapping::StrictRFC1459) ? ']' : 'Z';
+	for(auto &c : str) {
+		if(c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		else if(c >= '[' && c <= last)
+			c += '{' - '[';
+	}
+	return str;
+}
+bool caseEqual(string a, string b, CaseMapping cm) {
+	if(a.length() != b.length())
+		return false;
+	return foldCase(a, cm) == foldCase(b, cm);
+}
+
+NameTable::Id NameTable::intern(string name) {
+	string key = foldCase(name, _cm);
+	auto it = _ids.find(key);
+	if(it != _ids.end())
+		return it->second;
+
+	Id id;
+	if(!_free.empty()) {
+		id = _free.back();
+		_free.pop_back();
+		_names[id] = name;
+		_live[id] = true;
+	} else {
+		id = _names.size();
+		_names.push_back(name);
+		_live.push_back(true);
+	}
+	_ids[key] = id;
+	return id;
+}
+NameTable::Id NameTable::find(string name) const {
+	auto it = _ids.find(foldCase(name, _cm));
+	if(it == _ids.end())
+		return None;
+	return it->second;
+}
+void NameTable::release(Id id) {
+	if(!valid(id))
+		return;
+	auto it = _ids.find(foldCase(_names[id], _cm));
+	if(it != _ids.end() && it->second == id)
+		_ids.erase(it);
+	_names[id].clear();
+	_live[id] = false;
+	_free.push_back(id);
+}
+
+string NameTable::name(Id id) const {
+	if(!valid(id))
+		return "";
+	return _names[id];
+}
+bool NameTable::valid(Id id) const {
+	return id < _names.size() && _live[id];
+}
+NameTable::Id NameTable::bound() const {
+	return _names.size();
+}
+size_t NameTable::size() const {
+	return _names.size() - _free.size();
+}
+void NameTable::clear() {
+	_ids.clear();
+	_names.clear();
+	_live.clear();
+	_free.clear();
+}
+
+CaseMapping NameTable::caseMapping() const {
+	return _cm;
+}
+void NameTable::caseMapping(CaseMapping cm) {
+	if(cm == CaseMapping::INVALID || cm == _cm)
+		return;
+	_cm = cm;
+	_ids.clear();
+	for(Id id = 0; id < _names.size(); ++id)
+		if(_live[id])
+			_ids.insert({ foldCase(_names[id], _cm), id });
+}
@@ -0,0 +1,53 @@
+#ifndef CASEMAP_HPP
+#define CASEMAP_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// IRC case mappings as advertised by the ISUPPORT CASEMAPPING token
+enum class CaseMapping { ASCII, RFC1459, StrictRFC1459, INVALID };
+std::string toString(CaseMapping cm);
+CaseMapping toCaseMapping(std::string name);
+
+// Fold a name to its canonical lower case form under a case mapping
+std::string foldCase(std::string str, CaseMapping cm);
+// Compare two names for equality under a case mapping
+bool caseEqual(std::string a, std::string b, CaseMapping cm);
+
+// NameTable interns IRC names (channels or nicks) into compact integer ids.
+// Lookups are done on the case folded form, so "#Jitro" and "#jitro" share
+// an id, while name() returns the spelling the id was first interned with.
+// Released ids are reused so the table stays as large as its live set.
+struct NameTable {
+	typedef unsigned Id;
+	static const Id None = (Id)-1;
+
+	// Return the id of name, creating one if it does not exist yet
+	Id intern(std::string name);
+	// Return the id of name, or None if it has not been interned
+	Id find(std::string name) const;
+	// Forget an id; it may be handed out again by a later intern
+	void release(Id id);
+
+	std::string name(Id id) const;
+	bool valid(Id id) const;
+	// One past the largest id currently handed out
+	Id bound() const;
+	size_t size() const;
+	void clear();
+
+	CaseMapping caseMapping() const;
+	// Switch case mappings, refolding every live name. Names which collide
+	// under the new mapping resolve to the lowest id.
+	void caseMapping(CaseMapping cm);
+
+	protected:
+		CaseMapping _cm{CaseMapping::RFC1459};
+		std::unordered_map<std::string, Id> _ids{};
+		std::vector<std::string> _names{};
+		std::vector<bool> _live{};
+		std::vector<Id> _free{};
+};
+
+#endif // CASEMAP_HPP
@@ -0,0 +1,61 @@
+#include "filewatch.hpp"
+using std::string;
+
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <cstdio>
+
+#include "iobackend.hpp"
+
+FileWatch::~FileWatch() {
+	close();
+}
+
+int FileWatch::watch(string path) {
+	close();
+	size_t slash = path.rfind('/');
+	string dir = (slash == string::npos) ? "." : path.substr(0, slash + 1);
+	_name = (slash == string::npos) ? path : path.substr(slash + 1);
+
+	_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(_fd < 0) {
+		perror("FileWatch::watch: inotify_init1");
+		return -1;
+	}
+	if(inotify_add_watch(_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		perror("FileWatch::watch: inotify_add_watch");
+		close();
+		return -1;
+	}
+	return 0;
+}
+
+void FileWatch::close() {
+	if(_fd >= 0) {
+		IOBackend::closing(_fd);
+		::close(_fd);
+	}
+	_fd = -1;
+}
+
+int FileWatch::fd() const {
+	return _fd;
+}
+
+bool FileWatch::changed() {
+	if(_fd < 0)
+		return false;
+
+	bool ours = false;
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while((len = read(_fd, buf, sizeof(buf))) > 0) {
+		for(char *at = buf; at < buf + len; ) {
+			struct inotify_event *event = (struct inotify_event *)at;
+			if(event->len > 0 && _name == event->name)
+				ours = true;
+			at += sizeof(struct inotify_event) + event->len;
+		}
+	}
+	return ours;
+}
@@ -0,0 +1,29 @@
+#ifndef FILEWATCH_HPP
+#define FILEWATCH_HPP
+
+#include <string>
+
+// FileWatch notices when a file is rewritten, using inotify on the file's
+// directory so that editors which replace the file by renaming are seen
+// as well as those writing it in place.
+struct FileWatch {
+	FileWatch() = default;
+	~FileWatch();
+
+	FileWatch(const FileWatch &rhs) = delete;
+	FileWatch &operator=(const FileWatch &rhs) = delete;
+
+	int watch(std::string path);
+	void close();
+
+	// descriptor which becomes readable on changes, -1 if not watching
+	int fd() const;
+	// consume pending events, returning whether any were for our file
+	bool changed();
+
+	protected:
+		int _fd{-1};
+		std::string _name{};
+};
+
+#endif // FILEWATCH_HPP
@@ -0,0 +1,157 @@
+#include "framing.hpp"
+using std::string;
+using std::vector;
+
+using framing::Frame;
+using framing::DecodeStatus;
+
+static void putU16(string &out, uint16_t v);
+void putU16(string &out, uint16_t v) {
+	out += (char)(v >> 8);
+	out += (char)(v & 0xFF);
+}
+static void putU32(string &out, uint32_t v);
+void putU32(string &out, uint32_t v) {
+	putU16(out, (uint16_t)(v >> 16));
+	putU16(out, (uint16_t)(v & 0xFFFF));
+}
+static void putStr(string &out, const string &str);
+void putStr(string &out, const string &str) {
+	// fields are bounded by the IRC line length, but don't trust that
+	size_t len = str.length() > 0xFFFF ? 0xFFFF : str.length();
+	putU16(out, (uint16_t)len);
+	out.append(str, 0, len);
+}
+
+// whether str has any of chars in it
+static bool hasAny(const string &str, const char *chars, size_t count);
+bool hasAny(const string &str, const char *chars, size_t count) {
+	return str.find_first_of(chars, 0, count) != string::npos;
+}
+// Whether msg becomes exactly one line when written out: nothing may
+// break the line, and only the last param may be empty, hold spaces or
+// start with ':'. Tag values are escaped when written, all but a NUL.
+static bool wellFormed(const IRCMessage &msg);
+bool wellFormed(const IRCMessage &msg) {
+	// the NUL is counted in, so it is searched for too
+	static const char breaks[] = "\r\n";
+	static const char words[] = "\r\n ";
+	static const char keys[] = "\r\n ;=";
+	for(auto &tag : msg._tags)
+		if(hasAny(tag.first, keys, sizeof(keys))
+				|| tag.second.find('\0') != string::npos)
+			return false;
+	if(hasAny(msg._prefix, words, sizeof(words))
+			|| hasAny(msg._command, words, sizeof(words)))
+		return false;
+	for(size_t i = 0; i < msg._params.size(); ++i) {
+		const string &param = msg._params[i];
+		if(hasAny(param, breaks, sizeof(breaks)))
+			return false;
+		if(i + 1 < msg._params.size() && (param.empty() || param[0] == ':'
+				|| param.find(' ') != string::npos))
+			return false;
+	}
+	return true;
+}
+
+// reads fields off of a buffer, remembering if it ever ran past the end
+struct Cursor {
+	const string &_buf;
+	size_t _pos;
+	size_t _end;
+	bool _ok{true};
+
+	Cursor(const string &buf, size_t pos, size_t end)
+		: _buf(buf), _pos(pos), _end(end) { }
+
+	uint16_t u16() {
+		if(_pos + 2 > _end) {
+			_ok = false;
+			return 0;
+		}
+		uint16_t v = (uint16_t)(((unsigned char)_buf[_pos] << 8)
+				| (unsigned char)_buf[_pos + 1]);
+		_pos += 2;
+		return v;
+	}
+	uint32_t u32() {
+		uint32_t high = u16();
+		return (high << 16) | u16();
+	}
+	string str() {
+		size_t len = u16();
+		if(!_ok || _pos + len > _end) {
+			_ok = false;
+			return "";
+		}
+		string s = _buf.substr(_pos, len);
+		_pos += len;
+		return s;
+	}
+};
+
+string framing::encode(const vector<Frame> &frames) {
+	string body;
+	for(auto &frame : frames) {
+		const IRCMessage &msg = frame._msg;
+		putU16(body, frame._network);
+		putU16(body, (uint16_t)msg._tags.size());
+		for(auto &tag : msg._tags) {
+			putStr(body, tag.first);
+			putStr(body, tag.second);
+		}
+		putStr(body, msg._prefix);
+		putStr(body, msg._command);
+		putU16(body, (uint16_t)msg._params.size());
+		for(auto &param : msg._params)
+			putStr(body, param);
+	}
+
+	string out;
+	out.reserve(8 + body.length());
+	putU32(out, (uint32_t)frames.size());
+	putU32(out, (uint32_t)body.length());
+	out += body;
+	return out;
+}
+
+DecodeStatus framing::decode(string &buf, vector<Frame> &frames) {
+	if(buf.length() < 8)
+		return DecodeStatus::Incomplete;
+
+	Cursor header(buf, 0, 8);
+	uint32_t count = header.u32(), length = header.u32();
+	// more messages than could fit in length means a corrupt header
+	if(length > maxBatchLength || count > length / minFrameLength)
+		return DecodeStatus::Corrupt;
+	if(buf.length() < 8 + (size_t)length)
+		return DecodeStatus::Incomplete;
+
+	Cursor c(buf, 8, 8 + length);
+	vector<Frame> batch;
+	for(uint32_t i = 0; i < count && c._ok; ++i) {
+		Frame frame;
+		frame._network = c.u16();
+		uint16_t ntags = c.u16();
+		for(uint16_t t = 0; t < ntags && c._ok; ++t) {
+			string key = c.str();
+			frame._msg._tags[key] = c.str();
+		}
+		frame._msg._prefix = c.str();
+		frame._msg._command = c.str();
+		uint16_t nparams = c.u16();
+		for(uint16_t p = 0; p < nparams && c._ok; ++p)
+			frame._msg._params.push_back(c.str());
+		// a message that wouldn't be one line could smuggle in others
+		if(c._ok && !wellFormed(frame._msg))
+			return DecodeStatus::Corrupt;
+		batch.push_back(frame);
+	}
+	if(!c._ok || c._pos != c._end)
+		return DecodeStatus::Corrupt;
+
+	buf.erase(0, 8 + length);
+	frames.insert(frames.end(), batch.begin(), batch.end());
+	return DecodeStatus::Ok;
+}
@@ -0,0 +1,49 @@
+#ifndef FRAMING_HPP
+#define FRAMING_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "ircmessage.hpp"
+
+// The framed protocol is an opt-in alternative to the newline protocol
+// between jitro and its binaries. Messages travel pre-parsed, in batches:
+//
+//   batch   := u32 count, u32 length, message{count}   (length of messages)
+//   message := u16 network, u16 ntags, (str key, str value){ntags},
+//              str prefix, str command, u16 nparams, str{nparams}
+//   str     := u16 length, byte{length}
+//
+// Integers are big endian. network is the index of the network in
+// irc.networks. Binaries send replies the same way, where network may
+// also be Broadcast. Control messages use the Control network: jitro
+// sends "NETWORKS <name>..." when a binary starts, and binaries may send
+// "QUERY <what> <args>..." on a network to be answered inline by a QUERY
+// message whose last param is the answer.
+//
+// Every message must make exactly one IRC line: no NUL anywhere, no CR
+// or LF outside tag values (which are escaped), no spaces in the prefix,
+// command or tag keys, and only the last param may be empty, contain
+// spaces or start with ':'. A batch with any other message is corrupt.
+namespace framing {
+	static const uint16_t Broadcast = 0xFFFF;
+	static const uint16_t Control = 0xFFFE;
+	// refuse batches larger than this, the stream is likely corrupt
+	static const uint32_t maxBatchLength = 16 * 1024 * 1024;
+	// the smallest a message can be: no tags, prefix, command or params
+	static const uint32_t minFrameLength = 10;
+
+	struct Frame {
+		uint16_t _network{0};
+		IRCMessage _msg{};
+	};
+
+	// Encode frames as a single batch
+	std::string encode(const std::vector<Frame> &frames);
+
+	enum class DecodeStatus { Ok, Incomplete, Corrupt };
+	// Decode a batch from the front of buf into frames, removing it from buf
+	DecodeStatus decode(std::string &buf, std::vector<Frame> &frames);
+}
+
+#endif // FRAMING_HPP
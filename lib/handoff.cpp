@@ -0,0 +1,117 @@
+#include "handoff.hpp"
+using std::string;
+using std::to_string;
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <cstdio>
+
+#include "util.hpp"
+using util::fromString;
+
+static const char *handoffEnv = "JITRO_HANDOFF_FD";
+
+void Handoff::set(string key, string value) {
+	_values[key] = value;
+}
+bool Handoff::has(string key) const {
+	return _values.find(key) != _values.end();
+}
+string Handoff::get(string key) const {
+	auto it = _values.find(key);
+	if(it == _values.end())
+		return "";
+	return it->second;
+}
+
+void Handoff::fd(string key, int fd) {
+	if(fd < 0)
+		return;
+	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) & ~FD_CLOEXEC);
+	set(key, to_string(fd));
+	_fds.push_back(fd);
+}
+int Handoff::fd(string key) const {
+	if(!has(key))
+		return -1;
+	int fd = fromString<int>(get(key));
+	fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+	return fd;
+}
+
+// entries are "<key length> <value length>\n<key><value>", so values may
+// hold anything, partial lines and binary data included
+int Handoff::save() {
+	string data;
+	for(auto &value : _values)
+		data += to_string(value.first.length()) + " "
+			+ to_string(value.second.length()) + "\n" + value.first + value.second;
+
+	int fd = memfd_create("jitro-handoff", 0);
+	if(fd < 0) {
+		perror("Handoff::save: memfd_create");
+		return -1;
+	}
+	for(size_t done = 0; done < data.length(); ) {
+		ssize_t wamount = ::write(fd, data.data() + done, data.length() - done);
+		if(wamount <= 0) {
+			perror("Handoff::save: write");
+			::close(fd);
+			return -1;
+		}
+		done += wamount;
+	}
+	lseek(fd, 0, SEEK_SET);
+	setenv(handoffEnv, to_string(fd).c_str(), 1);
+	_memfd = fd;
+	return 0;
+}
+
+void Handoff::abandon() {
+	for(int fd : _fds)
+		fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
+	_fds.clear();
+	if(_memfd >= 0) {
+		::close(_memfd);
+		unsetenv(handoffEnv);
+	}
+	_memfd = -1;
+}
+
+int Handoff::load() {
+	const char *env = getenv(handoffEnv);
+	if(!env)
+		return -1;
+	int fd = atoi(env);
+	unsetenv(handoffEnv);
+
+	string data;
+	char buf[16 * 1024];
+	ssize_t ramount;
+	while((ramount = ::read(fd, buf, sizeof(buf))) > 0)
+		data.append(buf, ramount);
+	::close(fd);
+
+	for(size_t pos = 0; pos < data.length(); ) {
+		size_t nl = data.find('\n', pos);
+		if(nl == string::npos)
+			return -1;
+		string lengths = data.substr(pos, nl - pos);
+		size_t space = lengths.find(' ');
+		if(space == string::npos)
+			return -1;
+		size_t klen = fromString<size_t>(lengths.substr(0, space)),
+			vlen = fromString<size_t>(lengths.substr(space + 1));
+		if(nl + 1 + klen + vlen > data.length())
+			return -1;
+		_values[data.substr(nl + 1, klen)] = data.substr(nl + 1 + klen, vlen);
+		pos = nl + 1 + klen + vlen;
+	}
+	return 0;
+}
+
+bool Handoff::empty() const {
+	return _values.empty();
+}
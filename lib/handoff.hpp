@@ -0,0 +1,42 @@
+#ifndef HANDOFF_HPP
+#define HANDOFF_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+
+// Handoff carries state from a running jitro to the new binary it execs
+// into. Everything is a string under a dotted key; descriptors stay open
+// across the exec and are passed by number. The whole thing travels in a
+// memfd whose number is put in the environment.
+struct Handoff {
+	void set(std::string key, std::string value);
+	bool has(std::string key) const;
+	// value under key, or blank
+	std::string get(std::string key) const;
+
+	// Pass fd on, making sure it survives the exec
+	void fd(std::string key, int fd);
+	// descriptor passed under key, or -1. It is made close-on-exec again,
+	// so it doesn't leak into anything we start.
+	int fd(std::string key) const;
+
+	// Write ourselves out and point the environment at it, before exec
+	int save();
+	// The exec didn't happen: make what was passed on close-on-exec again
+	// and drop what save() left, so none of it leaks into what we start
+	void abandon();
+	// In the new process, pick up whatever the old one left (returns -1
+	// if this isn't a handoff)
+	int load();
+
+	bool empty() const;
+
+	protected:
+		std::map<std::string, std::string> _values{};
+		// descriptors passed on, and the memfd save() wrote us to
+		std::vector<int> _fds{};
+		int _memfd{-1};
+};
+
+#endif // HANDOFF_HPP
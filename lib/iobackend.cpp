@@ -0,0 +1,147 @@
+#include "iobackend.hpp"
+using std::string;
+using std::vector;
+using std::unordered_map;
+
+#include <iostream>
+using std::cerr;
+using std::endl;
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <cerrno>
+#include <cstdio>
+
+IOBackend *IOBackend::_current = nullptr;
+
+IOBackend::~IOBackend() {
+	if(_current == this)
+		_current = nullptr;
+}
+
+void IOBackend::forget(int) { }
+
+IOBackend *IOBackend::create(string kind) {
+	IOBackend *backend = nullptr;
+	if(kind == "auto" || kind == "io_uring") {
+		UringBackend *uring = new UringBackend();
+		if(uring->open(1024) == 0)
+			backend = uring;
+		else
+			delete uring;
+	}
+	if(!backend && kind != "poll") {
+		EpollBackend *epoll = new EpollBackend();
+		if(epoll->open() == 0)
+			backend = epoll;
+		else
+			delete epoll;
+	}
+	if(!backend)
+		backend = new PollBackend();
+	if(kind != "auto" && kind != backend->name())
+		cerr << "IOBackend::create: " << kind << " is unavailable, using "
+			<< backend->name() << endl;
+	_current = backend;
+	return backend;
+}
+
+void IOBackend::closing(int fd) {
+	if(_current && fd >= 0)
+		_current->forget(fd);
+}
+
+
+int PollBackend::wait(vector<struct pollfd> &fds, int timeout) {
+	return poll(fds.data(), fds.size(), timeout);
+}
+
+string PollBackend::name() const {
+	return "poll";
+}
+
+
+EpollBackend::~EpollBackend() {
+	if(_fd >= 0)
+		close(_fd);
+}
+
+int EpollBackend::open() {
+	_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(_fd < 0) {
+		perror("EpollBackend::open");
+		return -1;
+	}
+	return 0;
+}
+
+int EpollBackend::wait(vector<struct pollfd> &fds, int timeout) {
+	// bring the registrations in line with fds
+	unordered_map<int, size_t> index;
+	for(size_t i = 0; i < fds.size(); ++i) {
+		struct pollfd &pfd = fds[i];
+		pfd.revents = 0;
+		index[pfd.fd] = i;
+		auto it = _registered.find(pfd.fd);
+		if(it != _registered.end() && it->second == pfd.events)
+			continue;
+
+		// poll and epoll share their event bits
+		struct epoll_event ev{};
+		ev.events = (uint32_t)pfd.events;
+		ev.data.fd = pfd.fd;
+		int op = it == _registered.end() ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+		int res = epoll_ctl(_fd, op, pfd.fd, &ev);
+		if(res < 0 && errno == EEXIST)
+			res = epoll_ctl(_fd, EPOLL_CTL_MOD, pfd.fd, &ev);
+		else if(res < 0 && errno == ENOENT)
+			res = epoll_ctl(_fd, EPOLL_CTL_ADD, pfd.fd, &ev);
+		if(res < 0) {
+			// poll would say as much about a descriptor it can't use
+			pfd.revents = POLLNVAL;
+			_registered.erase(pfd.fd);
+			continue;
+		}
+		_registered[pfd.fd] = pfd.events;
+	}
+	for(auto it = _registered.begin(); it != _registered.end(); ) {
+		if(index.count(it->first)) {
+			++it;
+			continue;
+		}
+		epoll_ctl(_fd, EPOLL_CTL_DEL, it->first, nullptr);
+		it = _registered.erase(it);
+	}
+
+	int ready = 0;
+	for(auto &pfd : fds)
+		ready += pfd.revents != 0;
+	if(ready)
+		timeout = 0;
+
+	vector<struct epoll_event> events(fds.empty() ? 1 : fds.size());
+	int count = epoll_wait(_fd, events.data(), (int)events.size(), timeout);
+	if(count < 0)
+		return ready ? ready : -1;
+	for(int i = 0; i < count; ++i) {
+		auto it = index.find(events[i].data.fd);
+		if(it == index.end())
+			continue;
+		struct pollfd &pfd = fds[it->second];
+		if(!pfd.revents)
+			ready++;
+		pfd.revents |= (short)events[i].events;
+	}
+	return ready;
+}
+
+void EpollBackend::forget(int fd) {
+	if(!_registered.erase(fd))
+		return;
+	// a copy held elsewhere (say by a child) would keep it registered
+	epoll_ctl(_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+string EpollBackend::name() const {
+	return "epoll";
+}
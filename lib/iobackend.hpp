@@ -0,0 +1,121 @@
+#ifndef IOBACKEND_HPP
+#define IOBACKEND_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <poll.h>
+#include <linux/time_types.h>
+
+// IOBackend is how the main loop waits for its descriptors. Every backend
+// takes the same pollfd list poll(2) does and fills in revents the same
+// way, but the ones other than poll keep what they were given registered
+// in the kernel between calls, so an unchanged set costs nothing to wait
+// on again and only changes to it are submitted.
+//
+// Since registrations outlive a descriptor's use, code closing anything it
+// may have handed out to be waited on must call IOBackend::closing first.
+struct IOBackend {
+	IOBackend() = default;
+	virtual ~IOBackend();
+
+	IOBackend(const IOBackend &rhs) = delete;
+	IOBackend &operator=(const IOBackend &rhs) = delete;
+
+	// Wait up to timeout ms (-1 forever) for one of fds to be ready,
+	// returning how many are as poll(2) would
+	virtual int wait(std::vector<struct pollfd> &fds, int timeout) = 0;
+	// fd is about to be closed, so drop anything held on it
+	virtual void forget(int fd);
+	virtual std::string name() const = 0;
+
+	// Make the backend called kind ("io_uring", "epoll" or "poll"), falling
+	// back to the next in that order if it can't be had here. "auto" is
+	// the first that works.
+	static IOBackend *create(std::string kind);
+	// tell the backend in use, if any, that fd is about to be closed
+	static void closing(int fd);
+
+	protected:
+		static IOBackend *_current;
+};
+
+// PollBackend is plain poll(2), which everything supports
+struct PollBackend : IOBackend {
+	int wait(std::vector<struct pollfd> &fds, int timeout) override;
+	std::string name() const override;
+};
+
+// EpollBackend keeps descriptors registered with a level triggered epoll
+// instance, adding, changing or removing only what differs between waits
+struct EpollBackend : IOBackend {
+	~EpollBackend() override;
+
+	int open();
+	int wait(std::vector<struct pollfd> &fds, int timeout) override;
+	void forget(int fd) override;
+	std::string name() const override;
+
+	protected:
+		int _fd{-1};
+		// what each descriptor is registered for
+		std::unordered_map<int, short> _registered{};
+};
+
+// UringBackend waits with io_uring, talked to through the raw syscalls.
+// Each descriptor has a one shot poll armed for it, which stays armed
+// until it fires; only fired or changed ones are armed again, and all of
+// that is submitted along with the wait itself in a single io_uring_enter.
+struct UringBackend : IOBackend {
+	~UringBackend() override;
+
+	int open(unsigned entries);
+	int wait(std::vector<struct pollfd> &fds, int timeout) override;
+	void forget(int fd) override;
+	std::string name() const override;
+
+	protected:
+		struct Armed {
+			short _events{0};
+			uint32_t _generation{0};
+		};
+
+		// next free submission entry, submitting what's queued to make room
+		struct io_uring_sqe *_sqe();
+		void _arm(int fd, short events);
+		void _disarm(int fd);
+		// submit everything queued, waiting for at least wait completions
+		int _enter(unsigned wait);
+		// take completed polls into _ready
+		void _reap();
+		void _close();
+
+	protected:
+		int _fd{-1};
+		void *_sqRing{nullptr};
+		size_t _sqRingSize{0};
+		void *_cqRing{nullptr};
+		size_t _cqRingSize{0};
+		struct io_uring_sqe *_sqes{nullptr};
+		size_t _sqesSize{0};
+
+		unsigned *_sqHead{nullptr};
+		unsigned *_sqTail{nullptr};
+		unsigned *_sqMask{nullptr};
+		unsigned *_sqArray{nullptr};
+		unsigned _sqEntries{0};
+		unsigned *_cqHead{nullptr};
+		unsigned *_cqTail{nullptr};
+		unsigned *_cqMask{nullptr};
+		struct io_uring_cqe *_cqes{nullptr};
+
+		// polls in the kernel, and what fired since they were reported
+		std::unordered_map<int, Armed> _armed{};
+		std::unordered_map<int, short> _ready{};
+		// tells a stale completion from one for the current poll on an fd
+		uint32_t _generation{0};
+		struct __kernel_timespec _timeout{};
+};
+
+#endif // IOBACKEND_HPP
@@ -0,0 +1,145 @@
+#include "ircmessage.hpp"
+using std::string;
+using std::vector;
+
+// unescape a message tag value as per the IRCv3 message-tags spec
+static string unescapeTag(string value);
+string unescapeTag(string value) {
+	string res;
+	res.reserve(value.length());
+	for(size_t i = 0; i < value.length(); ++i) {
+		if(value[i] != '\\') {
+			res += value[i];
+			continue;
+		}
+		if(++i >= value.length())
+			break;
+		switch(value[i]) {
+			case ':': res += ';'; break;
+			case 's': res += ' '; break;
+			case 'r': res += '\r'; break;
+			case 'n': res += '\n'; break;
+			default: res += value[i]; break;
+		}
+	}
+	return res;
+}
+
+// escape a message tag value as per the IRCv3 message-tags spec
+static string escapeTag(string value);
+string escapeTag(string value) {
+	string res;
+	res.reserve(value.length());
+	for(auto c : value) {
+		switch(c) {
+			case ';': res += "\\:"; break;
+			case ' ': res += "\\s"; break;
+			case '\r': res += "\\r"; break;
+			case '\n': res += "\\n"; break;
+			case '\\': res += "\\\\"; break;
+			default: res += c; break;
+		}
+	}
+	return res;
+}
+
+IRCMessage IRCMessage::parse(string line) {
+	IRCMessage msg;
+	size_t pos = 0, len = line.length();
+
+	// message tags
+	if(pos < len && line[pos] == '@') {
+		size_t end = line.find(' ', pos);
+		if(end == string::npos)
+			end = len;
+		string tags = line.substr(pos + 1, end - pos - 1);
+		size_t tpos = 0;
+		while(tpos <= tags.length()) {
+			size_t tend = tags.find(';', tpos);
+			if(tend == string::npos)
+				tend = tags.length();
+			string tag = tags.substr(tpos, tend - tpos);
+			if(!tag.empty()) {
+				size_t eq = tag.find('=');
+				if(eq == string::npos)
+					msg._tags[tag] = "";
+				else
+					msg._tags[tag.substr(0, eq)] = unescapeTag(tag.substr(eq + 1));
+			}
+			tpos = tend + 1;
+		}
+		pos = line.find_first_not_of(' ', end);
+		if(pos == string::npos)
+			return msg;
+	}
+
+	// prefix
+	if(pos < len && line[pos] == ':') {
+		size_t end = line.find(' ', pos);
+		if(end == string::npos)
+			end = len;
+		msg._prefix = line.substr(pos + 1, end - pos - 1);
+		pos = line.find_first_not_of(' ', end);
+		if(pos == string::npos)
+			return msg;
+	}
+
+	// command
+	size_t end = line.find(' ', pos);
+	if(end == string::npos)
+		end = len;
+	msg._command = line.substr(pos, end - pos);
+	pos = line.find_first_not_of(' ', end);
+
+	// params, the last of which may be a ':' trailing param
+	while(pos != string::npos && pos < len) {
+		if(line[pos] == ':') {
+			msg._params.push_back(line.substr(pos + 1));
+			break;
+		}
+		end = line.find(' ', pos);
+		if(end == string::npos)
+			end = len;
+		msg._params.push_back(line.substr(pos, end - pos));
+		pos = line.find_first_not_of(' ', end);
+	}
+
+	return msg;
+}
+
+string IRCMessage::str() const {
+	string line;
+	if(!_tags.empty()) {
+		line += "@";
+		for(auto &tag : _tags) {
+			if(line.length() > 1)
+				line += ";";
+			line += tag.first;
+			if(!tag.second.empty())
+				line += "=" + escapeTag(tag.second);
+		}
+		line += " ";
+	}
+	if(!_prefix.empty())
+		line += ":" + _prefix + " ";
+	line += _command;
+	for(size_t i = 0; i < _params.size(); ++i) {
+		const string &param = _params[i];
+		// only the last param may contain spaces or be empty
+		bool trailing = param.empty() || param[0] == ':'
+			|| param.find(' ') != string::npos;
+		line += (trailing && i + 1 == _params.size()) ? " :" : " ";
+		line += param;
+	}
+	return line;
+}
+
+string IRCMessage::nick() const {
+	return _prefix.substr(0, _prefix.find('!'));
+}
+
+string IRCMessage::param(size_t idx) const {
+	if(idx >= _params.size())
+		return "";
+	return _params[idx];
+}
@@ -0,0 +1,26 @@
+#ifndef IRCMESSAGE_HPP
+#define IRCMESSAGE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+
+// IRCMessage is a single parsed protocol line: [@tags] [:prefix] command params
+struct IRCMessage {
+	std::map<std::string, std::string> _tags{};
+	std::string _prefix{};
+	std::string _command{};
+	std::vector<std::string> _params{};
+
+	// Parse a raw line (without the trailing "\r\n")
+	static IRCMessage parse(std::string line);
+	// Serialize back into a raw line (without the trailing "\r\n")
+	std::string str() const;
+
+	// nick portion of the prefix (everything before the '!')
+	std::string nick() const;
+	// parameter at index, or blank if there isn't one
+	std::string param(size_t idx) const;
+};
+
+#endif // IRCMESSAGE_HPP
@@ -4,139 +4,474 @@ using std::to_string;
 using std::vector;
 
 #include <algorithm>
-using std::find;
 using std::min;
+#include <map>
+using std::map;
 #include <iostream>
 using std::cerr;
 using std::endl;
-#include <fstream>
-using std::ofstream;
-using std::ios_base;
+#include <memory>
+using std::shared_ptr;
+using std::make_shared;
+#include <thread>
+using std::thread;
 #include <mutex>
-using std::recursive_mutex;
+using std::mutex;
 using std::lock_guard;
+#include <chrono>
+using std::chrono::seconds;
+using std::chrono::milliseconds;
+using std::chrono::duration_cast;
+using std::chrono::system_clock;
 
 #include <unistd.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
 #include <netdb.h>
 #include <cstring>
+#include <ctime>
 
+#include "iobackend.hpp"
+#include "logger.hpp"
+#include "probes.hpp"
 #include "util.hpp"
 using util::contains;
 using util::startsWith;
 using util::toString;
-using util::formatTime;
 using util::trim;
 using util::split;
-
-static string logName = "ircsock.log";
-static ofstream logFile;
-
-static void log(string host, string line);
-void log(string host, string line) {
-	static recursive_mutex mut;
-	lock_guard<recursive_mutex> lock(mut);
-	// TODO: scope_guard and move into log or something
-	static bool _triedInit = false;
-	if(!_triedInit) {
-		logFile.open(logName, ios_base::app);
-		_triedInit = true;
-		string dashes = " ------------------------------ ";
-		log(host, dashes + " STARTED " + dashes);
-	}
-	if(logFile.good()) {
-		if(trim(line).length() > 0)
-			logFile << formatTime("%s") << ":" << host << ":" << line << endl;
-	}
-}
+using util::fromString;
+using util::base64;
 
 AddressInfo::AddressInfo(struct addrinfo *ai) : _ai(ai) { }
 AddressInfo::AddressInfo(AddressInfo &&rhs) : _ai(rhs._ai) { rhs._ai = nullptr; }
 AddressInfo::~AddressInfo() { if(_ai) freeaddrinfo(_ai); }
 struct addrinfo *AddressInfo::operator()() { return _ai; }
 
+// what a Resolver shares with its thread, which only touches it holding
+// _mutex and leaves it alone once _abandoned
+struct Resolver::Lookup {
+	mutex _mutex{};
+	int _fd{-1};
+	bool _done{false};
+	bool _abandoned{false};
+	struct addrinfo *_result{nullptr};
+	int _error{0};
+
+	Lookup() = default;
+	Lookup(const Lookup &rhs) = delete;
+	Lookup &operator=(const Lookup &rhs) = delete;
+};
+
+Resolver::Resolver(string host, int port) : _lookup(make_shared<Lookup>()) {
+	_lookup->_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(_lookup->_fd < 0)
+		perror("Resolver::Resolver: eventfd");
+	shared_ptr<Lookup> lookup = _lookup;
+	thread([lookup, host, port]() {
+		// IPv4 only, as our sockets are
+		struct addrinfo *result = nullptr, hints;
+		::memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_protocol = 0;
+		hints.ai_flags = (AI_V4MAPPED | AI_ADDRCONFIG); // defaults for no hints
+		int error = ::getaddrinfo(host.c_str(), to_string(port).c_str(),
+				&hints, &result);
+
+		lock_guard<mutex> guard(lookup->_mutex);
+		if(lookup->_abandoned) {
+			if(!error)
+				freeaddrinfo(result);
+			return;
+		}
+		lookup->_result = error ? nullptr : result;
+		lookup->_error = error;
+		lookup->_done = true;
+		if(lookup->_fd >= 0)
+			eventfd_write(lookup->_fd, 1);
+	}).detach();
+}
+Resolver::~Resolver() {
+	lock_guard<mutex> guard(_lookup->_mutex);
+	_lookup->_abandoned = true;
+	if(_lookup->_result)
+		freeaddrinfo(_lookup->_result);
+	_lookup->_result = nullptr;
+	if(_lookup->_fd >= 0) {
+		IOBackend::closing(_lookup->_fd);
+		close(_lookup->_fd);
+	}
+	_lookup->_fd = -1;
+}
 
-IRCSock::IRCSock(string host, int port, string nick, string password)
-		: _host(host), _port(port), _nick(nick), _password(password) {
+int Resolver::fd() const {
+	return _lookup->_fd;
+}
+bool Resolver::done() const {
+	lock_guard<mutex> guard(_lookup->_mutex);
+	return _lookup->_done;
+}
+AddressInfo Resolver::take() {
+	lock_guard<mutex> guard(_lookup->_mutex);
+	struct addrinfo *result = _lookup->_result;
+	_lookup->_result = nullptr;
+	return result;
+}
+string Resolver::error() const {
+	lock_guard<mutex> guard(_lookup->_mutex);
+	return _lookup->_error ? gai_strerror(_lookup->_error) : "";
+}
+
+
+IRCSock::IRCSock(TimerWheel &timers, vector<Server> servers,
+		vector<string> nicks, map<string, string> passwords)
+		: _servers(servers), _timers(&timers), _nicks(nicks),
+		_passwords(passwords) {
+	_nick = _primary();
+	_password = _passwordFor(_nick);
+	if(!_servers.empty()) {
+		_host = _servers[0]._host;
+		_port = _servers[0]._port;
+	}
+	_reconnectTimer = _timers->after(seconds(0), [this]() {
+		_reconnectTimer = TimerWheel::None;
+		this->connect();
+	});
 }
 
 // TODO: handle disconnecting
 IRCSock::~IRCSock() {
 	_quit();
-}
-
-string extractNick(string from);
-string extractNick(string from) {
-	if(from.find("!") == string::npos)
-		return from;
-	return from.substr(0, from.find("!"));
+	_cancelTimers();
 }
 
 void IRCSock::_quit() {
-	if(_socket < 0 || _mstatus == Status::Disconnected)
+	if(_mstatus != Status::Connected && _mstatus != Status::Connecting)
 		return;
-	send("QUIT :goodbye"); // TODO
-	_trySend();
+	delete _resolver;
+	_resolver = nullptr;
+	// there's nothing to say it over until we're connected and a TLS
+	// handshake is done
+	if(!_quitting && _mstatus == Status::Connected
+			&& (!_tls || _tls->established())) {
+		send("QUIT :goodbye");
+		_trySend();
+	}
+	delete _tls;
+	_tls = nullptr;
 
 	_connectionTries = 0;
-	_lastConnectionTry = 0;
+	_cancelTimers();
 
 	_mstatus = Status::Disconnected;
 	_nstatus = NickStatus::NeedsSent;
-	_cstatus.clear();
+	for(auto &cs : _cstatus)
+		cs._status = ChannelStatus::None;
+	_isupport.clear();
+	_members.clear();
 
 	_hasMOTD = false;
+	_welcomed = _canJoin = false;
+	_offeredCaps.clear();
+	_caps.clear();
+	_capNegotiating = false;
+	_sasl = SaslStatus::None;
 
 	_br.clear();
+	// whatever didn't make it out is for the next connection to resend
+	_queued -= _wbuf.length();
+	_wbuf.clear();
 
-	usleep(1000);
-	if(_socket >= 0)
+	if(_socket >= 0) {
+		IOBackend::closing(_socket);
 		close(_socket);
+	}
+	_socket = -1;
+}
+
+void IRCSock::_scheduleConnect() {
+	_timers->cancel(_reconnectTimer);
+	if(_quitting)
+		return;
+	if(_connectionTries > _maxConnectionTries) {
+		cerr << "IRCSock::connect: giving up on " << _host << endl;
+		_mstatus = Status::Failed;
+		return;
+	}
+	// back off exponentially between attempts
+	int delay = min(1 << _connectionTries, _maxConnectionDelay);
+	_reconnectTimer = _timers->after(seconds(delay), [this]() {
+		_reconnectTimer = TimerWheel::None;
+		this->connect();
+	});
+}
+
+// what the session waits on the server for: being let in, and the end of
+// the MOTD (or word that there is none)
+static const vector<string> welcomed = { "001" };
+static const vector<string> motdDone = { "376", "422" };
+
+// gcc's lowering of coroutines trips this on switches of its own making
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wswitch-default"
+
+Task IRCSock::_watchPing() {
+	// rather than moving a timer on every line, wake when the last line would
+	// be too old and see whether another has come since
+	while(TimerWheel::now() - _lastMessage < seconds(_pingTimeout))
+		co_await Sleep(*_timers, _lastMessage + seconds(_pingTimeout));
+	cerr << "IRCSock::process: " << _host << " pinged out" << endl;
+	_drop(false, false);
+}
+
+Task IRCSock::_probe() {
+	while(true) {
+		co_await Sleep(*_timers, TimerWheel::now() + seconds(_probeInterval));
+		// don't stack up probes on a server that isn't answering them
+		if(_probeToken.empty()) {
+			_probeSent = TimerWheel::now();
+			_probeToken = "jitro-" + to_string(duration_cast<milliseconds>(
+						_probeSent.time_since_epoch()).count());
+			send("PING :" + _probeToken);
+			_trySend();
+		}
+		if(_checkLag())
+			co_return;
+	}
+}
+
+bool IRCSock::_checkLag() {
+	// a probe we're still waiting on counts for at least as long as it's been
+	// out, otherwise a server which has stopped answering would look fine
+	TimerWheel::TimePoint now = TimerWheel::now();
+	TimerWheel::Duration current = _lagAverage;
+	if(!_probeToken.empty() && now - _probeSent > current)
+		current = now - _probeSent;
+
+	if(_lagThreshold <= 0 || current < seconds(_lagThreshold)) {
+		_lagging = false;
+		return false;
+	}
+	if(!_lagging) {
+		_lagging = true;
+		_laggingSince = now;
+		return false;
+	}
+	if(now - _laggingSince < seconds(_lagWindow) || _servers.size() < 2)
+		return false;
+
+	cerr << "IRCSock::process: " << _host << " has lagged "
+		<< duration_cast<milliseconds>(current).count() << "ms for "
+		<< _lagWindow << "s, switching servers" << endl;
+	_drop(true, false);
+	return true;
+}
+
+Task IRCSock::_session(bool introduce) {
+	// looking the server up and connecting to it, unless we're resuming a
+	// connection already made
+	if(_mstatus == Status::Connecting) {
+		TimerWheel::TimePoint connectBy = TimerWheel::now()
+			+ seconds(_connectTimeout);
+		while(!_resolver->done()) {
+			if(!co_await _io.wait(*_timers, connectBy - TimerWheel::now())) {
+				cerr << "IRCSock::connect: looking up " << _host << " timed out"
+					<< endl;
+				_drop(true, true);
+				co_return;
+			}
+		}
+		AddressInfo ai = _resolver->take();
+		if(!ai()) {
+			cerr << "IRCSock::connect: failed to look up " << _host << ": "
+				<< _resolver->error() << endl;
+			_drop(true, true);
+			co_return;
+		}
+		delete _resolver;
+		_resolver = nullptr;
+
+		if(!_open(ai)) {
+			_drop(true, true);
+			co_return;
+		}
+		while(!_writable) {
+			if(!co_await _io.wait(*_timers, connectBy - TimerWheel::now())) {
+				cerr << "IRCSock::connect: connecting to " << server()
+					<< " timed out" << endl;
+				_drop(true, true);
+				co_return;
+			}
+		}
+		if(!_connected()) {
+			_drop(true, true);
+			co_return;
+		}
+	}
+
+	TimerWheel::TimePoint deadline = TimerWheel::now() + seconds(_registerTimeout);
+
+	// nothing goes over TLS until the handshake is done
+	while(_tls && !_tls->established()) {
+		int res = _tls->handshake();
+		if(res < 0) {
+			cerr << "IRCSock::process: TLS handshake with " << server()
+				<< " failed" << endl;
+			_drop(true, true);
+			co_return;
+		}
+		if(res == 0 && !co_await _io.wait(*_timers, deadline - TimerWheel::now())) {
+			cerr << "IRCSock::process: TLS handshake with " << server()
+				<< " timed out" << endl;
+			_drop(true, true);
+			co_return;
+		}
+	}
+
+	if(introduce) {
+		// servers that know CAP hold registration until we END it
+		if(!_wantedCaps.empty() || (_useSasl && !_password.empty()))
+			_commandQueue.push_back(Command(CommandType::Cap, "LS 302"));
+		_commandQueue.push_back(Command(CommandType::Nick, _nick));
+		_commandQueue.push_back(Command(CommandType::User, _nick));
+	}
+
+	// capabilities, SASL and nick troubles are seen to as the server brings
+	// them up; all that matters here is that it accepts us in the end
+	if(!_welcomed && !co_await _expect(welcomed, deadline)) {
+		cerr << "IRCSock::process: " << _host << " didn't accept us within "
+			<< _registerTimeout << "s" << endl;
+		_drop(true, true);
+		co_return;
+	}
+
+	// channels wait for us to identify, unless SASL saw to it or there is
+	// nothing to identify with; NickServ only listens once the MOTD is done
+	if(!_canJoin && _sasl != SaslStatus::Succeeded) {
+		if(_passwordFor(_nick).empty())
+			_nstatus = NickStatus::NoAuth;
+		else {
+			if(!_hasMOTD && !co_await _expect(motdDone,
+						TimerWheel::now() + seconds(_motdTimeout)))
+				cerr << "IRCSock::process: no end to the MOTD from " << _host
+					<< ", identifying anyway" << endl;
+			_commandQueue.push_back(Command(CommandType::Identify,
+						_passwordFor(_nick)));
+		}
+	}
+	_canJoin = true;
+
+	// joins left for now are retried on their own timers
+	for(NameTable::Id id = 0; id < _cstatus.size(); ++id) {
+		ChannelState &cs = _cstatus[id];
+		if(_chans.valid(id) && cs._wanted && (cs._status == ChannelStatus::None
+					|| cs._status == ChannelStatus::Parted))
+			_commandQueue.push_back(Command(CommandType::Join, _chans.name(id)));
+	}
+}
+
+#pragma GCC diagnostic pop
+
+Trigger::Wait IRCSock::_expect(vector<string> commands,
+		TimerWheel::TimePoint deadline) {
+	_awaited = commands;
+	return _reply.wait(*_timers, deadline - TimerWheel::now());
+}
+
+void IRCSock::_drop(bool nextServer, bool backOff) {
+	_timers->cancel(_reconnectTimer);
+	_reconnectTimer = _timers->after(seconds(0), [this, nextServer, backOff]() {
+		_reconnectTimer = TimerWheel::None;
+		int tries = _connectionTries;
+		_quit();
+		if(backOff)
+			_connectionTries = tries;
+		if(nextServer)
+			_nextServer();
+		_scheduleConnect();
+	});
+}
+
+void IRCSock::_nextServer() {
+	if(_servers.empty())
+		return;
+	_server = (_server + 1) % _servers.size();
+	_host = _servers[_server]._host;
+	_port = _servers[_server]._port;
+}
+
+void IRCSock::_retryJoin(NameTable::Id id) {
+	ChannelState &cs = _channel(id);
+	_timers->cancel(cs._retryTimer);
+	int delay = min(_joinRetryDelay << min(cs._joinTries, 16), _maxJoinRetryDelay);
+	cs._retryTimer = _timers->schedule(cs._lastJoin + seconds(delay), [this, id]() {
+		ChannelState &retry = _channel(id);
+		retry._retryTimer = TimerWheel::None;
+		if(retry._wanted && retry._status == ChannelStatus::Failed
+				&& _mstatus == Status::Connected)
+			_commandQueue.push_back(Command(CommandType::Join, _chans.name(id)));
+	});
+}
+
+void IRCSock::_cancelTimers() {
+	_sessionTask.cancel();
+	_pingTask.cancel();
+	_probeTask.cancel();
+	_timers->cancel(_reclaimTimer);
+	for(auto &cs : _cstatus)
+		_timers->cancel(cs._retryTimer);
+	_probeToken.clear();
 }
 
 bool IRCSock::process() {
+	// the session looks the server up and connects to it
+	if(_mstatus == Status::Connecting)
+		_io.fire();
 	switch(_mstatus) {
 		case Status::Connected:
 			break;
-		case Status::Disconnected: {
-			time_t now = time(NULL);
-			if(_connectionTries > _maxConnectionTries) {
-				_mstatus = Status::Failed;
-				return false;
-			}
-			// make sure we've waited long enough before retrying
-			int delay = min(1 << _connectionTries, _maxConnectionDelay);
-			if((now - _lastConnectionTry) < delay)
-				return false;
-
-			// attempt to connect
-			this->connect();
-			return true;
-		}
+		// connecting is up to the session, reconnecting to _reconnectTimer
+		case Status::Connecting:
+		case Status::Disconnected:
 		case Status::Failed:
 		case Status::INVALID:
 		default:
 			return false;
 	}
 
-	time_t now = time(NULL);
-	// if we've pinged out
-	if(now - _lastMessage > _pingTimeout) {
-		_quit();
-		return true;
+	// the session does the TLS handshake, and nothing goes over TLS until
+	// it's done
+	if(_tls && !_tls->established()) {
+		_io.fire();
+		if(!_tls->established())
+			return false;
 	}
 
 	bool didSomething = !_commandQueue.empty();
 	vector<Command> ncomms{};
-	for(int i = 0; i < _commandQueue.size(); ++i) {
+	// compatible commands are held back here so they can share a line
+	vector<string> joins{}, msgTargets{};
+	string msgText{};
+	for(size_t i = 0; i < _commandQueue.size(); ++i) {
 		Command &comm = _commandQueue[i];
 
+		if(comm._type != CommandType::Join)
+			_flushJoins(joins);
+		if(comm._type != CommandType::Msg || comm._args[1] != msgText)
+			_flushMsgs(msgTargets, msgText);
+
 		switch(comm._type) {
 			case CommandType::Nick:
 				send("NICK " + comm._args[0]);
 				//usleep(10000);
+				_pendingNick = comm._args[0];
+				// until we're registered, the nick we asked for is ours
+				// unless the server says otherwise
+				if(!_welcomed)
+					_nick = _pendingNick;
 				_nstatus = NickStatus::Sent;
 				break;
 			case CommandType::User:
@@ -144,7 +479,7 @@ bool IRCSock::process() {
 				//usleep(10000);
 				break;
 			case CommandType::Identify:
-				if(!_password.empty()) {
+				if(!comm._args[0].empty()) {
 					send("PRIVMSG NickServ :identify " + comm._args[0]);
 					//usleep(10000);
 					_nstatus = NickStatus::Verified;
@@ -152,29 +487,49 @@ bool IRCSock::process() {
 					_nstatus = NickStatus::NoAuth;
 				}
 				break;
+			case CommandType::Cap:
+				send("CAP " + comm._args[0]);
+				_capNegotiating = true;
+				break;
 			case CommandType::Join:
-				if(_hasMOTD) {
-					send("JOIN " + comm._args[0]);
-					//usleep(100000);
-				} else
-					ncomms.push_back(comm);
+				joins.push_back(comm._args[0]);
 				break;
 			case CommandType::Part:
 				send("PART " + comm._args[0]);
-				_cstatus[comm._args[0]] = ChannelStatus::Parted;
+				_channel(_chans.intern(comm._args[0]))._status = ChannelStatus::Parted;
 				break;
 			case CommandType::Msg:
-				// TODO: join chan if not in chan?
-				send("PRIVMSG " + comm._args[0] + " :" + comm._args[1]);
+				// hold messages for a channel until we're in it
+				if(joining(comm._args[0])) {
+					ncomms.push_back(comm);
+					break;
+				}
+				// the same text twice to one target is two messages, not
+				// one naming it twice
+				for(auto &target : msgTargets) {
+					if(caseEqual(target, comm._args[0], _chans.caseMapping())) {
+						_flushMsgs(msgTargets, msgText);
+						break;
+					}
+				}
+				msgTargets.push_back(comm._args[0]);
+				msgText = comm._args[1];
 				break;
 			case CommandType::Quit:
-				_quit();
+				// what comes after is never sent; the server hangs up on us
+				// once it has the QUIT
+				send("QUIT :" + comm._args[0]);
+				_quitting = true;
+				_commandQueue.clear();
+				_trySend();
 				return true;
 			case CommandType::INVALID:
 			default:
 				break; // TODO
 		}
 	}
+	_flushJoins(joins);
+	_flushMsgs(msgTargets, msgText);
 	_commandQueue = ncomms;
 
 	// try sending anything we may be waiting to send
@@ -186,104 +541,586 @@ bool IRCSock::process() {
 		if(line.empty())
 			continue;
 
-		vector<string> fields = split(line);
-		if(fields.size() < 2)
+		IRCMessage msg = IRCMessage::parse(line);
+		PROBE2(parse, msg._command.c_str(), msg._params.size());
+		if(msg._command.empty())
+			continue;
+		_handle(msg);
+
+		// answers to our own lag probes are of no interest to anybody else
+		if(msg._command == "PONG" && msg.param(1) == _probeToken
+				&& !_probeToken.empty()) {
+			_lag = TimerWheel::now() - _probeSent;
+			_lagAverage = _haveLag ? _lagAverage + (_lag - _lagAverage) / 4 : _lag;
+			_haveLag = true;
+			_probeToken.clear();
+			continue;
+		}
+		_out.push_back(line);
+	}
+	// what's left waits for the socket to be readable again
+	_readable = false;
+
+	// the server hung up on us
+	if(_br.eof()) {
+		cerr << "IRCSock::process: " << _host << " closed the connection" << endl;
+		_quit();
+		_scheduleConnect();
+		return true;
+	}
+
+	// try sending anything we may be waiting to send
+	didSomething |= _trySend() > 0;
+	// TLS may have decrypted more than we asked for
+	didSomething |= _tls && _tls->pending() > 0;
+
+	return didSomething;
+}
+
+void IRCSock::_flushJoins(vector<string> &chans) {
+	if(chans.empty())
+		return;
+
+	// count the channels we're in or going to be in per prefix, so we don't
+	// try to go over the server's CHANLIMIT
+	map<char, size_t> inUse;
+	for(NameTable::Id id = 0; id < _cstatus.size(); ++id) {
+		ChannelStatus status = _cstatus[id]._status;
+		string name = _chans.name(id);
+		if(!name.empty() && (status == ChannelStatus::Joined
+					|| status == ChannelStatus::Joining))
+			inUse[name[0]]++;
+	}
+
+	vector<string> joinable;
+	for(auto &chan : chans) {
+		ChannelState &cs = _channel(_chans.intern(chan));
+		if(cs._status == ChannelStatus::Joined
+				|| cs._status == ChannelStatus::Joining)
+			continue;
+		if(inUse[chan[0]] >= _isupport.chanLimit(chan[0])) {
+			cerr << "IRCSock::process: CHANLIMIT reached, not joining "
+				<< chan << endl;
+			cs._status = ChannelStatus::Failed;
 			continue;
-		string from = fields[0], command = fields[1];
-
-		// if we see nick in use, abort
-		if(command == "433") {
-			_nstatus = NickStatus::Failed;
-			// TODO: switch to alternate nicks
-			cerr << "IRCSock::connect: nick in use!" << endl;
-			throw 433;
 		}
+		inUse[chan[0]]++;
+		cs._status = ChannelStatus::Joining;
+		cs._lastJoin = TimerWheel::now();
+		joinable.push_back(chan);
+	}
+	chans.clear();
 
-		// if we recieve the nick invalid message, abort
-		if(command == "432") {
-			_nstatus = NickStatus::Failed;
-			// TODO: same as above
-			cerr << "IRCSock::connect: nick contains illegal charaters" << endl;
-			throw 432;
+	_sendList("JOIN ", joinable, "", _isupport.targetMax("JOIN"));
+}
+void IRCSock::_flushMsgs(vector<string> &targets, string text) {
+	if(targets.empty())
+		return;
+	_sendList("PRIVMSG ", targets, " :" + text, _isupport.targetMax("PRIVMSG"));
+	targets.clear();
+}
+void IRCSock::_sendList(string head, const vector<string> &items,
+		string tail, size_t maxItems) {
+	// 512 bytes per line, including the trailing "\r\n"
+	const size_t maxLength = 510;
+	string list;
+	size_t count = 0;
+	for(auto &item : items) {
+		bool full = (count >= maxItems) || (head.length() + list.length()
+				+ 1 + item.length() + tail.length() > maxLength);
+		if(!list.empty() && full) {
+			send(head + list + tail);
+			list.clear();
+			count = 0;
 		}
+		list += (list.empty() ? "" : ",") + item;
+		count++;
+	}
+	if(!list.empty())
+		send(head + list + tail);
+}
+
+void IRCSock::_handle(const IRCMessage &msg) {
+	string command = msg._command;
+
+	// the nick we asked for is in use, not allowed, or held by services
+	if(command == "432" || command == "433" || command == "436"
+			|| command == "437")
+		_nickRejected(msg);
 
-		// if we see the end of motd code, we're in and may need to auth
-		if(command == "376") {
-			_commandQueue.push_back(Command(CommandType::Identify, _password));
-			_hasMOTD = true;
+	// server feature advertisement, which tells us how to compare names
+	if(command == "005") {
+		_isupport.parse(msg);
+		if(_isupport.has("CASEMAPPING")) {
+			CaseMapping cm = toCaseMapping(_isupport.get("CASEMAPPING"));
+			if(cm != CaseMapping::INVALID)
+				_chans.caseMapping(cm);
 		}
+		_members.configure(_isupport);
+		// now we know whether there's MONITOR
+		_scheduleReclaim();
+	}
+
+	if(command == "CAP")
+		_handleCap(msg);
+	if(command == "AUTHENTICATE" && msg.param(0) == "+")
+		_authenticate();
+	// SASL worked, or didn't (in which case NickServ gets a try after all)
+	if(command == "903") {
+		_sasl = SaslStatus::Succeeded;
+		_nstatus = NickStatus::Verified;
+		_endCap();
+	}
+	if(command == "902" || command == "904" || command == "905"
+			|| command == "906" || command == "908") {
+		cerr << "IRCSock::process: SASL authentication to " << _host
+			<< " failed (" << command << ")" << endl;
+		_sasl = SaslStatus::Failed;
+		_endCap();
+	}
+
+	// we're registered, under whichever nick the server says
+	if(command == "001") {
+		_welcomed = true;
+		if(!msg.param(0).empty())
+			_nick = msg.param(0);
+		if(!caseEqual(_nick, _primary(), _chans.caseMapping()))
+			cerr << "IRCSock::process: using " << _nick << " on " << _host
+				<< " until " << _primary() << " is free" << endl;
+		_scheduleReclaim();
+	}
+
+	// the end of the MOTD (or word that there is none)
+	if(command == "376" || command == "422")
+		_hasMOTD = true;
+
+	if(msg._tags.count("time"))
+		_serverTime(msg);
+
+	bool fromUs = caseEqual(msg.nick(), _nick, _chans.caseMapping());
+
+	// channel membership listing
+	if(command == "353")
+		_members.names(msg.param(2), msg.param(3));
+	if(command == "366")
+		_members.endNames(msg.param(1));
+
+	// somebody joined a channel
+	if(command == "JOIN") {
+		// we joined a channel
+		if(fromUs) {
+			ChannelState &cs = _channel(_chans.intern(msg.param(0)));
+			cs._status = ChannelStatus::Joined;
+			cs._joinTries = 0;
+			_timers->cancel(cs._retryTimer);
+		}
+		_members.join(msg.param(0), msg.nick());
+	}
+
+	// somebody left a channel, possibly not by choice
+	if(command == "PART" || command == "KICK") {
+		string chan = msg.param(0),
+			who = (command == "KICK") ? msg.param(1) : msg.nick();
+		if(caseEqual(who, _nick, _chans.caseMapping())) {
+			NameTable::Id id = _chans.find(chan);
+			if(id != NameTable::None && command == "PART")
+				_channel(id)._status = ChannelStatus::Parted;
+			else if(id != NameTable::None) {
+				// a channel we want is rejoined, after a while
+				ChannelState &cs = _channel(id);
+				cs._status = cs._wanted ? ChannelStatus::Failed
+					: ChannelStatus::None;
+				if(cs._wanted) {
+					cerr << "IRCSock::process: kicked from " << chan
+						<< ", rejoining later" << endl;
+					_retryJoin(id);
+					cs._joinTries++;
+				}
+			}
+			_members.forget(chan);
+		} else
+			_members.part(chan, who);
+	}
 
-		// TODO: names
-		// if(contains(line, " 332 ") || 
+	if(command == "QUIT")
+		_members.quit(msg.nick());
 
-		// somebody joined a channel
-		if(command == "JOIN") {
-			// we joined a channel
-			if(extractNick(from) == _nick) {
-				_cstatus[fields[2]] = ChannelStatus::Joined;
+	if(command == "NICK") {
+		_members.rename(msg.nick(), msg.param(0));
+		if(fromUs) {
+			_nick = msg.param(0);
+			if(caseEqual(_nick, _primary(), _chans.caseMapping())) {
+				cerr << "IRCSock::process: got " << _nick << " back on "
+					<< _host << endl;
+				if(_monitoring)
+					send("MONITOR - " + _nick);
+				_monitoring = false;
+				_recoveries = 0;
+				if(_sasl != SaslStatus::Succeeded)
+					_commandQueue.push_back(Command(CommandType::Identify,
+								_passwordFor(_nick)));
 			}
+			_scheduleReclaim();
 		}
+	}
 
-		// respond to PINGs
-		if(startsWith(line, "PING"))
-			send("PONG" + line.substr(4));
+	// who of the nicks we asked after is online (ISON, MONITOR)
+	if(command == "303")
+		_reclaimed(split(msg.param(1), " "));
+	if(command == "730" || command == "731") {
+		vector<string> nicks;
+		for(auto &target : split(msg.param(1), ","))
+			nicks.push_back(target.substr(0, target.find('!')));
+		// offline ones are left out of what's online
+		_reclaimed(command == "730" ? nicks : vector<string>());
 	}
 
-	// try sending anything we may be waiting to send
-	didSomething |= _trySend() > 0;
+	// channel modes may change who holds op or voice
+	if(command == "MODE" && !caseEqual(msg.param(0), _nick, _chans.caseMapping()))
+		_members.mode(msg.param(0),
+				vector<string>(msg._params.begin() + 1, msg._params.end()));
 
-	return didSomething;
+	// we couldn't join a channel (full, invite only, banned), try again later
+	if(command == "471" || command == "473" || command == "474") {
+		NameTable::Id id = _chans.find(msg.param(1));
+		if(id != NameTable::None) {
+			ChannelState &cs = _channel(id);
+			cerr << "IRCSock::process: unable to join " << msg.param(1)
+				<< " (" << command << "), retrying later" << endl;
+			cs._status = ChannelStatus::Failed;
+			_retryJoin(id);
+			cs._joinTries++;
+		}
+	}
+
+	// respond to PINGs
+	if(command == "PING")
+		send("PONG :" + msg.param(0));
+
+	// the session may have been waiting for this
+	if(_reply.waiting() && contains(_awaited, command))
+		_reply.fire();
+}
+
+void IRCSock::_handleCap(const IRCMessage &msg) {
+	// CAP <target> <subcommand> [*] :<caps>, the * meaning more to come
+	string sub = msg.param(1);
+	bool more = msg._params.size() > 3 && msg.param(2) == "*";
+	vector<string> caps = split(msg._params.back(), " ");
+
+	if(sub == "LS") {
+		for(auto &cap : caps) {
+			size_t eq = cap.find('=');
+			_offeredCaps[cap.substr(0, eq)] = eq == string::npos ? ""
+				: cap.substr(eq + 1);
+		}
+		if(more)
+			return;
+		string request;
+		for(auto &cap : _wantedCaps)
+			if(_offeredCaps.count(cap))
+				request += (request.empty() ? "" : " ") + cap;
+		// SASL only if PLAIN is among its mechanisms (or none are listed)
+		auto sasl = _offeredCaps.find("sasl");
+		vector<string> mechanisms;
+		if(sasl != _offeredCaps.end())
+			mechanisms = split(sasl->second, ",");
+		if(_useSasl && !_password.empty() && sasl != _offeredCaps.end()
+				&& (mechanisms.empty() || contains(mechanisms, (string)"PLAIN")))
+			request += (request.empty() ? "" : " ") + string("sasl");
+		if(request.empty())
+			_endCap();
+		else
+			send("CAP REQ :" + request);
+	} else if(sub == "ACK") {
+		for(auto &cap : caps) {
+			if(cap[0] == '-')
+				_caps.erase(std::remove(_caps.begin(), _caps.end(),
+							cap.substr(1)), _caps.end());
+			else if(!hasCap(cap))
+				_caps.push_back(cap);
+		}
+		if(more || !_capNegotiating)
+			return;
+		if(hasCap("sasl") && _sasl == SaslStatus::None) {
+			_sasl = SaslStatus::Authenticating;
+			send("AUTHENTICATE PLAIN");
+		} else
+			_endCap();
+	} else if(sub == "NAK") {
+		if(_capNegotiating)
+			_endCap();
+	} else if(sub == "DEL") {
+		for(auto &cap : caps) {
+			_offeredCaps.erase(cap);
+			_caps.erase(std::remove(_caps.begin(), _caps.end(), cap), _caps.end());
+		}
+	} else if(sub == "NEW") {
+		// cap-notify comes with 302: ask for newly offered caps we want
+		string request;
+		for(auto &cap : caps) {
+			string name = cap.substr(0, cap.find('='));
+			_offeredCaps[name] = cap.find('=') == string::npos ? ""
+				: cap.substr(cap.find('=') + 1);
+			if(contains(_wantedCaps, name) && !hasCap(name))
+				request += (request.empty() ? "" : " ") + name;
+		}
+		if(!request.empty())
+			send("CAP REQ :" + request);
+	}
+}
+
+void IRCSock::_authenticate() {
+	if(_sasl != SaslStatus::Authenticating)
+		return;
+	// PLAIN is authzid NUL authcid NUL password, sent 400 bytes at a time
+	// we log in to the account of our first choice, whatever nick we got
+	string account = _primary();
+	string auth = base64(account + string(1, '\0') + account
+			+ string(1, '\0') + _password);
+	for(size_t at = 0; at < auth.length(); at += 400)
+		send("AUTHENTICATE " + auth.substr(at, 400));
+	if(auth.length() % 400 == 0)
+		send("AUTHENTICATE +");
+}
+
+void IRCSock::_endCap() {
+	if(!_capNegotiating)
+		return;
+	send("CAP END");
+	_capNegotiating = false;
+}
+
+void IRCSock::_serverTime(const IRCMessage &msg) {
+	// server-time is ISO 8601 in UTC: YYYY-MM-DDThh:mm:ss.sssZ
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	int ms = 0;
+	if(sscanf(msg._tags.at("time").c_str(), "%4d-%2d-%2dT%2d:%2d:%2d.%3dZ",
+				&tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min,
+				&tm.tm_sec, &ms) < 6)
+		return;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	auto sent = system_clock::from_time_t(timegm(&tm)) + milliseconds(ms);
+	auto delay = duration_cast<TimerWheel::Duration>(system_clock::now() - sent);
+	// history playback and the like is stamped long ago; that's not delay
+	if(delay > seconds(60) || delay < -seconds(60))
+		return;
+	_delay = _haveDelay ? _delay + (delay - _delay) / 8 : delay;
+	_haveDelay = true;
+}
+
+void IRCSock::_nickRejected(const IRCMessage &msg) {
+	// 437 is also about channels, which aren't our business here
+	string nick = msg.param(1);
+	if(!caseEqual(nick, _pendingNick, _chans.caseMapping()))
+		return;
+	bool invalid = msg._command == "432";
+
+	// we have a nick, this was us trying to get our first choice back
+	if(_welcomed) {
+		if(invalid && caseEqual(nick, _primary(), _chans.caseMapping())) {
+			cerr << "IRCSock::process: " << _host << " won't allow " << nick
+				<< ", keeping " << _nick << endl;
+			_reclaimable = false;
+			_timers->cancel(_reclaimTimer);
+		}
+		return;
+	}
+
+	string next = (_nickIndex + 1 < _nicks.size())
+		? _nicks[++_nickIndex] : _fallbackNick();
+	cerr << "IRCSock::process: nick " << nick << " is "
+		<< (invalid ? "not allowed" : "taken") << " on " << _host
+		<< ", trying " << next << endl;
+	_commandQueue.push_back(Command(CommandType::Nick, next));
+}
+
+string IRCSock::_fallbackNick() {
+	// first choice with an underscore or two, then with digits, within
+	// the server's NICKLEN (or the RFC's 9 before we know it)
+	string primary = _primary();
+	size_t maxLength = _isupport.has("NICKLEN")
+		? fromString<size_t>(_isupport.get("NICKLEN")) : 9;
+	maxLength = std::max(maxLength, primary.length());
+	_fallbacks++;
+	string suffix;
+	if(_fallbacks <= 2)
+		suffix = string(_fallbacks, '_');
+	else {
+		// not random, but not the same twice in a row either
+		auto now = TimerWheel::now().time_since_epoch();
+		suffix = to_string((duration_cast<milliseconds>(now).count()
+					+ _fallbacks * 7919) % 1000);
+	}
+	if(maxLength < suffix.length() + 1)
+		maxLength = suffix.length() + 1;
+	return primary.substr(0, maxLength - suffix.length()) + suffix;
+}
+
+void IRCSock::_scheduleReclaim() {
+	_timers->cancel(_reclaimTimer);
+	if(!_welcomed || !_reclaimable || _mstatus != Status::Connected
+			|| caseEqual(_nick, _primary(), _chans.caseMapping()))
+		return;
+	// MONITOR says the moment it's taken or free (730 and 731); without
+	// it we ask now and then
+	if(_isupport.has("MONITOR")) {
+		if(!_monitoring)
+			send("MONITOR + " + _primary());
+		_monitoring = true;
+		return;
+	}
+	_reclaimTimer = _timers->after(seconds(_reclaimInterval), [this]() {
+		_reclaimTimer = TimerWheel::None;
+		if(_mstatus != Status::Connected)
+			return;
+		send("ISON " + _primary());
+		_scheduleReclaim();
+	});
+}
+
+void IRCSock::_reclaimed(const vector<string> &online) {
+	string primary = _primary();
+	if(!_welcomed || !_reclaimable
+			|| caseEqual(_nick, primary, _chans.caseMapping()))
+		return;
+	for(auto &nick : online)
+		if(caseEqual(nick, primary, _chans.caseMapping())) {
+			// somebody has it, maybe our own ghost from a dropped connection
+			_recover();
+			return;
+		}
+	_commandQueue.push_back(Command(CommandType::Nick, primary));
 }
 
-int IRCSock::connect() {
+void IRCSock::_recover() {
+	if(_password.empty() || _recoveries > _maxRecoveries)
+		return;
+	// whoever has it isn't a ghost services will clear for us; we'll only
+	// take it once it's free
+	if(_recoveries == _maxRecoveries) {
+		cerr << "IRCSock::_recover: services won't give us " << _primary()
+			<< ", waiting for it to be free" << endl;
+		_recoveries++;
+		return;
+	}
+	// REGAIN ghosts the holder and hands us the nick in one go; services
+	// without it only GHOST, after which we ask for the nick ourselves
+	string primary = _primary();
+	if(_recoveries++ % 2 == 0)
+		send("PRIVMSG NickServ :REGAIN " + primary + " " + _password);
+	else {
+		send("PRIVMSG NickServ :GHOST " + primary + " " + _password);
+		_commandQueue.push_back(Command(CommandType::Nick, primary));
+	}
+}
+
+string IRCSock::_primary() const {
+	return _nicks.empty() ? _nick : _nicks[0];
+}
+string IRCSock::_passwordFor(string nick) const {
+	for(auto &entry : _passwords)
+		if(caseEqual(entry.first, nick, _chans.caseMapping()))
+			return entry.second;
+	return "";
+}
+
+IRCSock::ChannelState &IRCSock::_channel(NameTable::Id id) {
+	if(id >= _cstatus.size())
+		_cstatus.resize(_chans.bound());
+	return _cstatus[id];
+}
+
+void IRCSock::connect() {
 	_connectionTries++;
-	_lastConnectionTry = time(NULL);
 	cerr << "IRCSock::connect: attempting to connect to " << _host << endl;
+	PROBE3(reconnect, _host.c_str(), _port, _connectionTries);
 
+	// the session takes it from here, without waiting on the lookup or the
+	// server here
+	_mstatus = Status::Connecting;
+	_resolver = new Resolver(_host, _port);
+	_sessionTask = _session(true);
+}
+
+bool IRCSock::_open(AddressInfo &ai) {
 	// attempt to create socket
-	_socket = socket(AF_INET, SOCK_STREAM, 0);
+	_socket = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	if(_socket == -1) {
 		perror("IRCSock::connect: failed to create socket");
-		return 1;
+		return false;
 	}
 
-	// lookup address info for host
-	AddressInfo ai = lookupDomain();
-	if(!ai())
-		return 2;
-
-	// connect to host
-	int error = ::connect(_socket, ai()->ai_addr, ai()->ai_addrlen);
-	if(error == -1) {
+	// connect to host; that usually takes a while, and is done when the
+	// socket turns writable
+	_readable = false;
+	_writable = ::connect(_socket, ai()->ai_addr, ai()->ai_addrlen) == 0;
+	if(!_writable && errno != EINPROGRESS) {
 		perror("IRCSock::connect");
-		return 3;
+		return false;
+	}
+	return true;
+}
+
+bool IRCSock::_connected() {
+	// writable doesn't mean it worked
+	int error = 0;
+	socklen_t length = sizeof(error);
+	if(getsockopt(_socket, SOL_SOCKET, SO_ERROR, &error, &length) == -1)
+		error = errno;
+	if(error != 0) {
+		cerr << "IRCSock::connect: failed to connect to " << server() << ": "
+			<< strerror(error) << endl;
+		return false;
 	}
 
 	// setup our buffered reader object
 	_br.setup(_socket, "\r\n");
 
-	_mstatus = Status::Connected;
-	_commandQueue.push_back(Command(CommandType::Nick, _nick));
-	_commandQueue.push_back(Command(CommandType::User, _nick));
-	for(auto &chan : _channels)
-		_commandQueue.push_back(Command(CommandType::Join, chan));
+	// the handshake happens in the session, once the socket is writable
+	if(_server < _servers.size() && _servers[_server]._tls) {
+		_tls = new Tls();
+		if(_tls->open(_socket, _host, server(), _servers[_server]._verify) != 0) {
+			delete _tls;
+			_tls = nullptr;
+			return false;
+		}
+		_br.tls(_tls);
+	}
 
-	time_t now = time(NULL);
-	_lastMessage = now;
+	_mstatus = Status::Connected;
+	_connection++;
+	_nick = _primary();
+	_nickIndex = 0;
+	_fallbacks = 0;
+	_reclaimable = true;
+	_monitoring = false;
+	_recoveries = 0;
 
-	return 0;
+	_lastMessage = TimerWheel::now();
+	_haveLag = false;
+	_lagAverage = _lag = TimerWheel::Duration::zero();
+	_lagging = false;
+	_pingTask = _watchPing();
+	_probeTask = _probe();
+	return true;
 }
 
 bool IRCSock::_canRead() {
-	return _br.canRead();
+	// TLS may have decrypted more than was asked for
+	if(_readable || (_tls && _tls->pending() > 0))
+		return _br.canRead();
+	return _br.hasLine();
 }
 string IRCSock::_read() {
 	string l = _br.read();
-	if(!l.empty()) {
-		_lastMessage = time(NULL);
-		_out.push_back(l);
-	}
-	log(_host, l);
+	if(!l.empty())
+		_lastMessage = TimerWheel::now();
+	PROBE2(line_read, _host.c_str(), l.c_str());
+	if(!trim(l).empty())
+		logger::record(_logName.empty() ? _host : _logName, l);
 	return l;
 }
 
@@ -291,7 +1128,8 @@ ssize_t IRCSock::_trySend() {
 	if(_wbuf.empty())
 		return 0;
 
-	ssize_t wamount = write(_socket, _wbuf.c_str(), _wbuf.length());
+	ssize_t wamount = _tls ? _tls->write(_wbuf.c_str(), _wbuf.length())
+		: write(_socket, _wbuf.c_str(), _wbuf.length());
 	if((wamount < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
 		return 0;
 
@@ -300,41 +1138,185 @@ ssize_t IRCSock::_trySend() {
 		return wamount;
 	} else if(wamount > 0) {
 		_wbuf = _wbuf.substr(wamount);
+		_written += wamount;
+		PROBE2(socket_write, _host.c_str(), wamount);
 	}
 
 	return wamount;
 }
 
 
-void IRCSock::send(string str) {
-	if(!str.empty())
+int IRCSock::fd() const {
+	// until there's a socket, the lookup is what we're waiting on
+	if(_mstatus == Status::Connecting && _socket < 0)
+		return _resolver ? _resolver->fd() : -1;
+	if(_mstatus == Status::Connecting || _mstatus == Status::Connected)
+		return _socket;
+	return -1;
+}
+bool IRCSock::wantsWrite() const {
+	if(_mstatus == Status::Connecting)
+		return _socket >= 0;
+	return !_wbuf.empty() || (_tls && _tls->wantsWrite());
+}
+void IRCSock::readable() {
+	_readable = true;
+}
+void IRCSock::writable() {
+	_writable = true;
+}
+void IRCSock::lagPolicy(int probeInterval, int threshold, int window) {
+	_probeInterval = probeInterval;
+	_lagThreshold = threshold;
+	_lagWindow = window;
+	if(_mstatus == Status::Connected)
+		_probeTask = _probe();
+}
+TimerWheel::Duration IRCSock::lag() const {
+	return _lag;
+}
+TimerWheel::Duration IRCSock::averageLag() const {
+	return _lagAverage;
+}
+void IRCSock::logAs(string name) {
+	_logName = name;
+}
+
+string IRCSock::server() const {
+	return _host + ":" + to_string(_port);
+}
+
+void IRCSock::capabilities(vector<string> caps, bool sasl) {
+	_wantedCaps = caps;
+	_useSasl = sasl;
+}
+bool IRCSock::hasCap(string cap) const {
+	return std::find(_caps.begin(), _caps.end(), cap) != _caps.end();
+}
+void IRCSock::nicks(vector<string> nicks, map<string, string> passwords) {
+	string old = _primary();
+	_nicks = nicks;
+	_passwords = passwords;
+	_password = _passwordFor(_primary());
+	if(_mstatus != Status::Connected || !_welcomed)
+		return;
+	if(_monitoring && !caseEqual(old, _primary(), _chans.caseMapping())) {
+		send("MONITOR - " + old);
+		_monitoring = false;
+	}
+	_reclaimable = true;
+	_recoveries = 0;
+	_scheduleReclaim();
+}
+string IRCSock::nick() const {
+	return _nick;
+}
+TimerWheel::Duration IRCSock::delay() const {
+	return _delay;
+}
+
+bool IRCSock::connecting() const {
+	return _mstatus == Status::Connecting;
+}
+bool IRCSock::registered() const {
+	return _mstatus == Status::Connected && _canJoin;
+}
+bool IRCSock::joining(string target) const {
+	string chantypes = _isupport.has("CHANTYPES")
+		? _isupport.get("CHANTYPES") : "#&";
+	if(target.empty() || chantypes.find(target[0]) == string::npos)
+		return false;
+	NameTable::Id id = _chans.find(target);
+	return id != NameTable::None && id < _cstatus.size()
+		&& _joining(_cstatus[id]);
+}
+bool IRCSock::joining() const {
+	for(auto &cs : _cstatus)
+		if(_joining(cs))
+			return true;
+	return false;
+}
+bool IRCSock::_joining(const ChannelState &cs) const {
+	if(!cs._wanted)
+		return false;
+	switch(cs._status) {
+		// not sent yet: we're connecting, or it's queued to go
+		case ChannelStatus::None:
+			return true;
+		case ChannelStatus::Joining:
+			return TimerWheel::now() - cs._lastJoin < seconds(_joinTimeout);
+		case ChannelStatus::Joined:
+		case ChannelStatus::Parted:
+		case ChannelStatus::Failed:
+		case ChannelStatus::INVALID:
+		default:
+			return false;
+	}
+}
+
+unsigned IRCSock::connection() const {
+	return _connection;
+}
+uint64_t IRCSock::queued() const {
+	return _queued;
+}
+uint64_t IRCSock::written() const {
+	return _written;
+}
+
+bool IRCSock::send(string str) {
+	if(_mstatus != Status::Connected)
+		return false;
+	if(!str.empty()) {
 		_wbuf += str + "\r\n";
+		_queued += str.length() + 2;
+	}
+	return true;
 }
 void IRCSock::pmsg(string target, string msg) {
 	_commandQueue.push_back(Command(CommandType::Msg, target, msg));
 }
 
 void IRCSock::join(string chan) {
-	if(_cstatus.find(chan) == _cstatus.end()
-			|| _cstatus[chan] == ChannelStatus::Parted
-			|| _cstatus[chan] == ChannelStatus::Failed) {
+	ChannelState &cs = _channel(_chans.intern(chan));
+	if(cs._wanted)
+		return;
+	cs._wanted = true;
+	// until we're registered, the session joins every wanted channel itself
+	if(_mstatus != Status::Connected || !_canJoin)
+		return;
+	if(cs._status == ChannelStatus::None
+			|| cs._status == ChannelStatus::Parted
+			|| cs._status == ChannelStatus::Failed)
 		_commandQueue.push_back(Command(CommandType::Join, chan));
-		_channels.push_back(chan);
-	}
 }
 void IRCSock::part(string chan) {
-	if(_cstatus.find(chan) == _cstatus.end()
-			|| _cstatus[chan] != ChannelStatus::Joined)
+	NameTable::Id id = _chans.find(chan);
+	if(id == NameTable::None)
+		return;
+	ChannelState &cs = _channel(id);
+	cs._wanted = false;
+	_timers->cancel(cs._retryTimer);
+	// a JOIN already sent will go through, so follow it with the PART
+	if(cs._status != ChannelStatus::Joined
+			&& cs._status != ChannelStatus::Joining)
 		return;
 	_commandQueue.push_back(Command(CommandType::Part, chan));
-
-	auto it = find(_channels.begin(), _channels.end(), chan);
-	if(it != _channels.end())
-		_channels.erase(it);
 }
 
-void IRCSock::quit() {
-	_commandQueue.push_back(Command(CommandType::Quit, "goodbype"));
+void IRCSock::quit(string message) {
+	// if we're between connections (or still making one), stay that way
+	_timers->cancel(_reconnectTimer);
+	if(_mstatus != Status::Connected) {
+		_quitting = true;
+		_quit();
+		return;
+	}
+	if(!_quitting)
+		_commandQueue.push_back(Command(CommandType::Quit, message));
+}
+bool IRCSock::closed() const {
+	return _quitting && _mstatus != Status::Connected;
 }
 
 vector<string> IRCSock::read() {
@@ -343,33 +1325,168 @@ vector<string> IRCSock::read() {
 	return out;
 }
 
-AddressInfo IRCSock::lookupDomain() {
-	// if we don't yet have a socket, there is obviously a problem
-	if(_socket == -1) {
-		cerr << "IRCSock::lookupDomain: socket is nonexistant" << endl;
-		return { nullptr };
+const Membership &IRCSock::members() const {
+	return _members;
+}
+
+void IRCSock::handoff(Handoff &state, string prefix) const {
+	if(_mstatus != Status::Connected)
+		return;
+	// TLS state lives in this process, so the next one connects again
+	// (resuming the TLS session, at least)
+	if(_tls) {
+		cerr << "IRCSock::handoff: can't pass on the TLS connection to "
+			<< _host << endl;
+		return;
 	}
+	state.fd(prefix + "socket", _socket);
+	state.set(prefix + "server", to_string(_server));
+	state.set(prefix + "nick", _nick);
+	state.set(prefix + "monitoring", _monitoring ? "1" : "0");
+	state.set(prefix + "reclaimable", _reclaimable ? "1" : "0");
+	state.set(prefix + "motd", _hasMOTD ? "1" : "0");
+	state.set(prefix + "welcomed", _welcomed ? "1" : "0");
+	state.set(prefix + "canjoin", _canJoin ? "1" : "0");
+	state.set(prefix + "sasl", to_string((int)_sasl));
+	string caps;
+	for(auto &cap : _caps)
+		caps += (caps.empty() ? "" : " ") + cap;
+	state.set(prefix + "caps", caps);
+	state.set(prefix + "nickstatus", to_string((int)_nstatus));
+	state.set(prefix + "wbuf", _wbuf);
+	state.set(prefix + "connection", to_string(_connection));
+	state.set(prefix + "queued", to_string(_queued));
+	state.set(prefix + "written", to_string(_written));
+	state.set(prefix + "rbuf", _br.buffered());
 
-	// get the string version of our port number
-	string sport = to_string(_port);
+	vector<string> tokens = _isupport.tokens();
+	string isupport;
+	for(auto &token : tokens)
+		isupport += (isupport.empty() ? "" : " ") + token;
+	state.set(prefix + "isupport", isupport);
 
-	// try to get the address info, hinting taht we want IPv4 only
-	struct addrinfo *result, hints;
-	::memset(&hints, 0, sizeof(hints));
-	hints.ai_family = AF_INET;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_protocol = 0;
-	hints.ai_flags = (AI_V4MAPPED | AI_ADDRCONFIG); // defaults for no hints
-	int error = ::getaddrinfo(_host.c_str(), sport.c_str(), &hints, &result);
+	// an unanswered probe's PONG is still on its way
+	state.set(prefix + "probe", _probeToken);
+	state.set(prefix + "probesent", to_string(_probeSent.time_since_epoch().count()));
+	state.set(prefix + "lag", to_string(_lag.count()));
+	state.set(prefix + "lagaverage", to_string(_lagAverage.count()));
 
-	// if we failed, report the error and abort
-	if(error) {
-		cerr << "IRCSock::lookupDomain: failed lookup domain: "
-			<< gai_strerror(error) << endl;
-		return { nullptr };
+	string chans;
+	for(NameTable::Id id = 0; id < _cstatus.size(); ++id) {
+		const ChannelState &cs = _cstatus[id];
+		if(!_chans.valid(id) || cs._status == ChannelStatus::None)
+			continue;
+		string chan = _chans.name(id), cprefix = prefix + "chan." + chan + ".";
+		chans += (chans.empty() ? "" : " ") + chan;
+		state.set(cprefix + "status", to_string((int)cs._status));
+		state.set(cprefix + "tries", to_string(cs._joinTries));
+		state.set(cprefix + "names", _members.entries(chan));
 	}
+	state.set(prefix + "chans", chans);
 
-	// TODO: need {} wrap?
-	return result;
+	for(size_t i = 0; i < _commandQueue.size(); ++i) {
+		string command = to_string((int)_commandQueue[i]._type);
+		for(auto &arg : _commandQueue[i]._args)
+			command += "\n" + arg;
+		state.set(prefix + "command." + to_string(i), command);
+	}
+}
+
+bool IRCSock::resume(const Handoff &state, string prefix) {
+	if(state.fd(prefix + "socket") < 0)
+		return false;
+	_timers->cancel(_reconnectTimer);
+
+	_socket = state.fd(prefix + "socket");
+	_server = fromString<size_t>(state.get(prefix + "server"));
+	if(_server < _servers.size()) {
+		_host = _servers[_server]._host;
+		_port = _servers[_server]._port;
+	}
+	_nick = state.get(prefix + "nick");
+	_monitoring = state.get(prefix + "monitoring") == "1";
+	_reclaimable = state.get(prefix + "reclaimable") != "0";
+	_hasMOTD = state.get(prefix + "motd") == "1";
+	// an older jitro only knew about the MOTD
+	_welcomed = _hasMOTD || state.get(prefix + "welcomed") == "1";
+	_canJoin = _hasMOTD || state.get(prefix + "canjoin") == "1";
+	_sasl = (SaslStatus)fromString<int>(state.get(prefix + "sasl"));
+	_caps = split(state.get(prefix + "caps"), " ");
+	_nstatus = (NickStatus)fromString<int>(state.get(prefix + "nickstatus"));
+	_wbuf = state.get(prefix + "wbuf");
+	_connection = fromString<unsigned>(state.get(prefix + "connection"));
+	_queued = fromString<uint64_t>(state.get(prefix + "queued"));
+	_written = fromString<uint64_t>(state.get(prefix + "written"));
+	_br.setup(_socket, "\r\n");
+	_br.suffix(state.get(prefix + "rbuf"));
+	_mstatus = Status::Connected;
+	cerr << "IRCSock::resume: taking over the connection to " << _host << endl;
+
+	// replaying the server's 005 sets up case mapping and membership
+	IRCMessage isupport;
+	isupport._command = "005";
+	isupport._params.push_back(_nick);
+	for(auto &token : split(state.get(prefix + "isupport"), " "))
+		isupport._params.push_back(token);
+	isupport._params.push_back("are supported by this server");
+	_handle(isupport);
+
+	_probeToken = state.get(prefix + "probe");
+	_probeSent = TimerWheel::TimePoint(TimerWheel::Duration(
+				fromString<long long>(state.get(prefix + "probesent"))));
+	_lag = TimerWheel::Duration(fromString<long long>(state.get(prefix + "lag")));
+	_lagAverage = TimerWheel::Duration(
+			fromString<long long>(state.get(prefix + "lagaverage")));
+	_haveLag = _lagAverage != TimerWheel::Duration::zero();
+
+	for(size_t i = 0; state.has(prefix + "command." + to_string(i)); ++i) {
+		vector<string> fields;
+		string command = state.get(prefix + "command." + to_string(i));
+		for(size_t pos = 0; pos != string::npos; ) {
+			size_t nl = command.find('\n', pos);
+			fields.push_back(command.substr(pos, nl == string::npos ? nl : nl - pos));
+			pos = (nl == string::npos) ? nl : nl + 1;
+		}
+		Command comm((CommandType)fromString<int>(fields[0]), "");
+		comm._args.assign(fields.begin() + 1, fields.end());
+		_commandQueue.push_back(comm);
+	}
+
+	for(auto &chan : split(state.get(prefix + "chans"), " ")) {
+		string cprefix = prefix + "chan." + chan + ".";
+		NameTable::Id id = _chans.intern(chan);
+		ChannelState &cs = _channel(id);
+		cs._status = (ChannelStatus)fromString<int>(state.get(cprefix + "status"));
+		cs._joinTries = fromString<int>(state.get(cprefix + "tries"));
+		cs._lastJoin = TimerWheel::now();
+		if(cs._status == ChannelStatus::Joined) {
+			_members.names(chan, state.get(cprefix + "names"));
+			_members.endNames(chan);
+		}
+	}
+
+	// bring channels in line with what we were told to be in since
+	for(NameTable::Id id = 0; id < _cstatus.size(); ++id) {
+		ChannelState &cs = _cstatus[id];
+		if(!_chans.valid(id))
+			continue;
+		bool in = cs._status == ChannelStatus::Joined
+			|| cs._status == ChannelStatus::Joining;
+		if(cs._wanted && cs._status == ChannelStatus::Failed)
+			_retryJoin(id);
+		else if(cs._wanted && !in && _canJoin)
+			_commandQueue.push_back(Command(CommandType::Join, _chans.name(id)));
+		else if(!cs._wanted && in)
+			_commandQueue.push_back(Command(CommandType::Part, _chans.name(id)));
+	}
+
+	_lastMessage = TimerWheel::now();
+	_pingTask = _watchPing();
+	_probeTask = _probe();
+	// a connection handed over before it was through registering carries on
+	// from where it got to
+	if(!_canJoin)
+		_sessionTask = _session(false);
+	return true;
 }
 
@@ -4,8 +4,18 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <cstdint>
 #include <sys/types.h>
 #include "bufreader.hpp"
+#include "casemap.hpp"
+#include "isupport.hpp"
+#include "ircmessage.hpp"
+#include "membership.hpp"
+#include "timerwheel.hpp"
+#include "task.hpp"
+#include "handoff.hpp"
+#include "tls.hpp"
 
 // simple RAII wrapper around struct addrinfo *
 struct AddressInfo {
@@ -22,16 +32,44 @@ struct AddressInfo {
 		struct addrinfo *_ai{nullptr};
 };
 
+// Resolver looks a host up on a thread of its own, so the main loop never
+// waits on DNS. fd() becomes readable once it's done. It may be destroyed
+// before then; the thread finishes the lookup and throws it away.
+struct Resolver {
+	Resolver(std::string host, int port);
+	~Resolver();
+
+	Resolver(const Resolver &rhs) = delete;
+	Resolver &operator=(const Resolver &rhs) = delete;
+
+	int fd() const;
+	bool done() const;
+	// what was found once done, nullptr if nothing (see error)
+	AddressInfo take();
+	std::string error() const;
+
+	protected:
+		struct Lookup;
+		std::shared_ptr<Lookup> _lookup{};
+};
+
 
 struct IRCSock {
-	enum class Status { Connected, Disconnected, Failed, INVALID };
+	enum class Status { Connecting, Connected, Disconnected, Failed, INVALID };
 	enum class NickStatus { NeedsSent, Sent, NoAuth, Verified, Failed, INVALID };
 	enum class ChannelStatus { None, Joining, Joined, Parted, Failed, INVALID };
 	struct ChannelState {
 		ChannelStatus _status{ChannelStatus::None};
-		time_t _lastJoin{0};
+		TimerWheel::TimePoint _lastJoin{};
+		// whether we should be in this channel (rejoined on connect)
+		bool _wanted{false};
+		// failed joins in a row, and the timer that will try again
+		int _joinTries{0};
+		TimerWheel::TimerId _retryTimer{TimerWheel::None};
 	};
-	enum class CommandType { Nick, User, Identify, Join, Part, Quit, Msg, INVALID };
+	enum class CommandType { Nick, User, Identify, Join, Part, Quit, Msg, Cap,
+		INVALID };
+	enum class SaslStatus { None, Authenticating, Succeeded, Failed, INVALID };
 	struct Command {
 		CommandType _type{CommandType::INVALID};
 		std::vector<std::string> _args{};
@@ -46,61 +84,281 @@ struct IRCSock {
 	};
 
 
-	IRCSock(std::string host, int port, std::string nick, std::string password);
+	struct Server {
+		std::string _host{};
+		int _port{6667};
+		// speak TLS, and whether to check the server's certificate
+		bool _tls{false};
+		bool _verify{true};
+	};
+
+
+	// servers are tried in order, moving on when one fails or lags; so are
+	// nicks, the first of which we keep trying to get back
+	IRCSock(TimerWheel &timers, std::vector<Server> servers,
+			std::vector<std::string> nicks,
+			std::map<std::string, std::string> passwords);
 	~IRCSock();
 
+	IRCSock(const IRCSock &rhs) = delete;
+	IRCSock &operator=(const IRCSock &rhs) = delete;
 
-	// call this every so often to process events and commands
+
+	// call this when the socket is ready or a timer has fired
 	bool process();
 
+	// socket to wait on (-1 if none), and whether we want to write to it
+	// (or see it connect)
+	int fd() const;
+	bool wantsWrite() const;
+	// the socket was seen to be readable (or hung up on); process only
+	// reads from it after this
+	void readable();
+	// the same for writable, which a connection attempt waits for
+	void writable();
+	// Set how often we PING the server, and how many seconds of lag
+	// (threshold) sustained for how long (window) make us switch servers.
+	// A threshold of 0 never switches.
+	void lagPolicy(int probeInterval, int threshold, int window);
+	// round trip time of the last answered client PING, and its average
+	TimerWheel::Duration lag() const;
+	TimerWheel::Duration averageLag() const;
+	// host:port of the server we are using
+	std::string server() const;
+	// the network lines we read are logged as (the server's host if blank)
+	void logAs(std::string name);
+	// Ask servers for these IRCv3 capabilities when connecting, and
+	// authenticate with SASL PLAIN if they offer it and we have a password
+	// (unless sasl is false). Takes effect on the next connection.
+	void capabilities(std::vector<std::string> caps, bool sasl);
+	// whether the server enabled cap for us
+	bool hasCap(std::string cap) const;
+	// Change the nicks we'd like, by preference, and their NickServ
+	// passwords. If we don't have the first, we watch for it to free up
+	// (or have services ghost whoever is using it, given its password).
+	void nicks(std::vector<std::string> nicks,
+			std::map<std::string, std::string> passwords);
+	// the nick we have (or are asking for, until registered)
+	std::string nick() const;
+	// how long server-time stamped messages take to reach us, averaged
+	TimerWheel::Duration delay() const;
+	// whether we're looking the server up or waiting on it to connect
+	bool connecting() const;
+	// whether we're connected and the server has accepted us
+	bool registered() const;
+	// Whether target is a channel we want and are still on our way into,
+	// so that messages to it would be lost; a join that goes unanswered
+	// stops counting after a while. Without a target, whether any is.
+	bool joining(std::string target) const;
+	bool joining() const;
+	// which connection we're on, counting up from 1 with each connect
+	unsigned connection() const;
+	// Bytes ever passed to send() and written to the socket on this
+	// connection; a line is out once written() reaches queued() as it was
+	// just after sending it.
+	uint64_t queued() const;
+	uint64_t written() const;
+
 
-	// interact with the connection through these methods
-	void send(std::string str);
+	// interact with the connection through these methods; send returns
+	// false (dropping str) when there is no connection to send it on
+	bool send(std::string str);
 	void pmsg(std::string target, std::string msg);
 	void join(std::string chan);
 	void part(std::string chan);
-	void quit();
+	// Say goodbye with message, after whatever is queued ahead of it, then
+	// stay disconnected once the server hangs up
+	void quit(std::string message = "goodbye");
+	// whether we've quit (or been stopped from ever connecting)
+	bool closed() const;
 
 	std::vector<std::string> read();
 
-	protected:
-		AddressInfo lookupDomain();
+	// who is in the channels we're in
+	const Membership &members() const;
 
-		int connect();
+	// Pass a live connection on to a new jitro, which picks it up with
+	// resume (after joining the channels it wants) instead of connecting.
+	// resume returns false if there was nothing to pick up.
+	void handoff(Handoff &state, std::string prefix) const;
+	bool resume(const Handoff &state, std::string prefix);
+
+	protected:
+		void connect();
 		void _quit();
+		// start connecting to the first of ai, and finish once the socket
+		// has connected; false (having said why) if that failed
+		bool _open(AddressInfo &ai);
+		bool _connected();
+
+		// The connection lifecycle. _session gets from connecting to being
+		// in our channels one step at a time, each with its time limit;
+		// _watchPing and _probe then keep an eye on the connection for as
+		// long as it lasts. They all stop when the connection is closed.
+		Task _session(bool introduce);
+		Task _watchPing();
+		Task _probe();
+		// the session waits on the server's answers to it through these
+		Trigger::Wait _expect(std::vector<std::string> commands,
+				TimerWheel::TimePoint deadline);
+		// returns true if lag has made us drop the connection
+		bool _checkLag();
+		// Close the connection (from the timers, so not out from under
+		// whoever calls this) and connect again, to the next server if
+		// nextServer, keeping on backing off if backOff.
+		void _drop(bool nextServer, bool backOff);
+		void _scheduleConnect();
+		void _nextServer();
+		void _retryJoin(NameTable::Id id);
+		void _cancelTimers();
 
 		bool _canRead();
 		std::string _read();
 
 		ssize_t _trySend();
 
+		// send queued commands, packing as many targets per line as allowed
+		void _flushJoins(std::vector<std::string> &chans);
+		void _flushMsgs(std::vector<std::string> &targets, std::string text);
+		void _sendList(std::string head, const std::vector<std::string> &items,
+				std::string tail, size_t maxItems);
+
+		// nick acquisition: moving on from a nick the server refused, and
+		// getting our first choice back later
+		void _nickRejected(const IRCMessage &msg);
+		std::string _fallbackNick();
+		void _scheduleReclaim();
+		void _reclaimed(const std::vector<std::string> &online);
+		void _recover();
+		std::string _primary() const;
+		std::string _passwordFor(std::string nick) const;
+
+		void _handle(const IRCMessage &msg);
+		void _handleCap(const IRCMessage &msg);
+		void _authenticate();
+		// finish capability negotiation, letting registration go on
+		void _endCap();
+		void _serverTime(const IRCMessage &msg);
+		ChannelState &_channel(NameTable::Id id);
+		bool _joining(const ChannelState &cs) const;
+
 	protected:
+		std::vector<Server> _servers{};
+		size_t _server{0};
 		std::string _host{};
 		int _port{};
+		std::string _logName{};
 		int _domain{};
 		int _socket{-1};
 
 		bool _hasMOTD{false};
+		// seen 001, and whether it's time to join channels: right away
+		// when we needn't identify or SASL did it, otherwise after the MOTD
+		bool _welcomed{false};
+		bool _canJoin{false};
+
+		std::vector<std::string> _wantedCaps{};
+		bool _useSasl{true};
+		// what the server offers (with values), and what it enabled
+		std::map<std::string, std::string> _offeredCaps{};
+		std::vector<std::string> _caps{};
+		bool _capNegotiating{false};
+		SaslStatus _sasl{SaslStatus::None};
+		TimerWheel::Duration _delay{};
+		bool _haveDelay{false};
+
+		TimerWheel *_timers{nullptr};
+		TimerWheel::TimerId _reconnectTimer{TimerWheel::None};
+		Task _sessionTask{};
+		Task _pingTask{};
+		Task _probeTask{};
+		// fired for the session when the socket is ready (while connecting
+		// and during the TLS handshake), and when one of the _awaited
+		// commands arrives
+		Trigger _io{};
+		Trigger _reply{};
+		std::vector<std::string> _awaited{};
+		// seconds to look the server up and connect to it, from then to
+		// being registered, and then for the end of the MOTD (which we
+		// identify after)
+		int _connectTimeout{30};
+		int _registerTimeout{60};
+		int _motdTimeout{30};
 
 		int _connectionTries{0};
 		int _maxConnectionTries{16};
 		int _maxConnectionDelay{600};
-		time_t _lastConnectionTry{0};
-		time_t _lastMessage{0};
+		TimerWheel::TimePoint _lastMessage{};
 		int _pingTimeout{300};
 
+		// we PING the server ourselves to measure lag, keeping an
+		// exponentially weighted moving average of the round trip
+		int _probeInterval{60};
+		std::string _probeToken{};
+		TimerWheel::TimePoint _probeSent{};
+		TimerWheel::Duration _lag{};
+		TimerWheel::Duration _lagAverage{};
+		bool _haveLag{false};
+
+		int _lagThreshold{0};
+		int _lagWindow{120};
+		bool _lagging{false};
+		TimerWheel::TimePoint _laggingSince{};
+
+		// joins unanswered after this many seconds aren't waited on
+		int _joinTimeout{30};
+		// failed joins are retried after this many seconds, doubling
+		int _joinRetryDelay{30};
+		int _maxJoinRetryDelay{1800};
+
 		std::vector<Command> _commandQueue{};
-		std::vector<std::string> _channels{};
 
 		Status _mstatus{Status::Disconnected};
 		NickStatus _nstatus{NickStatus::NeedsSent};
-		std::map<std::string, ChannelStatus> _cstatus{};
+
+		// channel state is indexed by the channel's id in _chans
+		NameTable _chans{};
+		std::vector<ChannelState> _cstatus{};
+		ISupport _isupport{};
+		Membership _members{};
 
 		std::string _nick{};
+		// the password for our first choice of nick (used for SASL, and to
+		// ghost it)
 		std::string _password{};
+		std::vector<std::string> _nicks{};
+		std::map<std::string, std::string> _passwords{};
+		// the nick last sent, which configured nick we're on, and how many
+		// made up ones we've tried since they ran out
+		std::string _pendingNick{};
+		size_t _nickIndex{0};
+		int _fallbacks{0};
+		// reclaiming the first nick, with MONITOR if the server has it and
+		// ISON every so often if not
+		TimerWheel::TimerId _reclaimTimer{TimerWheel::None};
+		int _reclaimInterval{60};
+		bool _reclaimable{true};
+		bool _monitoring{false};
+		// REGAINs and GHOSTs sent for the first nick, up to a few before
+		// we leave it to come free
+		int _recoveries{0};
+		int _maxRecoveries{4};
+		// QUIT has been sent; we're only waiting for the server to hang up
+		bool _quitting{false};
 
+		// looking up the server we're connecting to
+		Resolver *_resolver{nullptr};
 		BufReader _br{};
+		// whether the socket may have something for _br, and whether it
+		// has connected
+		bool _readable{false};
+		bool _writable{false};
 		std::string _wbuf{};
+		// set while the connection is over TLS
+		Tls *_tls{nullptr};
+		unsigned _connection{0};
+		uint64_t _queued{0};
+		uint64_t _written{0};
 
 		std::vector<std::string> _out{};
 };
@@ -0,0 +1,91 @@
+#include "isupport.hpp"
+using std::string;
+using std::vector;
+
+#include <limits>
+using std::numeric_limits;
+
+#include "util.hpp"
+using util::split;
+using util::fromString;
+
+static const size_t unlimited = numeric_limits<size_t>::max();
+
+// parse a limit value, where an empty value means there is no limit
+static size_t limit(string value);
+size_t limit(string value) {
+	if(value.empty())
+		return unlimited;
+	size_t lim = fromString<size_t>(value);
+	return lim ? lim : unlimited;
+}
+
+void ISupport::parse(const IRCMessage &msg) {
+	// first param is our nick and the last is human readable text
+	for(size_t i = 1; i + 1 < msg._params.size(); ++i) {
+		string token = msg._params[i];
+		if(token.empty())
+			continue;
+		if(token[0] == '-') {
+			_tokens.erase(token.substr(1));
+			continue;
+		}
+		size_t eq = token.find('=');
+		if(eq == string::npos)
+			_tokens[token] = "";
+		else
+			_tokens[token.substr(0, eq)] = token.substr(eq + 1);
+	}
+}
+void ISupport::clear() {
+	_tokens.clear();
+}
+
+vector<string> ISupport::tokens() const {
+	vector<string> tokens;
+	for(auto &token : _tokens)
+		tokens.push_back(token.second.empty() ? token.first
+				: token.first + "=" + token.second);
+	return tokens;
+}
+
+bool ISupport::has(string key) const {
+	return _tokens.find(key) != _tokens.end();
+}
+string ISupport::get(string key) const {
+	auto it = _tokens.find(key);
+	if(it == _tokens.end())
+		return "";
+	return it->second;
+}
+
+size_t ISupport::targetMax(string command) const {
+	if(has("TARGMAX")) {
+		for(auto &entry : split(get("TARGMAX"), ",")) {
+			size_t colon = entry.find(':');
+			if(entry.substr(0, colon) != command)
+				continue;
+			return (colon == string::npos) ? unlimited
+				: limit(entry.substr(colon + 1));
+		}
+		// TARGMAX lists every command accepting multiple targets
+		return 1;
+	}
+	bool isMessage = (command == "PRIVMSG" || command == "NOTICE");
+	if(isMessage && has("MAXTARGETS"))
+		return limit(get("MAXTARGETS"));
+	// without being told otherwise, only JOIN is safe to stack up
+	return (command == "JOIN") ? unlimited : 1;
+}
+
+size_t ISupport::chanLimit(char prefix) const {
+	// CHANLIMIT=#&:100,+:
+	for(auto &entry : split(get("CHANLIMIT"), ",")) {
+		size_t colon = entry.find(':');
+		if(colon == string::npos)
+			continue;
+		if(entry.substr(0, colon).find(prefix) != string::npos)
+			return limit(entry.substr(colon + 1));
+	}
+	return unlimited;
+}
@@ -0,0 +1,29 @@
+#ifndef ISUPPORT_HPP
+#define ISUPPORT_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+#include "ircmessage.hpp"
+
+// ISupport collects the tokens a server advertises in RPL_ISUPPORT (005)
+struct ISupport {
+	// Merge the tokens of a 005 message
+	void parse(const IRCMessage &msg);
+	void clear();
+
+	bool has(std::string key) const;
+	std::string get(std::string key) const;
+	// every token, in the form a 005 advertises them
+	std::vector<std::string> tokens() const;
+
+	// How many targets command may be given at once (TARGMAX, MAXTARGETS)
+	size_t targetMax(std::string command) const;
+	// How many channels starting with prefix we may be in (CHANLIMIT)
+	size_t chanLimit(char prefix) const;
+
+	protected:
+		std::map<std::string, std::string> _tokens{};
+};
+
+#endif // ISUPPORT_HPP
@@ -0,0 +1,301 @@
+#include "journal.hpp"
+using std::string;
+using std::vector;
+using std::pair;
+using std::deque;
+
+#include <iostream>
+using std::cerr;
+using std::endl;
+#include <chrono>
+using std::chrono::system_clock;
+using std::chrono::milliseconds;
+using std::chrono::duration_cast;
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <zlib.h>
+
+// the file starts with magic, then records, ended by one of zero length:
+//   u32 length, u32 flags, u64 seq, i64 time, u32 check, u32 0,
+//   byte{length}, padded to 8
+// check is the CRC-32 of everything but the flags, which change on ack; a
+// record which doesn't match it (torn by a crash) ends the journal
+static const char magic[8] = { 'J', 'I', 'T', 'R', 'O', 'J', '0', '2' };
+static const size_t headerSize = 64;
+static const size_t minSize = 64 * 1024;
+
+struct RecordHeader {
+	uint32_t _length;
+	uint32_t _flags;
+	uint64_t _seq;
+	int64_t _time;
+	uint32_t _check;
+	uint32_t _reserved;
+};
+static const uint32_t acked = 1;
+
+static size_t recordSize(size_t length);
+size_t recordSize(size_t length) {
+	return (sizeof(RecordHeader) + length + 7) & ~(size_t)7;
+}
+
+static uint32_t checksum(const RecordHeader *record, size_t length);
+uint32_t checksum(const RecordHeader *record, size_t length) {
+	uLong crc = crc32(0L, Z_NULL, 0);
+	crc = crc32(crc, (const Bytef *)&record->_seq, sizeof(record->_seq));
+	crc = crc32(crc, (const Bytef *)&record->_time, sizeof(record->_time));
+	uint32_t len = (uint32_t)length;
+	crc = crc32(crc, (const Bytef *)&len, sizeof(len));
+	crc = crc32(crc, (const Bytef *)(record + 1), (uInt)length);
+	return (uint32_t)crc;
+}
+
+static int64_t nowMs();
+int64_t nowMs() {
+	return duration_cast<milliseconds>(
+			system_clock::now().time_since_epoch()).count();
+}
+
+Journal::~Journal() {
+	close();
+}
+
+int Journal::open(string path, size_t size) {
+	close();
+	if(size < minSize)
+		size = minSize;
+
+	_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if(_fd < 0) {
+		perror("Journal::open");
+		return -1;
+	}
+	struct stat st;
+	if(fstat(_fd, &st) != 0 || ((size_t)st.st_size < size
+				&& ftruncate(_fd, size) != 0)) {
+		perror("Journal::open: sizing");
+		close();
+		return -1;
+	}
+	// a journal that was made bigger is kept at its size
+	_size = (size_t)st.st_size > size ? (size_t)st.st_size : size;
+	void *mem = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+	if(mem == MAP_FAILED) {
+		perror("Journal::open: mmap");
+		close();
+		return -1;
+	}
+	_mem = (char *)mem;
+	_path = path;
+
+	if(memcmp(_mem, magic, sizeof(magic)) != 0) {
+		memset(_mem, 0, headerSize + sizeof(RecordHeader));
+		memcpy(_mem, magic, sizeof(magic));
+		_dirty(0, headerSize + sizeof(RecordHeader));
+	}
+
+	// find what the last run left unacknowledged
+	size_t at = headerSize;
+	while(at + sizeof(RecordHeader) <= _size) {
+		RecordHeader *record = (RecordHeader *)(_mem + at);
+		if(record->_length == 0 || at + recordSize(record->_length) > _size
+				|| record->_check != checksum(record, record->_length))
+			break;
+		if(!(record->_flags & acked))
+			_unacked.push_back({ record->_seq, at });
+		if(record->_seq >= _next)
+			_next = record->_seq + 1;
+		at += recordSize(record->_length);
+	}
+	_end = at;
+	return 0;
+}
+
+void Journal::close() {
+	if(_mem) {
+		commit();
+		munmap(_mem, _size);
+	}
+	_mem = nullptr;
+	if(_fd >= 0)
+		::close(_fd);
+	_fd = -1;
+	_path.clear();
+	_unacked.clear();
+	_end = _size = 0;
+	_next = 1;
+	_dirtyFrom = _dirtyTo = 0;
+}
+
+bool Journal::valid() const {
+	return _mem != nullptr;
+}
+string Journal::path() const {
+	return _path;
+}
+
+Journal::Seq Journal::append(string line) {
+	if(!_mem || line.empty())
+		return 0;
+	size_t need = recordSize(line.length());
+	// leave room for the zero length record that ends the journal
+	if(_end + need + sizeof(RecordHeader) > _size)
+		_compact();
+	if(_end + need + sizeof(RecordHeader) > _size) {
+		cerr << "Journal::append: " << _path << " is full" << endl;
+		return 0;
+	}
+
+	size_t at = _end;
+	RecordHeader *record = (RecordHeader *)(_mem + at);
+	record->_flags = 0;
+	record->_seq = _next++;
+	record->_time = nowMs();
+	record->_reserved = 0;
+	memcpy(_mem + at + sizeof(RecordHeader), line.data(), line.length());
+	memset(_mem + at + need, 0, sizeof(RecordHeader));
+	record->_check = checksum(record, line.length());
+	record->_length = (uint32_t)line.length();
+
+	_end = at + need;
+	_dirty(at, _end + sizeof(RecordHeader));
+	_unacked.push_back({ record->_seq, at });
+	return record->_seq;
+}
+
+size_t Journal::_find(Seq seq) const {
+	// acknowledgements come (nearly) in order, so this is usually the front
+	for(auto &unacked : _unacked)
+		if(unacked.first == seq)
+			return unacked.second;
+	return 0;
+}
+
+void Journal::ack(Seq seq) {
+	size_t at = _find(seq);
+	if(!at)
+		return;
+	RecordHeader *record = (RecordHeader *)(_mem + at);
+	record->_flags |= acked;
+	_dirty(at, at + sizeof(RecordHeader));
+	for(auto it = _unacked.begin(); it != _unacked.end(); ++it)
+		if(it->first == seq) {
+			_unacked.erase(it);
+			break;
+		}
+}
+
+int Journal::commit() {
+	if(!_mem || _dirtyTo <= _dirtyFrom)
+		return 0;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t from = _dirtyFrom & ~(page - 1);
+	int res = msync(_mem + from, _dirtyTo - from, MS_SYNC);
+	if(res != 0)
+		perror("Journal::commit: msync");
+	_dirtyFrom = _dirtyTo = 0;
+	return res;
+}
+
+vector<Journal::Entry> Journal::pending(int maxAge, size_t &expired) {
+	vector<Entry> entries;
+	expired = 0;
+	int64_t oldest = nowMs() - (int64_t)maxAge * 1000;
+	vector<Seq> stale;
+	for(auto &unacked : _unacked) {
+		RecordHeader *record = (RecordHeader *)(_mem + unacked.second);
+		if(record->_time < oldest) {
+			stale.push_back(unacked.first);
+			continue;
+		}
+		Entry entry;
+		entry._seq = record->_seq;
+		entry._time = record->_time;
+		entry._line.assign(_mem + unacked.second + sizeof(RecordHeader),
+				record->_length);
+		entries.push_back(entry);
+	}
+	for(auto seq : stale)
+		ack(seq);
+	expired = stale.size();
+	return entries;
+}
+
+void Journal::_compact() {
+	// the unacknowledged records are copied to a new file which then takes
+	// this one's place, so a crash part way leaves one or the other whole
+	commit();
+	string tmp = _path + ".new";
+	int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if(fd < 0) {
+		perror("Journal::_compact: open");
+		return;
+	}
+	void *mem = MAP_FAILED;
+	if(ftruncate(fd, _size) == 0)
+		mem = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(mem == MAP_FAILED) {
+		perror("Journal::_compact: sizing");
+		::close(fd);
+		unlink(tmp.c_str());
+		return;
+	}
+
+	char *to = (char *)mem;
+	memcpy(to, magic, sizeof(magic));
+	size_t end = headerSize;
+	deque<pair<Seq, size_t>> moved;
+	for(auto &unacked : _unacked) {
+		RecordHeader *record = (RecordHeader *)(_mem + unacked.second);
+		size_t size = recordSize(record->_length);
+		memcpy(to + end, _mem + unacked.second, size);
+		moved.push_back({ unacked.first, end });
+		end += size;
+	}
+	memset(to + end, 0, sizeof(RecordHeader));
+
+	// the new file must be on disk before it's in place, and its name
+	// before we go on using it
+	string dir = _path.find('/') == string::npos ? "."
+		: _path.substr(0, _path.rfind('/') + 1);
+	int dirfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if(msync(mem, end + sizeof(RecordHeader), MS_SYNC) != 0
+			|| rename(tmp.c_str(), _path.c_str()) != 0) {
+		perror("Journal::_compact: replacing");
+		munmap(mem, _size);
+		::close(fd);
+		if(dirfd >= 0)
+			::close(dirfd);
+		unlink(tmp.c_str());
+		return;
+	}
+	if(dirfd >= 0) {
+		fsync(dirfd);
+		::close(dirfd);
+	}
+
+	munmap(_mem, _size);
+	::close(_fd);
+	_mem = to;
+	_fd = fd;
+	_end = end;
+	_unacked.swap(moved);
+	_dirtyFrom = _dirtyTo = 0;
+}
+
+void Journal::_dirty(size_t from, size_t to) {
+	if(_dirtyTo <= _dirtyFrom) {
+		_dirtyFrom = from;
+		_dirtyTo = to;
+		return;
+	}
+	if(from < _dirtyFrom)
+		_dirtyFrom = from;
+	if(to > _dirtyTo)
+		_dirtyTo = to;
+}
@@ -0,0 +1,74 @@
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <cstdint>
+
+// Journal is an append-only, memory mapped file of outbound lines, so that
+// what binaries asked us to send survives jitro or its connection going
+// away. Each line gets a sequence number and is acknowledged once it has
+// been written to the socket; whatever never was can be replayed.
+//
+// Appending only touches memory. commit() syncs everything appended since
+// the last commit in one go, so a burst of lines costs a single sync.
+// When the file fills up, unacknowledged records are copied into a new
+// file which replaces it. Records carry a checksum, so one torn by a crash
+// is never replayed.
+struct Journal {
+	typedef uint64_t Seq;
+	struct Entry {
+		Seq _seq{0};
+		// when it was appended, in ms since the epoch
+		int64_t _time{0};
+		std::string _line{};
+	};
+
+	Journal() = default;
+	~Journal();
+
+	Journal(const Journal &rhs) = delete;
+	Journal &operator=(const Journal &rhs) = delete;
+
+	// Open (creating if needed) a journal of size bytes, picking up any
+	// records left unacknowledged by a previous run
+	int open(std::string path, size_t size);
+	void close();
+	bool valid() const;
+	std::string path() const;
+
+	// Record line, returning its sequence number (0 if it couldn't be)
+	Seq append(std::string line);
+	// line seq has been written out and needn't be replayed
+	void ack(Seq seq);
+	// sync appends and acks to disk
+	int commit();
+
+	// Unacknowledged entries no older than maxAge seconds, oldest first.
+	// Older ones are acknowledged as expired and counted in expired.
+	std::vector<Entry> pending(int maxAge, size_t &expired);
+
+	protected:
+		// where the record for seq starts, or 0 if it's not unacknowledged
+		size_t _find(Seq seq) const;
+		void _compact();
+		void _dirty(size_t from, size_t to);
+
+	protected:
+		std::string _path{};
+		int _fd{-1};
+		char *_mem{nullptr};
+		size_t _size{0};
+		// where the next record goes
+		size_t _end{0};
+		Seq _next{1};
+		// (seq, offset) of records not acknowledged yet, in order
+		std::deque<std::pair<Seq, size_t>> _unacked{};
+		// byte range changed since the last commit
+		size_t _dirtyFrom{0};
+		size_t _dirtyTo{0};
+};
+
+#endif // JOURNAL_HPP
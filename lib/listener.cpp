@@ -0,0 +1,240 @@
+#include "listener.hpp"
+using std::string;
+
+#include <iostream>
+using std::cerr;
+using std::endl;
+
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "iobackend.hpp"
+#include "util.hpp"
+using util::startsWith;
+
+Listener::~Listener() {
+	close();
+}
+
+int Listener::listen(string address) {
+	close();
+	_address = address;
+
+	if(startsWith(address, "unix:")) {
+		_path = address.substr(5);
+		struct sockaddr_un sun;
+		memset(&sun, 0, sizeof(sun));
+		sun.sun_family = AF_UNIX;
+		if(_path.empty() || _path.length() >= sizeof(sun.sun_path)) {
+			cerr << "Listener::listen: bad socket path \"" << _path << "\"" << endl;
+			return -1;
+		}
+		strcpy(sun.sun_path, _path.c_str());
+
+		_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(_fd < 0) {
+			perror("Listener::listen: socket");
+			return -1;
+		}
+		// a stale socket from a previous run would make bind fail
+		::unlink(_path.c_str());
+		if(bind(_fd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+			perror("Listener::listen: bind");
+			_path.clear();
+			close();
+			return -1;
+		}
+	} else if(startsWith(address, "tcp:")) {
+		string hostport = address.substr(4);
+		size_t colon = hostport.rfind(':');
+		if(colon == string::npos) {
+			cerr << "Listener::listen: no port in \"" << address << "\"" << endl;
+			return -1;
+		}
+		string host = hostport.substr(0, colon), port = hostport.substr(colon + 1);
+
+		struct addrinfo hints, *res = nullptr;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+		int error = getaddrinfo(host.empty() ? nullptr : host.c_str(),
+				port.c_str(), &hints, &res);
+		if(error != 0) {
+			cerr << "Listener::listen: " << gai_strerror(error) << endl;
+			return -1;
+		}
+
+		_fd = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC,
+				res->ai_protocol);
+		if(_fd < 0) {
+			perror("Listener::listen: socket");
+			freeaddrinfo(res);
+			return -1;
+		}
+		int on = 1;
+		setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+		error = bind(_fd, res->ai_addr, res->ai_addrlen);
+		freeaddrinfo(res);
+		if(error != 0) {
+			perror("Listener::listen: bind");
+			close();
+			return -1;
+		}
+	} else {
+		cerr << "Listener::listen: unknown address \"" << address << "\"" << endl;
+		return -1;
+	}
+
+	if(::listen(_fd, 16) != 0) {
+		perror("Listener::listen");
+		close();
+		return -1;
+	}
+	fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+	return 0;
+}
+
+int Listener::accept() {
+	if(_fd < 0)
+		return -1;
+	int fd = accept4(_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if(fd < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+		perror("Listener::accept");
+	return fd;
+}
+
+void Listener::close() {
+	if(_fd >= 0) {
+		IOBackend::closing(_fd);
+		::close(_fd);
+	}
+	_fd = -1;
+	if(!_path.empty())
+		::unlink(_path.c_str());
+	_path.clear();
+}
+
+void Listener::handoff(Handoff &state, string prefix) const {
+	state.fd(prefix + "fd", _fd);
+	state.set(prefix + "address", _address);
+}
+int Listener::resume(const Handoff &state, string prefix) {
+	close();
+	_fd = state.fd(prefix + "fd");
+	if(_fd < 0)
+		return -1;
+	_address = state.get(prefix + "address");
+	if(startsWith(_address, "unix:"))
+		_path = _address.substr(5);
+	return 0;
+}
+
+int Listener::fd() const {
+	return _fd;
+}
+bool Listener::remote() const {
+	return startsWith(_address, "tcp:");
+}
+string Listener::address() const {
+	return _address;
+}
+
+
+Peer::Peer(int fd) : _fd(fd) {
+	_br.setup(_fd, "\n");
+}
+Peer::~Peer() {
+	close();
+}
+
+void Peer::write(string line) {
+	// past finish(), the peer isn't listening
+	if(_finished)
+		return;
+	_wbuf += line + "\n";
+	flush();
+}
+ssize_t Peer::flush() {
+	if(_wbuf.empty() || _fd < 0)
+		return 0;
+
+	// MSG_NOSIGNAL, as a worker vanishing must not take us down with SIGPIPE
+	ssize_t wamount = send(_fd, _wbuf.data(), _wbuf.length(), MSG_NOSIGNAL);
+	if((wamount < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+		return 0;
+
+	if(wamount < 0) {
+		perror("Peer::flush");
+		_broken = true;
+		return wamount;
+	}
+	if(wamount > 0)
+		_partial = _wbuf[wamount - 1] != '\n';
+	_wbuf.erase(0, wamount);
+	if(_wbuf.empty() && _finishing && !_finished) {
+		::shutdown(_fd, SHUT_WR);
+		_finished = true;
+	}
+	return wamount;
+}
+string Peer::read() {
+	if(_fd < 0)
+		return "";
+	string line = _br.read();
+	if(!line.empty() && line[line.length() - 1] == '\r')
+		line.erase(line.length() - 1);
+	return line;
+}
+string Peer::unsent() {
+	string data;
+	data.swap(_wbuf);
+	_partial = false;
+	return data;
+}
+void Peer::finish() {
+	_finishing = true;
+	if(_wbuf.empty() && _fd >= 0 && !_finished) {
+		::shutdown(_fd, SHUT_WR);
+		_finished = true;
+	}
+}
+string Peer::unstarted() {
+	size_t from = 0;
+	if(_partial) {
+		from = _wbuf.find('\n');
+		from = from == string::npos ? _wbuf.length() : from + 1;
+	}
+	string data = _wbuf.substr(from);
+	_wbuf.erase(from);
+	return data;
+}
+
+int Peer::fd() const {
+	return _fd;
+}
+bool Peer::wantsWrite() const {
+	return !_wbuf.empty();
+}
+bool Peer::writable() const {
+	if(_fd < 0)
+		return false;
+	struct pollfd pfd = { _fd, POLLOUT, 0 };
+	return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLOUT);
+}
+bool Peer::closed() const {
+	return _fd < 0 || _broken || _br.eof();
+}
+void Peer::close() {
+	if(_fd >= 0) {
+		IOBackend::closing(_fd);
+		::close(_fd);
+	}
+	_fd = -1;
+}
@@ -0,0 +1,79 @@
+#ifndef LISTENER_HPP
+#define LISTENER_HPP
+
+#include <string>
+#include <sys/types.h>
+#include "bufreader.hpp"
+#include "handoff.hpp"
+
+// Listener is a listening stream socket, bound to either "unix:<path>" or
+// "tcp:<host>:<port>". Accepted connections are non-blocking.
+struct Listener {
+	Listener() = default;
+	~Listener();
+
+	Listener(const Listener &rhs) = delete;
+	Listener &operator=(const Listener &rhs) = delete;
+
+	int listen(std::string address);
+	// a newly connected descriptor, or -1 if nobody is waiting
+	int accept();
+	void close();
+
+	// Pass the socket on to a new jitro, and pick it up there, so peers
+	// can keep connecting throughout
+	void handoff(Handoff &state, std::string prefix) const;
+	int resume(const Handoff &state, std::string prefix);
+
+	int fd() const;
+	// whether peers may be on other hosts
+	bool remote() const;
+	std::string address() const;
+
+	protected:
+		int _fd{-1};
+		std::string _address{};
+		std::string _path{};
+};
+
+// Peer is one accepted connection, carrying "\n" terminated lines
+struct Peer {
+	Peer(int fd);
+	~Peer();
+
+	Peer(const Peer &rhs) = delete;
+	Peer &operator=(const Peer &rhs) = delete;
+
+	// queue a line, and write as much of what is queued as we can
+	void write(std::string line);
+	ssize_t flush();
+	// a complete line, or blank if there isn't one yet
+	std::string read();
+	// whatever was queued but never written
+	std::string unsent();
+	// tell the peer there's nothing more coming, once what's queued is out
+	void finish();
+	// the same, less the rest of a line that was partly written (which
+	// stays queued, so what the peer reads still comes in whole lines)
+	std::string unstarted();
+
+	int fd() const;
+	bool wantsWrite() const;
+	// whether the peer has room for more, without waiting
+	bool writable() const;
+	// the peer hung up or the connection broke
+	bool closed() const;
+	void close();
+
+	protected:
+		int _fd{-1};
+		bool _broken{false};
+		std::string _wbuf{};
+		// whether the front of _wbuf is the rest of a partly written line
+		bool _partial{false};
+		bool _finishing{false};
+		bool _finished{false};
+		BufReader _br{};
+};
+
+#endif // LISTENER_HPP
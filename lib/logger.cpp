@@ -0,0 +1,175 @@
+#include "logger.hpp"
+using std::string;
+
+#include <deque>
+using std::deque;
+#include <map>
+using std::map;
+#include <fstream>
+using std::ofstream;
+using std::ios_base;
+#include <iostream>
+using std::cerr;
+using std::endl;
+#include <thread>
+using std::thread;
+#include <mutex>
+using std::mutex;
+using std::unique_lock;
+using std::lock_guard;
+#include <condition_variable>
+using std::condition_variable;
+#include <memory>
+using std::unique_ptr;
+#include <ctime>
+
+#include "logstore.hpp"
+
+// lines queued for the thread past which new ones are dropped
+static const size_t maxQueued = 65536;
+
+static mutex queueLock;
+static condition_variable wakeup;
+// a line for the file at _path, or for the store (said on _network at
+// _when) if there's no path
+struct Entry {
+	string _path{};
+	string _network{};
+	string _line{};
+	time_t _when{0};
+};
+static deque<Entry> queue;
+static size_t dropped = 0;
+static bool running = false;
+static bool stopping = false;
+static thread worker;
+// only touched by whoever is writing: the thread, or the caller without it
+static map<string, ofstream> files;
+static unique_ptr<LogStore> store;
+
+static void append(const string &path, const string &line);
+void append(const string &path, const string &line) {
+	ofstream &file = files[path];
+	if(!file.is_open())
+		file.open(path, ios_base::app);
+	if(file.good())
+		file << line << '\n';
+}
+
+static void append(const Entry &entry);
+void append(const Entry &entry) {
+	if(!entry._path.empty())
+		append(entry._path, entry._line);
+	else if(store)
+		store->append(entry._when, entry._network, entry._line);
+}
+
+static void flush();
+void flush() {
+	for(auto &file : files)
+		file.second.flush();
+	if(store)
+		store->flush();
+}
+
+static void run(Placement placement);
+void run(Placement placement) {
+	placement.apply("jitro-log");
+	unique_lock<mutex> guard(queueLock);
+	while(true) {
+		wakeup.wait(guard, []() { return !queue.empty() || stopping; });
+		if(queue.empty() && stopping)
+			break;
+		deque<Entry> lines;
+		lines.swap(queue);
+		size_t lost = dropped;
+		dropped = 0;
+		// the disk is only waited on with the lock let go
+		guard.unlock();
+		if(lost)
+			cerr << "logger: dropped " << lost << " lines, falling behind" << endl;
+		for(auto &line : lines)
+			append(line);
+		flush();
+		guard.lock();
+	}
+	for(auto &file : files)
+		file.second.close();
+	files.clear();
+	// the segment is picked up where it was left by whoever stores next
+	if(store)
+		store->close();
+}
+
+void logger::start(const Placement &placement) {
+	lock_guard<mutex> guard(queueLock);
+	if(running)
+		return;
+	// what was written on the spot is closed, for the thread to reopen
+	for(auto &file : files)
+		file.second.close();
+	files.clear();
+	if(store)
+		store->close();
+	stopping = false;
+	running = true;
+	worker = thread(run, placement);
+}
+
+void logger::stop() {
+	{
+		lock_guard<mutex> guard(queueLock);
+		if(!running)
+			return;
+		stopping = true;
+	}
+	wakeup.notify_one();
+	worker.join();
+	lock_guard<mutex> guard(queueLock);
+	running = false;
+}
+
+static void push(Entry entry);
+void push(Entry entry) {
+	unique_lock<mutex> guard(queueLock);
+	if(!running) {
+		append(entry);
+		flush();
+		return;
+	}
+	if(queue.size() >= maxQueued) {
+		dropped++;
+		return;
+	}
+	queue.push_back(std::move(entry));
+	guard.unlock();
+	wakeup.notify_one();
+}
+
+void logger::write(string path, string line) {
+	Entry entry;
+	entry._path = std::move(path);
+	entry._line = std::move(line);
+	push(std::move(entry));
+}
+
+void logger::storeIn(string dir, int segment) {
+	lock_guard<mutex> guard(queueLock);
+	if(running) {
+		cerr << "logger::storeIn: the log thread is already running" << endl;
+		return;
+	}
+	store.reset(new LogStore(dir, segment));
+	// segments left from before are compressed here, before there's a
+	// thread to do it
+	if(store->open() != 0)
+		store.reset();
+}
+
+void logger::record(string network, string line) {
+	Entry entry;
+	entry._network = std::move(network);
+	entry._line = std::move(line);
+	entry._when = time(nullptr);
+	push(std::move(entry));
+}
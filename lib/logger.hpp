@@ -0,0 +1,27 @@
+#ifndef LOGGER_HPP
+#define LOGGER_HPP
+
+#include <string>
+#include "placement.hpp"
+
+// logger appends lines to log files from a thread of its own, so the main
+// loop never waits on the disk. Until it's started (and after it's
+// stopped) lines are written on the spot instead. If the thread falls too
+// far behind, lines are dropped rather than held up.
+namespace logger {
+	// start the thread, placed as placement says
+	void start(const Placement &placement);
+	// write out everything queued, then end the thread
+	void stop();
+
+	// append line (a newline is added) to the file at path
+	void write(std::string path, std::string line);
+
+	// Keep what the networks say in a LogStore in dir, of segment seconds
+	// to a segment; until this is called, it isn't kept
+	void storeIn(std::string dir, int segment);
+	// store line, as just said on network
+	void record(std::string network, std::string line);
+}
+
+#endif // LOGGER_HPP
@@ -0,0 +1,287 @@
+#include "logstore.hpp"
+using std::string;
+using std::vector;
+using std::function;
+using std::ofstream;
+using std::ifstream;
+using std::ios_base;
+
+#include <iostream>
+using std::cerr;
+using std::endl;
+#include <set>
+using std::set;
+#include <algorithm>
+using std::sort;
+using std::unique;
+using std::max;
+#include <cstdlib>
+#include <cstring>
+
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "ircmessage.hpp"
+#include "casemap.hpp"
+#include "util.hpp"
+using util::toString;
+using util::endsWith;
+using util::readable;
+
+// split "<time> <network> <line>" into its parts, false if it isn't that
+static bool parseRecord(const string &record, time_t &when, string &network,
+		string &line);
+bool parseRecord(const string &record, time_t &when, string &network,
+		string &line) {
+	size_t first = record.find(' ');
+	if(first == string::npos)
+		return false;
+	size_t second = record.find(' ', first + 1);
+	if(second == string::npos)
+		return false;
+	char *end = nullptr;
+	when = (time_t)strtoll(record.c_str(), &end, 10);
+	if(end != record.c_str() + first)
+		return false;
+	network = record.substr(first + 1, second - first - 1);
+	line = record.substr(second + 1);
+	return true;
+}
+
+LogStore::LogStore(string dir, int segment) : _dir(dir), _segment(segment) {
+	if(_segment <= 0)
+		_segment = 3600;
+}
+LogStore::~LogStore() {
+	close();
+}
+
+string LogStore::_path(time_t start, string suffix) const {
+	return _dir + "/" + toString((long long)start) + suffix;
+}
+
+vector<time_t> LogStore::_segments() const {
+	vector<time_t> starts;
+	DIR *dir = opendir(_dir.c_str());
+	if(!dir)
+		return starts;
+	for(struct dirent *entry; (entry = readdir(dir)); ) {
+		string name = entry->d_name;
+		if(!endsWith(name, ".log") && !endsWith(name, ".idx"))
+			continue;
+		char *end = nullptr;
+		long long start = strtoll(name.c_str(), &end, 10);
+		if(end == name.c_str() || *end != '.')
+			continue;
+		starts.push_back((time_t)start);
+	}
+	closedir(dir);
+	sort(starts.begin(), starts.end());
+	starts.erase(unique(starts.begin(), starts.end()), starts.end());
+	return starts;
+}
+
+int LogStore::open() {
+	if(mkdir(_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+		perror(("LogStore::open: " + _dir).c_str());
+		return -1;
+	}
+	time_t now = time(nullptr), current = now - now % _segment;
+	for(time_t start : _segments()) {
+		if(!readable(_path(start, ".log")))
+			continue;
+		// compressed, but not cleaned up after
+		if(readable(_path(start, ".idx")))
+			unlink(_path(start, ".log").c_str());
+		else if(start < current)
+			compress(start);
+	}
+	return 0;
+}
+
+void LogStore::append(time_t when, const string &network,
+		const string &line) {
+	// a clock going back leaves lines in the segment they came during
+	if(_start >= 0 && when >= _start + _segment) {
+		time_t done = _start;
+		close();
+		compress(done);
+	}
+	if(_start < 0) {
+		_start = when - when % _segment;
+		_file.open(_path(_start, ".log"), ios_base::app);
+		if(!_file.good())
+			cerr << "LogStore::append: can't write to " << _path(_start, ".log")
+				<< endl;
+	}
+	if(_file.good())
+		_file << (long long)when << ' ' << network << ' ' << line << '\n';
+}
+
+void LogStore::flush() {
+	if(_file.is_open())
+		_file.flush();
+}
+
+void LogStore::close() {
+	if(_file.is_open())
+		_file.close();
+	_file.clear();
+	_start = -1;
+}
+
+int LogStore::compress(time_t start) const {
+	ifstream in(_path(start, ".log"), ios_base::binary);
+	if(!in.good())
+		return -1;
+	string segPath = _path(start, ".seg"), idxPath = _path(start, ".idx");
+	ofstream seg(segPath + ".tmp", ios_base::binary | ios_base::trunc),
+		idx(idxPath + ".tmp", ios_base::trunc);
+
+	string block, record, network, line;
+	set<string> networks;
+	time_t when = 0, first = 0, last = 0;
+	uint64_t offset = 0;
+	vector<Bytef> out;
+	bool failed = false;
+	auto emit = [&]() {
+		if(block.empty())
+			return;
+		uLongf length = compressBound(block.length());
+		out.resize(length);
+		if(compress2(out.data(), &length, (const Bytef *)block.data(),
+					block.length(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+			failed = true;
+			return;
+		}
+		seg.write((const char *)out.data(), length);
+		string names;
+		for(auto &name : networks)
+			names += (names.empty() ? "" : ",") + name;
+		idx << offset << ' ' << length << ' ' << block.length() << ' '
+			<< (long long)first << ' ' << (long long)last << ' ' << names << '\n';
+		offset += length;
+		block.clear();
+		networks.clear();
+	};
+	while(getline(in, record)) {
+		if(!parseRecord(record, when, network, line))
+			continue;
+		if(block.empty())
+			first = last = when;
+		last = max(last, when);
+		networks.insert(network);
+		block += record + '\n';
+		if(block.length() >= blockSize)
+			emit();
+	}
+	emit();
+	seg.close();
+	idx.close();
+
+	// the index goes in last, as it's what says the segment is compressed
+	if(failed || !seg.good() || !idx.good()
+			|| rename((segPath + ".tmp").c_str(), segPath.c_str()) != 0
+			|| rename((idxPath + ".tmp").c_str(), idxPath.c_str()) != 0) {
+		cerr << "LogStore::compress: unable to compress "
+			<< _path(start, ".log") << endl;
+		unlink((segPath + ".tmp").c_str());
+		unlink((idxPath + ".tmp").c_str());
+		return -1;
+	}
+	unlink(_path(start, ".log").c_str());
+	return 0;
+}
+
+int LogStore::find(const Query &query,
+		function<void(const string &)> each) const {
+	if(access(_dir.c_str(), R_OK | X_OK) != 0)
+		return -1;
+	// each segment runs until the next one starts
+	vector<time_t> starts = _segments();
+	for(size_t i = 0; i < starts.size(); ++i) {
+		if(starts[i] > query._to)
+			break;
+		if(i + 1 < starts.size() && starts[i + 1] <= query._from)
+			continue;
+		if(readable(_path(starts[i], ".idx")))
+			_findCompressed(starts[i], query, each);
+		else
+			_findPlain(starts[i], query, each);
+	}
+	return 0;
+}
+
+bool LogStore::_matches(const string &record, const Query &query) const {
+	time_t when;
+	string network, line;
+	if(!parseRecord(record, when, network, line))
+		return false;
+	if(when < query._from || when > query._to)
+		return false;
+	if(!query._network.empty() && network != query._network)
+		return false;
+	// the network's own casemapping isn't kept, but RFC1459 is what nearly
+	// all use and also covers plain ASCII
+	if(!query._channel.empty() && !caseEqual(IRCMessage::parse(line).param(0),
+				query._channel, CaseMapping::RFC1459))
+		return false;
+	return true;
+}
+
+void LogStore::_findPlain(time_t start, const Query &query,
+		function<void(const string &)> each) const {
+	ifstream in(_path(start, ".log"));
+	for(string record; getline(in, record); )
+		if(_matches(record, query))
+			each(record);
+}
+
+void LogStore::_findCompressed(time_t start, const Query &query,
+		function<void(const string &)> each) const {
+	ifstream idx(_path(start, ".idx")), seg(_path(start, ".seg"),
+			ios_base::binary);
+	vector<char> in;
+	vector<Bytef> out;
+	for(string entry; getline(idx, entry); ) {
+		char names[4096] = "";
+		unsigned long long offset, length, raw;
+		long long first, last;
+		if(sscanf(entry.c_str(), "%llu %llu %llu %lld %lld %4095s", &offset,
+					&length, &raw, &first, &last, names) < 5)
+			continue;
+		if(last < query._from || first > query._to)
+			continue;
+		if(!query._network.empty()) {
+			bool has = false;
+			for(auto &name : util::split(names, ","))
+				has |= name == query._network;
+			if(!has)
+				continue;
+		}
+
+		in.resize(length);
+		out.resize(raw);
+		seg.clear();
+		seg.seekg((std::streamoff)offset);
+		if(!seg.read(in.data(), (std::streamsize)length))
+			break;
+		uLongf size = raw;
+		if(uncompress(out.data(), &size, (const Bytef *)in.data(), length)
+				!= Z_OK) {
+			cerr << "LogStore::find: corrupt block at " << offset << " in "
+				<< _path(start, ".seg") << endl;
+			continue;
+		}
+		const char *data = (const char *)out.data();
+		for(size_t pos = 0, nl; pos < size; pos = nl + 1) {
+			const char *end = (const char *)memchr(data + pos, '\n', size - pos);
+			nl = end ? (size_t)(end - data) : size;
+			string record(data + pos, nl - pos);
+			if(_matches(record, query))
+				each(record);
+		}
+	}
+}
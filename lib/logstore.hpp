@@ -0,0 +1,78 @@
+#ifndef LOGSTORE_HPP
+#define LOGSTORE_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <functional>
+#include <ctime>
+#include <limits>
+
+// LogStore keeps what the networks said in a directory of segments, one per
+// _segment seconds (aligned to the epoch) and named after when it starts.
+// Lines are stored as "<unix time> <network> <line>".
+//
+// The current segment, <start>.log, is plain text appended to as lines
+// come in. Once its time is up it's compressed into <start>.seg, a run of
+// zlib compressed blocks of about blockSize bytes of lines each, and
+// <start>.idx, a sparse index with one line per block:
+//
+//   <offset> <compressed length> <length> <first time> <last time> <networks>
+//
+// where networks lists those with lines in the block, comma separated. A
+// lookup only has to decompress the blocks which can hold what it's after.
+struct LogStore {
+	static const size_t blockSize = 64 * 1024;
+
+	// what find looks for; blank matches anything
+	struct Query {
+		std::string _network{};
+		std::string _channel{};
+		time_t _from{0};
+		time_t _to{std::numeric_limits<time_t>::max()};
+	};
+
+	LogStore(std::string dir, int segment = 3600);
+	~LogStore();
+
+	LogStore(const LogStore &rhs) = delete;
+	LogStore &operator=(const LogStore &rhs) = delete;
+
+	// Make the directory if need be, and compress the segments an earlier
+	// run left behind whose time is up. Returns -1 if the directory is
+	// unusable.
+	int open();
+	void append(time_t when, const std::string &network,
+			const std::string &line);
+	void flush();
+	// close the current segment, leaving it to be compressed later
+	void close();
+
+	// Give each stored line matching query to each, oldest first. Returns
+	// -1 if the directory can't be read.
+	int find(const Query &query,
+			std::function<void(const std::string &)> each) const;
+
+	// Compress the segment starting at start, replacing its .log with a
+	// .seg and .idx; returns -1 (leaving the .log) if that fails
+	int compress(time_t start) const;
+
+	protected:
+		std::string _path(time_t start, std::string suffix) const;
+		// starts of the segments there are, in order
+		std::vector<time_t> _segments() const;
+		bool _matches(const std::string &line, const Query &query) const;
+		void _findPlain(time_t start, const Query &query,
+				std::function<void(const std::string &)> each) const;
+		void _findCompressed(time_t start, const Query &query,
+				std::function<void(const std::string &)> each) const;
+
+	protected:
+		std::string _dir{};
+		int _segment{3600};
+		// the current segment, if one is open
+		time_t _start{-1};
+		std::ofstream _file{};
+};
+
+#endif // LOGSTORE_HPP
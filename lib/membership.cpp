@@ -0,0 +1,253 @@
+#include "membership.hpp"
+using std::string;
+using std::vector;
+
+#include <algorithm>
+using std::find;
+
+#include "util.hpp"
+using util::split;
+
+void Membership::configure(const ISupport &isupport) {
+	// PREFIX=(ov)@+
+	string prefix = isupport.get("PREFIX");
+	size_t close = prefix.find(')');
+	if(!prefix.empty() && prefix[0] == '(' && close != string::npos) {
+		string modes = prefix.substr(1, close - 1),
+			symbols = prefix.substr(close + 1);
+		if(modes.length() == symbols.length()) {
+			// we only have room for so many bits per membership
+			size_t max = sizeof(ModeBits) * 8;
+			_prefixModes = modes.substr(0, max);
+			_prefixSymbols = symbols.substr(0, max);
+		}
+	}
+
+	// CHANMODES=A,B,C,D
+	if(isupport.has("CHANMODES")) {
+		vector<string> types = split(isupport.get("CHANMODES"), ",");
+		types.resize(4);
+		_paramModes = types[0] + types[1];
+		_setParamModes = types[2];
+	}
+
+	if(isupport.has("CASEMAPPING")) {
+		CaseMapping cm = toCaseMapping(isupport.get("CASEMAPPING"));
+		if(cm != CaseMapping::INVALID) {
+			_chans.caseMapping(cm);
+			_nicks.caseMapping(cm);
+		}
+	}
+}
+void Membership::clear() {
+	_chans.clear();
+	_nicks.clear();
+	_channels.clear();
+	_users.clear();
+}
+
+void Membership::join(string chan, string nick) {
+	_add(_chans.intern(chan), _nicks.intern(nick), 0);
+}
+void Membership::part(string chan, string nick) {
+	Id cid = _chans.find(chan), uid = _nicks.find(nick);
+	if(cid == NameTable::None || uid == NameTable::None)
+		return;
+	_remove(cid, uid);
+}
+void Membership::quit(string nick) {
+	Id uid = _nicks.find(nick);
+	if(uid == NameTable::None)
+		return;
+	vector<Id> chans = _users[uid]._channels;
+	for(auto cid : chans)
+		_channels[cid]._users.erase(uid);
+	_users[uid]._channels.clear();
+	_release(uid);
+}
+void Membership::rename(string from, string to) {
+	Id uid = _nicks.find(from);
+	if(uid == NameTable::None)
+		return;
+	Id nid = _nicks.find(to);
+	// only a case change, or the new nick is somehow already known
+	if(nid == uid) {
+		_nicks.release(uid);
+		_nicks.intern(to);
+		return;
+	}
+	if(nid != NameTable::None)
+		quit(to);
+
+	vector<Id> chans = _users[uid]._channels;
+	vector<ModeBits> bits;
+	for(auto cid : chans)
+		bits.push_back(_channels[cid]._users[uid]);
+	quit(from);
+	for(size_t i = 0; i < chans.size(); ++i)
+		_add(chans[i], _nicks.intern(to), bits[i]);
+}
+void Membership::mode(string chan, vector<string> args) {
+	Id cid = _chans.find(chan);
+	if(cid == NameTable::None || args.empty())
+		return;
+
+	string modes = args[0];
+	size_t arg = 1;
+	bool set = true;
+	for(auto m : modes) {
+		if(m == '+' || m == '-') {
+			set = (m == '+');
+			continue;
+		}
+		size_t rank = _prefixModes.find(m);
+		if(rank != string::npos) {
+			if(arg >= args.size())
+				return;
+			Id uid = _nicks.find(args[arg++]);
+			if(uid == NameTable::None)
+				continue;
+			auto it = _channels[cid]._users.find(uid);
+			if(it == _channels[cid]._users.end())
+				continue;
+			if(set)
+				it->second |= (ModeBits)(1 << rank);
+			else
+				it->second &= (ModeBits)~(1 << rank);
+			continue;
+		}
+		// skip over params of modes which don't concern membership
+		if(_paramModes.find(m) != string::npos
+				|| (set && _setParamModes.find(m) != string::npos))
+			arg++;
+	}
+}
+void Membership::forget(string chan) {
+	Id cid = _chans.find(chan);
+	if(cid == NameTable::None)
+		return;
+	vector<Id> uids;
+	for(auto &u : _channels[cid]._users)
+		uids.push_back(u.first);
+	for(auto uid : uids)
+		_remove(cid, uid);
+	_channels[cid] = Channel();
+	_chans.release(cid);
+}
+
+void Membership::names(string chan, string entries) {
+	Id cid = _chans.intern(chan);
+	if(cid >= _channels.size())
+		_channels.resize(_chans.bound());
+
+	// a fresh NAMES reply replaces whatever we thought we knew
+	if(!_channels[cid]._syncing) {
+		vector<Id> uids;
+		for(auto &u : _channels[cid]._users)
+			uids.push_back(u.first);
+		for(auto uid : uids)
+			_remove(cid, uid);
+		_channels[cid]._syncing = true;
+	}
+
+	for(auto entry : split(entries, " ")) {
+		ModeBits bits = 0;
+		size_t i = 0;
+		// multi-prefix may give us several symbols
+		for(; i < entry.length(); ++i) {
+			size_t rank = _prefixSymbols.find(entry[i]);
+			if(rank == string::npos)
+				break;
+			bits |= (ModeBits)(1 << rank);
+		}
+		// userhost-in-names gives nick!user@host
+		string nick = entry.substr(i);
+		nick = nick.substr(0, nick.find('!'));
+		if(!nick.empty())
+			_add(cid, _nicks.intern(nick), bits);
+	}
+}
+void Membership::endNames(string chan) {
+	Id cid = _chans.find(chan);
+	if(cid == NameTable::None || cid >= _channels.size())
+		return;
+	_channels[cid]._syncing = false;
+}
+
+vector<string> Membership::members(string chan) const {
+	vector<string> res;
+	Id cid = _chans.find(chan);
+	if(cid == NameTable::None || cid >= _channels.size())
+		return res;
+	res.reserve(_channels[cid]._users.size());
+	for(auto &u : _channels[cid]._users)
+		res.push_back(_symbols(u.second, false) + _nicks.name(u.first));
+	return res;
+}
+vector<string> Membership::channels(string nick) const {
+	vector<string> res;
+	Id uid = _nicks.find(nick);
+	if(uid == NameTable::None || uid >= _users.size())
+		return res;
+	for(auto cid : _users[uid]._channels)
+		res.push_back(_chans.name(cid));
+	return res;
+}
+string Membership::modes(string chan, string nick) const {
+	Id cid = _chans.find(chan), uid = _nicks.find(nick);
+	if(cid == NameTable::None || uid == NameTable::None
+			|| cid >= _channels.size())
+		return "";
+	auto it = _channels[cid]._users.find(uid);
+	if(it == _channels[cid]._users.end())
+		return "";
+	return _symbols(it->second, true);
+}
+string Membership::entries(string chan) const {
+	Id cid = _chans.find(chan);
+	if(cid == NameTable::None || cid >= _channels.size())
+		return "";
+	string res;
+	for(auto &user : _channels[cid]._users)
+		res += (res.empty() ? "" : " ") + _symbols(user.second, true)
+			+ _nicks.name(user.first);
+	return res;
+}
+
+void Membership::_add(Id cid, Id uid, ModeBits bits) {
+	if(cid >= _channels.size())
+		_channels.resize(_chans.bound());
+	if(uid >= _users.size())
+		_users.resize(_nicks.bound());
+
+	auto res = _channels[cid]._users.insert({ uid, bits });
+	if(res.second)
+		_users[uid]._channels.push_back(cid);
+	else
+		res.first->second |= bits;
+}
+void Membership::_remove(Id cid, Id uid) {
+	_channels[cid]._users.erase(uid);
+	vector<Id> &chans = _users[uid]._channels;
+	auto it = find(chans.begin(), chans.end(), cid);
+	if(it != chans.end())
+		chans.erase(it);
+	if(chans.empty())
+		_release(uid);
+}
+void Membership::_release(Id uid) {
+	_users[uid] = User();
+	_nicks.release(uid);
+}
+
+string Membership::_symbols(ModeBits bits, bool all) const {
+	string res;
+	for(size_t rank = 0; rank < _prefixSymbols.length(); ++rank) {
+		if(!(bits & (1 << rank)))
+			continue;
+		res += _prefixSymbols[rank];
+		if(!all)
+			break;
+	}
+	return res;
+}
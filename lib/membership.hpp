@@ -0,0 +1,75 @@
+#ifndef MEMBERSHIP_HPP
+#define MEMBERSHIP_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "casemap.hpp"
+#include "isupport.hpp"
+
+// Membership tracks which users are in which channels on a single network,
+// along with the prefix modes (op, voice, ...) each user holds per channel.
+// It is kept up to date incrementally from NAMES replies and from JOIN,
+// PART, KICK, QUIT, NICK and MODE as they are seen.
+struct Membership {
+	typedef NameTable::Id Id;
+
+	// Pick up PREFIX, CHANMODES and CASEMAPPING from the server
+	void configure(const ISupport &isupport);
+	void clear();
+
+	void join(std::string chan, std::string nick);
+	// A user left chan by PART or KICK; if it was us, call forget instead
+	void part(std::string chan, std::string nick);
+	void quit(std::string nick);
+	void rename(std::string from, std::string to);
+	// Apply a channel MODE change, ignoring non-membership modes
+	void mode(std::string chan, std::vector<std::string> args);
+	// Drop all state for a channel (we left it)
+	void forget(std::string chan);
+
+	// A RPL_NAMREPLY (353) entry list, and its RPL_ENDOFNAMES (366)
+	void names(std::string chan, std::string entries);
+	void endNames(std::string chan);
+
+	// nicks in chan, each prefixed with its highest prefix mode symbol
+	std::vector<std::string> members(std::string chan) const;
+	// channels we share with nick
+	std::vector<std::string> channels(std::string nick) const;
+	// every prefix symbol nick has in chan, highest first
+	std::string modes(std::string chan, std::string nick) const;
+	// chan as a multi-prefix NAMES entry list, which names() accepts back
+	std::string entries(std::string chan) const;
+
+	protected:
+		typedef unsigned char ModeBits;
+		struct Channel {
+			std::unordered_map<Id, ModeBits> _users{};
+			// set between the first 353 of a NAMES reply and its 366
+			bool _syncing{false};
+		};
+		struct User {
+			std::vector<Id> _channels{};
+		};
+
+		void _add(Id cid, Id uid, ModeBits bits);
+		void _remove(Id cid, Id uid);
+		void _release(Id uid);
+		std::string _symbols(ModeBits bits, bool all) const;
+
+	protected:
+		NameTable _chans{};
+		NameTable _nicks{};
+		// both indexed by their id in the respective table
+		std::vector<Channel> _channels{};
+		std::vector<User> _users{};
+
+		// prefix modes from highest to lowest rank, and their symbols
+		std::string _prefixModes{"ov"};
+		std::string _prefixSymbols{"@+"};
+		// CHANMODES types A and B always take a param, C only when set
+		std::string _paramModes{"beIk"};
+		std::string _setParamModes{"l"};
+};
+
+#endif // MEMBERSHIP_HPP
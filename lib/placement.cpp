@@ -0,0 +1,112 @@
+#include "placement.hpp"
+using std::string;
+using std::vector;
+
+#include <iostream>
+using std::cerr;
+using std::endl;
+#include <cstdlib>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <numa.h>
+
+#include "util.hpp"
+using util::split;
+
+// where the process could run before we placed anything
+static cpu_set_t original;
+static bool remembered = false;
+
+bool Placement::empty() const {
+	return _cpus.empty() && _node < 0;
+}
+bool Placement::operator==(const Placement &rhs) const {
+	return _cpus == rhs._cpus && _node == rhs._node;
+}
+
+bool Placement::parseCpus(string spec, vector<int> &cpus) {
+	cpus.clear();
+	for(auto &range : split(spec, ", ")) {
+		char *end = nullptr;
+		long first = strtol(range.c_str(), &end, 10), last = first;
+		if(end == range.c_str())
+			return false;
+		if(*end == '-') {
+			const char *rest = end + 1;
+			last = strtol(rest, &end, 10);
+			if(end == rest)
+				return false;
+		}
+		if(*end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE)
+			return false;
+		for(long cpu = first; cpu <= last; ++cpu)
+			cpus.push_back((int)cpu);
+	}
+	return true;
+}
+
+int Placement::nodes() {
+	if(numa_available() < 0)
+		return 0;
+	return numa_max_node() + 1;
+}
+
+void Placement::remember() {
+	if(sched_getaffinity(0, sizeof(original), &original) == 0)
+		remembered = true;
+}
+
+int Placement::apply(string name) const {
+	int res = 0;
+	// a thread's name is what top -H and perf show for it
+	if(!name.empty() && pthread_setname_np(pthread_self(),
+				name.substr(0, 15).c_str()) != 0) {
+		cerr << "Placement::apply: can't name thread " << name << endl;
+		res = -1;
+	}
+	if(_place(false) != 0)
+		res = -1;
+	return res;
+}
+int Placement::applyProcess() const {
+	if(!empty())
+		return _place(true);
+	if(!remembered)
+		return 0;
+	if(numa_available() >= 0)
+		numa_set_localalloc();
+	return sched_setaffinity(0, sizeof(original), &original);
+}
+
+int Placement::_place(bool process) const {
+	int res = 0;
+	// the node first, which sets affinity to all of its CPUs; any CPUs
+	// given narrow that down afterwards
+	if(_node >= 0) {
+		if(numa_available() < 0 || _node > numa_max_node()) {
+			cerr << "Placement: no NUMA node " << _node << endl;
+			res = -1;
+		} else if(numa_run_on_node(_node) != 0) {
+			perror("Placement: numa_run_on_node");
+			res = -1;
+		} else
+			numa_set_localalloc();
+	}
+
+	if(_cpus.empty())
+		return res;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(int cpu : _cpus)
+		CPU_SET(cpu, &set);
+	// a process pins its main thread, which is all there is before exec
+	int error = process ? sched_setaffinity(0, sizeof(set), &set)
+		: pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if(error != 0) {
+		cerr << "Placement: can't run on the CPUs asked for" << endl;
+		res = -1;
+	}
+	return res;
+}
@@ -0,0 +1,39 @@
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+#include <string>
+#include <vector>
+
+// Placement says where a thread, or a binary we run, should be: which CPUs
+// it may run on, and which NUMA node it runs on and allocates memory from.
+// An empty placement leaves it to the scheduler.
+struct Placement {
+	std::vector<int> _cpus{};
+	// -1 for no node in particular
+	int _node{-1};
+
+	bool empty() const;
+	bool operator==(const Placement &rhs) const;
+
+	// Parse a CPU list such as "0-3,6" into cpus, false if it's malformed
+	static bool parseCpus(std::string spec, std::vector<int> &cpus);
+	// NUMA nodes there are to place things on (0 without NUMA support)
+	static int nodes();
+	// Note where the process may run as it was started, before placing
+	// any of our own threads; an empty placement puts a process back there
+	static void remember();
+
+	// Move the calling thread where this says, naming it name (cut to the
+	// 15 bytes the kernel keeps) unless name is blank. Returns 0, or -1 if
+	// any of it couldn't be done, having said what.
+	int apply(std::string name) const;
+	// The same for a whole process, as a forked child does before exec
+	// (having inherited where the forking thread was put); the memory
+	// policy carries over into what it execs.
+	int applyProcess() const;
+
+	protected:
+		int _place(bool process) const;
+};
+
+#endif // PLACEMENT_HPP
@@ -0,0 +1,35 @@
+#ifndef PROBES_HPP
+#define PROBES_HPP
+
+// Static probe points on the hot path, for perf, bpftrace or SystemTap to
+// attach to without rebuilding, e.g.
+//
+//   bpftrace -e 'usdt:./jitro:jitro:line_read { @[str(arg0)] = count(); }'
+//
+// Each is a nop until something attaches. They come from <sys/sdt.h>
+// (systemtap-sdt-dev); without it they compile away to nothing.
+//
+//   line_read     host, line               a line read off an IRC socket
+//   parse         command, params          an inbound line was parsed
+//   route         source, destination      a binary or endpoint line routed
+//   pipe_write    binary, bytes            written to a binary's stdin
+//   socket_write  host, bytes              written to an IRC socket
+//   reconnect     host, port, tries        connecting to a server (again)
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define JITRO_HAVE_SDT 1
+#endif
+#endif
+
+#ifdef JITRO_HAVE_SDT
+#define PROBE2(name, a, b) STAP_PROBE2(jitro, name, a, b)
+#define PROBE3(name, a, b, c) STAP_PROBE3(jitro, name, a, b, c)
+#else
+// still "use" the arguments, so nothing goes unused because of a probe
+#define PROBE2(name, a, b) do { (void)sizeof(a); (void)sizeof(b); } while(0)
+#define PROBE3(name, a, b, c) \
+	do { (void)sizeof(a); (void)sizeof(b); (void)sizeof(c); } while(0)
+#endif
+
+#endif // PROBES_HPP
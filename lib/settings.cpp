@@ -0,0 +1,295 @@
+#include "settings.hpp"
+using std::string;
+using std::vector;
+using std::map;
+using std::shared_ptr;
+using std::make_shared;
+using std::atomic;
+
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <climits>
+
+#include <unistd.h>
+
+#include "util.hpp"
+using util::split;
+using util::executable;
+using util::startsWith;
+
+// the published snapshot; readers on other threads load it while a reload
+// stores a new one
+static atomic<shared_ptr<const Settings>> published;
+
+// what compile() is working through, and what it has found wrong so far
+struct Compiler {
+	Config &_conf;
+	vector<string> &_errors;
+	bool _fatal{false};
+
+	Compiler(Config &conf, vector<string> &errors)
+		: _conf(conf), _errors(errors) { }
+
+	void error(string what) {
+		_errors.push_back(what);
+		_fatal = true;
+	}
+	void warning(string what) {
+		_errors.push_back("warning: " + what);
+	}
+
+	// the value of key, without leaving a blank behind if there isn't one
+	string get(string key) {
+		return _conf.has(key) ? _conf.get(key) : "";
+	}
+
+	// an integer in [min, max], or fallback if key isn't set
+	long number(string key, long fallback, long min, long max) {
+		string value = get(key);
+		if(value.empty())
+			return fallback;
+		errno = 0;
+		char *end = nullptr;
+		long res = strtol(value.c_str(), &end, 10);
+		if(errno != 0 || *end != '\0' || res < min || res > max) {
+			error(key + " must be a number from " + util::toString(min) + " to "
+					+ util::toString(max) + ", not \"" + value + "\"");
+			return fallback;
+		}
+		return res;
+	}
+
+	// Where the cpus and node keys in scope say to put something. A node
+	// of "spread" takes each of the machine's NUMA nodes in turn.
+	Placement placement(string scope) {
+		Placement placement;
+		string cpus = get(scope + "cpus");
+		if(!cpus.empty() && !Placement::parseCpus(cpus, placement._cpus))
+			error(scope + "cpus must list CPUs like \"0-3,6\", not \"" + cpus
+					+ "\"");
+		long configured = sysconf(_SC_NPROCESSORS_CONF);
+		for(int cpu : placement._cpus)
+			if(cpu >= configured) {
+				warning(scope + "cpus: there is no CPU " + util::toString(cpu));
+				break;
+			}
+
+		int nodes = Placement::nodes();
+		if(get(scope + "node") == "spread") {
+			if(nodes > 0)
+				placement._node = _spread++ % nodes;
+		} else
+			placement._node = (int)number(scope + "node", -1, 0, INT_MAX);
+		if(placement._node >= nodes) {
+			warning(scope + "node: there is no NUMA node "
+					+ util::toString(placement._node));
+			placement._node = -1;
+		}
+		return placement;
+	}
+	int _spread{0};
+
+	// one of choices (the first being the default)
+	string choice(string key, vector<string> choices) {
+		string value = get(key);
+		if(value.empty())
+			return choices[0];
+		for(auto &c : choices)
+			if(value == c)
+				return value;
+		string all;
+		for(auto &c : choices)
+			all += (all.empty() ? "" : ", ") + c;
+		error(key + " must be one of " + all + ", not \"" + value + "\"");
+		return choices[0];
+	}
+};
+
+shared_ptr<const Settings> Settings::compile(Config &conf,
+		vector<string> &errors) {
+	Compiler c(conf, errors);
+	auto settings = make_shared<Settings>();
+
+	vector<string> networks = split(c.get("irc.networks"));
+	if(networks.empty())
+		c.error("irc.networks does not list any networks");
+	for(auto &name : networks) {
+		string scope = "irc." + name + ".";
+		NetworkSettings network;
+		network._name = name;
+
+		network._tls = c.choice(scope + "tls", { "no", "yes" }) == "yes";
+		network._tlsVerify = c.choice(scope + "tls_verify", { "yes", "no" })
+			== "yes";
+		if(c._conf.has(scope + "caps"))
+			network._caps = split(c.get(scope + "caps"));
+		network._sasl = c.choice(scope + "sasl", { "yes", "no" }) == "yes";
+		int port = (int)c.number(scope + "port", network._tls ? 6697 : 6667,
+				1, 65535);
+		// each server may override the port as host:port
+		for(auto &host : split(c.get(scope + "server"))) {
+			ServerSettings server;
+			server._host = host.substr(0, host.find(':'));
+			server._port = port;
+			if(host.find(':') != string::npos) {
+				string sport = host.substr(host.find(':') + 1);
+				char *end = nullptr;
+				long p = strtol(sport.c_str(), &end, 10);
+				if(*end != '\0' || p < 1 || p > 65535)
+					c.error(scope + "server has a bad port in \"" + host + "\"");
+				server._port = (int)p;
+			}
+			if(server._host.empty())
+				c.error(scope + "server has an empty host in \"" + host + "\"");
+			network._servers.push_back(server);
+		}
+		if(network._servers.empty())
+			c.error(name + " has no defined server");
+
+		network._nicks = split(c.get(scope + "nicks"));
+		if(network._nicks.empty())
+			c.error(name + " has no defined nicks");
+		for(auto &nick : network._nicks)
+			if(c._conf.has(scope + nick + ".password"))
+				network._passwords[nick] = c.get(scope + nick + ".password");
+
+		network._channels = split(c.get(scope + "channels"));
+		if(network._channels.empty())
+			c.error(name + " has no defined channels");
+
+		network._probeInterval = (int)c.number(scope + "probe_interval", 60,
+				1, INT_MAX);
+		network._lagThreshold = (int)c.number(scope + "lag_threshold", 0,
+				0, INT_MAX);
+		network._lagWindow = (int)c.number(scope + "lag_window", 120, 0, INT_MAX);
+
+		network._journal = c.get(scope + "journal");
+		network._journalSize = (size_t)c.number(scope + "journal_size",
+				1024 * 1024, 64 * 1024, INT_MAX);
+		network._journalMaxAge = (int)c.number(scope + "journal_max_age", 300,
+				0, INT_MAX);
+
+		network._sendBurst = (size_t)c.number(scope + "send_burst", 5, 0, 1000);
+		network._sendInterval = (int)c.number(scope + "send_interval", 2000,
+				0, INT_MAX);
+		network._sendTotalBurst = (size_t)c.number(scope + "send_total_burst",
+				10, 0, 1000);
+		network._sendTotalInterval = (int)c.number(scope + "send_total_interval",
+				1000, 0, INT_MAX);
+		network._dedupWindow = (int)c.number(scope + "dedup_window", 10,
+				0, INT_MAX);
+		network._sendQueue = (size_t)c.number(scope + "send_queue", 64,
+				1, INT_MAX);
+		network._sendQueueTotal = (size_t)c.number(scope + "send_queue_total",
+				1024, 1, INT_MAX);
+		network._holdTimeout = (int)c.number(scope + "hold_timeout", 120,
+				0, INT_MAX);
+
+		settings->_networks.push_back(network);
+	}
+
+	for(auto &path : split(c.get("core.binary"))) {
+		string scope = "core." + path + ".";
+		if(!executable(path)) {
+			c.warning("configured binary not executable: \"" + path + "\"");
+			continue;
+		}
+		BinarySettings binary;
+		binary._path = path;
+		binary._framed = c.choice(scope + "protocol",
+				{ "lines", "framed" }) == "framed";
+		if(c.choice(scope + "transport", { "pipe", "shm" }) == "shm")
+			binary._ringSize = (size_t)c.number(scope + "ring_size", 1024 * 1024,
+					4096, 1L << 30);
+		binary._restartSlow = c.choice(scope + "slow",
+				{ "drop", "restart" }) == "restart";
+		binary._placement = c.placement(scope);
+		binary._stallInput = (int)c.number(scope + "stall_input", 30,
+				0, INT_MAX);
+		binary._stallOutput = (int)c.number(scope + "stall_output", 0,
+				0, INT_MAX);
+		binary._shedStalled = c.choice(scope + "stall",
+				{ "restart", "shed" }) == "shed";
+		settings->_binaries.push_back(binary);
+	}
+
+	for(auto &name : split(c.get("core.endpoints"))) {
+		string scope = "core." + name + ".";
+		EndpointSettings endpoint;
+		endpoint._name = name;
+		endpoint._listen = c.get(scope + "listen");
+		endpoint._secret = c.get(scope + "secret");
+		endpoint._backlog = (size_t)c.number(scope + "backlog", 4096,
+				0, LONG_MAX);
+		endpoint._stallInput = (int)c.number(scope + "stall_input", 30,
+				0, INT_MAX);
+		if(!startsWith(endpoint._listen, "unix:")
+				&& !startsWith(endpoint._listen, "tcp:"))
+			c.error(scope + "listen must be unix:<path> or tcp:<host>:<port>");
+		else if(startsWith(endpoint._listen, "tcp:") && endpoint._secret.empty())
+			c.error(name + " listens on TCP, but has no secret");
+		settings->_endpoints.push_back(endpoint);
+	}
+
+	if(settings->_binaries.empty() && settings->_endpoints.empty())
+		c.error("no executable binaries found");
+
+	settings->_io = c.choice("core.io", { "auto", "io_uring", "epoll", "poll" });
+	settings->_inbound = (size_t)c.number("core.inbound_buffer", 4096,
+			16, 1L << 24);
+	settings->_router = c.placement("core.router.");
+	settings->_logger = c.placement("core.logger.");
+	settings->_shutdownTimeout = (int)c.number("core.shutdown_timeout", 10,
+			0, INT_MAX);
+	if(!c.get("core.log_dir").empty())
+		settings->_logDir = c.get("core.log_dir");
+	settings->_logSegment = (int)c.number("core.log_segment", 3600, 60,
+			INT_MAX);
+
+	if(c._fatal)
+		return nullptr;
+	return settings;
+}
+
+const NetworkSettings *Settings::network(string name) const {
+	for(auto &network : _networks)
+		if(network._name == name)
+			return &network;
+	return nullptr;
+}
+const BinarySettings *Settings::binary(string path) const {
+	for(auto &binary : _binaries)
+		if(binary._path == path)
+			return &binary;
+	return nullptr;
+}
+const EndpointSettings *Settings::endpoint(string name) const {
+	for(auto &endpoint : _endpoints)
+		if(endpoint._name == name)
+			return &endpoint;
+	return nullptr;
+}
+
+bool ServerSettings::operator==(const ServerSettings &rhs) const {
+	return _host == rhs._host && _port == rhs._port;
+}
+bool NetworkSettings::sameConnection(const NetworkSettings &rhs) const {
+	return _name == rhs._name && _servers == rhs._servers
+		&& _tls == rhs._tls && _tlsVerify == rhs._tlsVerify;
+}
+bool BinarySettings::sameProcess(const BinarySettings &rhs) const {
+	return _path == rhs._path && _framed == rhs._framed
+		&& _ringSize == rhs._ringSize && _placement == rhs._placement;
+}
+bool EndpointSettings::sameProcess(const EndpointSettings &rhs) const {
+	return _name == rhs._name && _listen == rhs._listen
+		&& _secret == rhs._secret && _backlog == rhs._backlog;
+}
+
+shared_ptr<const Settings> currentSettings() {
+	return published.load();
+}
+void publishSettings(shared_ptr<const Settings> settings) {
+	published.store(settings);
+}
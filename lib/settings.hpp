@@ -0,0 +1,140 @@
+#ifndef SETTINGS_HPP
+#define SETTINGS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include "config.hpp"
+#include "placement.hpp"
+
+// Settings is jitro.conf checked and converted once into plain structs.
+// A Settings is never changed after it is compiled; a reload compiles a
+// new one and publishes it in place of the old, so readers (on any thread)
+// just take the current snapshot and keep it as long as they need it.
+struct ServerSettings {
+	std::string _host{};
+	int _port{6667};
+
+	bool operator==(const ServerSettings &rhs) const;
+};
+
+struct NetworkSettings {
+	std::string _name{};
+	std::vector<ServerSettings> _servers{};
+	// connect over TLS, checking the servers' certificates unless told not
+	bool _tls{false};
+	bool _tlsVerify{true};
+	// IRCv3 capabilities to ask for, and whether to identify with SASL
+	// rather than to NickServ
+	std::vector<std::string> _caps{ "message-tags", "server-time", "batch",
+		"multi-prefix", "labeled-response" };
+	bool _sasl{true};
+	// the first nick is the one we use
+	std::vector<std::string> _nicks{};
+	std::map<std::string, std::string> _passwords{};
+	std::vector<std::string> _channels{};
+
+	// lag probing, see IRCSock::lagPolicy
+	int _probeInterval{60};
+	int _lagThreshold{0};
+	int _lagWindow{120};
+
+	// journal of outbound lines (none if blank), its size in bytes, and how
+	// many seconds old a line may be and still be replayed
+	std::string _journal{};
+	size_t _journalSize{1024 * 1024};
+	int _journalMaxAge{300};
+
+	// output shaping, see Shaper: lines a target may get at once, then
+	// one per interval (in ms); the same for the whole connection; seconds
+	// to drop repeated lines for; how many lines may wait per target, and
+	// in all; and seconds a line may wait for us to be in its channel (0
+	// for as long as it takes)
+	size_t _sendBurst{5};
+	int _sendInterval{2000};
+	size_t _sendTotalBurst{10};
+	int _sendTotalInterval{1000};
+	int _dedupWindow{10};
+	size_t _sendQueue{64};
+	size_t _sendQueueTotal{1024};
+	int _holdTimeout{120};
+
+	// whether a connection made with rhs is one we can keep using: only
+	// channels, nicks, lag, journal and shaping settings may change on a
+	// live connection (capabilities only apply from the next one)
+	bool sameConnection(const NetworkSettings &rhs) const;
+};
+
+struct BinarySettings {
+	std::string _path{};
+	bool _framed{false};
+	// shared memory ring size, or 0 to use pipes
+	size_t _ringSize{0};
+	// whether a binary which falls too far behind the networks just misses
+	// lines, or is restarted
+	bool _restartSlow{false};
+	// where it runs (core.<path>.cpus and .node)
+	Placement _placement{};
+	// a binary is stalled once what we've written it goes unread for
+	// _stallInput seconds, or it's been given lines and said nothing back
+	// for _stallOutput (0 for never); stalled binaries are restarted, or
+	// have what's waiting for them shed
+	int _stallInput{30};
+	int _stallOutput{0};
+	bool _shedStalled{false};
+
+	// whether the binary may keep running with rhs (only _restartSlow and
+	// the stall settings may change under it)
+	bool sameProcess(const BinarySettings &rhs) const;
+};
+
+struct EndpointSettings {
+	std::string _name{};
+	std::string _listen{};
+	std::string _secret{};
+	size_t _backlog{4096};
+	// seconds a worker may leave what we've written it unread before its
+	// lines are diverted to the others (0 for never)
+	int _stallInput{30};
+
+	// whether the endpoint may keep running with rhs (_stallInput may change)
+	bool sameProcess(const EndpointSettings &rhs) const;
+};
+
+struct Settings {
+	std::vector<NetworkSettings> _networks{};
+	std::vector<BinarySettings> _binaries{};
+	std::vector<EndpointSettings> _endpoints{};
+	// how the main loop waits (see IOBackend::create), only read at startup
+	std::string _io{"auto"};
+	// lines from the networks kept for binaries and endpoints to read
+	size_t _inbound{4096};
+	// where the main loop and the log writing thread run (core.router.* and
+	// core.logger.*), only read at startup
+	Placement _router{};
+	Placement _logger{};
+	// seconds binaries, workers and networks get to finish what they have
+	// when we shut down
+	int _shutdownTimeout{10};
+	// where what the networks say is kept, and how many seconds each
+	// segment of it covers (see LogStore), only read at startup
+	std::string _logDir{"logs"};
+	int _logSegment{3600};
+
+	// Check conf and build Settings from it. Problems are described in
+	// errors; if any of them are fatal, nothing is returned.
+	static std::shared_ptr<const Settings> compile(Config &conf,
+			std::vector<std::string> &errors);
+
+	// lookups by name, nullptr if there is no such thing
+	const NetworkSettings *network(std::string name) const;
+	const BinarySettings *binary(std::string path) const;
+	const EndpointSettings *endpoint(std::string name) const;
+};
+
+// The snapshot currently in effect, swapped atomically
+std::shared_ptr<const Settings> currentSettings();
+void publishSettings(std::shared_ptr<const Settings> settings);
+
+#endif // SETTINGS_HPP
@@ -0,0 +1,340 @@
+#include "shaper.hpp"
+using std::string;
+using std::vector;
+using std::pair;
+using std::deque;
+
+#include <algorithm>
+using std::max;
+using std::min;
+using std::sort;
+#include <functional>
+using std::hash;
+
+#include "casemap.hpp"
+
+static const size_t minTableSize = 64;
+
+bool RecentSet::insert(uint64_t hash, TimerWheel::TimePoint now) {
+	if(hash == 0)
+		hash = 1;
+	// keep the table at most half full
+	if((_size + 1) * 2 > _table.size())
+		_grow();
+	size_t slot = _slot(hash);
+	if(_table[slot] == hash)
+		return false;
+	_table[slot] = hash;
+	_size++;
+	_order.push_back({ now, hash });
+	return true;
+}
+
+void RecentSet::expire(TimerWheel::TimePoint cutoff) {
+	while(!_order.empty() && _order.front().first < cutoff) {
+		_erase(_order.front().second);
+		_order.pop_front();
+	}
+}
+
+void RecentSet::clear() {
+	_table.clear();
+	_order.clear();
+	_size = 0;
+}
+
+size_t RecentSet::size() const {
+	return _size;
+}
+
+size_t RecentSet::_slot(uint64_t hash) const {
+	// linear probing, stopping at hash or the empty slot it would go in
+	size_t mask = _table.size() - 1, slot = hash & mask;
+	while(_table[slot] != 0 && _table[slot] != hash)
+		slot = (slot + 1) & mask;
+	return slot;
+}
+
+void RecentSet::_erase(uint64_t hash) {
+	if(_table.empty())
+		return;
+	size_t mask = _table.size() - 1, slot = _slot(hash);
+	if(_table[slot] != hash)
+		return;
+	_table[slot] = 0;
+	_size--;
+	// shift later entries of the run back so no lookup stops short
+	for(size_t next = (slot + 1) & mask; _table[next] != 0;
+			next = (next + 1) & mask) {
+		size_t home = _table[next] & mask;
+		// move it if its home isn't cyclically within (slot, next]
+		bool between = slot <= next ? (home > slot && home <= next)
+			: (home > slot || home <= next);
+		if(between)
+			continue;
+		_table[slot] = _table[next];
+		_table[next] = 0;
+		slot = next;
+	}
+}
+
+void RecentSet::_grow() {
+	vector<uint64_t> old;
+	old.swap(_table);
+	_table.assign(old.empty() ? minTableSize : old.size() * 2, 0);
+	for(auto hash : old)
+		if(hash != 0)
+			_table[_slot(hash)] = hash;
+}
+
+
+void Shaper::configure(const Limits &limits) {
+	_limits = limits;
+	if(_limits._dedupWindow.count() <= 0)
+		_recent.clear();
+}
+
+Shaper::Result Shaper::push(string line, TimerWheel::TimePoint now) {
+	IRCMessage msg = IRCMessage::parse(line);
+	if((msg._command != "PRIVMSG" && msg._command != "NOTICE")
+			|| msg._params.size() != 2) {
+		_through.push_back({ line, now, _seq++ });
+		_count++;
+		return _trim() ? Result::Overflow : Result::Queued;
+	}
+	string key = foldCase(msg._params[0], CaseMapping::RFC1459);
+
+	if(_limits._dedupWindow.count() > 0) {
+		_recent.expire(now - _limits._dedupWindow);
+		uint64_t h = hash<string>()(msg._command + " " + key + " "
+				+ msg._params[1]);
+		if(!_recent.insert(h, now))
+			return Result::Duplicate;
+	}
+
+	Target &target = _targets[key];
+	if(target._name.empty())
+		target._name = msg._params[0];
+	Result res = Result::Queued;
+	vector<string> pieces = split(msg, _limits._maxLength);
+	if(pieces.size() == 1)
+		pieces[0] = line;
+	for(auto &piece : pieces)
+		target._lines.push_back({ piece, now, _seq++ });
+	_count += pieces.size();
+	while(target._lines.size() > _limits._maxQueued) {
+		target._lines.pop_front();
+		_count--;
+		res = Result::Overflow;
+	}
+	if(_trim())
+		res = Result::Overflow;
+	return res;
+}
+
+vector<string> Shaper::pop(TimerWheel::TimePoint now, Ready ready) {
+	vector<string> out;
+	// held lines use none of the burst, but only wait so long
+	for(auto &it : _targets) {
+		Target &target = it.second;
+		if(target._lines.empty() || ready(target._name))
+			continue;
+		while(!target._lines.empty() && _limits._holdTimeout.count() > 0
+				&& target._lines.front()._queued + _limits._holdTimeout <= now) {
+			target._lines.pop_front();
+			_count--;
+			_waits._expired++;
+		}
+	}
+
+	// what's queued goes out a stretch at a time, each ending at the next
+	// line which isn't shaped per target
+	while(_totalRelease() <= now) {
+		uint64_t barrier = _through.empty() ? UINT64_MAX
+			: _through.front()._seq;
+		bool waiting = false;
+		for(auto &it : _targets) {
+			Target &target = it.second;
+			if(target._lines.empty() || !ready(target._name))
+				continue;
+			while(!target._lines.empty() && target._lines.front()._seq < barrier
+					&& _release(target) <= now && _totalRelease() <= now) {
+				_send(target._lines.front(), now, out);
+				target._lines.pop_front();
+				_count--;
+				target._due = max(target._due, now) + _limits._interval;
+			}
+			if(!target._lines.empty() && target._lines.front()._seq < barrier)
+				waiting = true;
+		}
+		if(waiting || _through.empty() || _totalRelease() > now)
+			break;
+		_send(_through.front(), now, out);
+		_through.pop_front();
+		_count--;
+	}
+
+	// a target that's caught up is the same as one never seen
+	for(auto it = _targets.begin(); it != _targets.end(); ) {
+		if(it->second._lines.empty() && it->second._due <= now)
+			it = _targets.erase(it);
+		else
+			++it;
+	}
+	return out;
+}
+
+TimerWheel::TimePoint Shaper::nextRelease(Ready ready) const {
+	TimerWheel::TimePoint next = TimerWheel::TimePoint::max();
+	uint64_t barrier = _through.empty() ? UINT64_MAX : _through.front()._seq;
+	bool waiting = false;
+	for(auto &target : _targets) {
+		if(target.second._lines.empty())
+			continue;
+		// a held target is let out when it's ready, not on a timer
+		if(!ready(target.second._name)) {
+			if(_limits._holdTimeout.count() > 0)
+				next = min(next, target.second._lines.front()._queued
+						+ _limits._holdTimeout);
+			continue;
+		}
+		// lines after the next unshaped one wait for it to go first
+		if(target.second._lines.front()._seq > barrier)
+			continue;
+		waiting = true;
+		next = min(next, max(_release(target.second), _totalRelease()));
+	}
+	if(!_through.empty() && !waiting)
+		next = min(next, _totalRelease());
+	return next;
+}
+
+bool Shaper::take(TimerWheel::TimePoint now) {
+	if(_totalRelease() > now)
+		return false;
+	_due = max(_due, now) + _limits._totalInterval;
+	return true;
+}
+TimerWheel::TimePoint Shaper::nextTake() const {
+	return _totalRelease();
+}
+void Shaper::restart() {
+	_due = TimerWheel::TimePoint();
+}
+
+const Shaper::Waits &Shaper::waits() const {
+	return _waits;
+}
+
+vector<string> Shaper::queued() const {
+	vector<Line> lines(_through.begin(), _through.end());
+	for(auto &target : _targets)
+		lines.insert(lines.end(), target.second._lines.begin(),
+				target.second._lines.end());
+	sort(lines.begin(), lines.end(),
+			[](const Line &a, const Line &b) { return a._seq < b._seq; });
+	vector<string> out;
+	for(auto &line : lines)
+		out.push_back(line._line);
+	return out;
+}
+bool Shaper::empty() const {
+	if(!_through.empty())
+		return false;
+	for(auto &target : _targets)
+		if(!target.second._lines.empty())
+			return false;
+	return true;
+}
+
+TimerWheel::TimePoint Shaper::_release(const Target &target) const {
+	if(_limits._burst == 0)
+		return TimerWheel::TimePoint::min();
+	return target._due - _limits._interval * (long)(_limits._burst - 1);
+}
+TimerWheel::TimePoint Shaper::_totalRelease() const {
+	if(_limits._totalBurst == 0)
+		return TimerWheel::TimePoint::min();
+	return _due - _limits._totalInterval * (long)(_limits._totalBurst - 1);
+}
+
+bool Shaper::_trim() {
+	bool dropped = false;
+	while(_count > _limits._maxTotal) {
+		deque<Line> *oldest = _through.empty() ? nullptr : &_through;
+		for(auto &it : _targets) {
+			deque<Line> &lines = it.second._lines;
+			if(!lines.empty() && (!oldest
+						|| lines.front()._seq < oldest->front()._seq))
+				oldest = &lines;
+		}
+		if(!oldest)
+			break;
+		oldest->pop_front();
+		_count--;
+		dropped = true;
+	}
+	return dropped;
+}
+
+void Shaper::_send(const Line &line, TimerWheel::TimePoint now,
+		vector<string> &out) {
+	TimerWheel::Duration waited = now - line._queued;
+	_waits._count++;
+	_waits._total += waited;
+	if(waited > _waits._max)
+		_waits._max = waited;
+	out.push_back(line._line);
+	take(now);
+}
+
+vector<string> Shaper::split(const IRCMessage &msg, size_t maxLength) {
+	string text = msg._params.back();
+	IRCMessage piece = msg;
+	piece._params.back() = "";
+	// what the line costs besides the text, counting the " :" str() adds
+	size_t overhead = piece.str().length();
+
+	// CTCPs are split into several, each with the same command
+	string head, tail;
+	if(text.length() >= 2 && text[0] == '\x01') {
+		size_t end = text.back() == '\x01' ? text.length() - 1 : text.length();
+		size_t space = text.find(' ');
+		if(space != string::npos && space < end) {
+			head = text.substr(0, space + 1);
+			tail = text.substr(end);
+			text = text.substr(space + 1, end - space - 1);
+		}
+	}
+	overhead += head.length() + tail.length();
+
+	vector<string> out;
+	// too little room to split sensibly; let the server truncate it
+	if(overhead + 32 > maxLength || overhead + text.length() <= maxLength) {
+		out.push_back(msg.str());
+		return out;
+	}
+
+	size_t room = maxLength - overhead;
+	while(!text.empty()) {
+		size_t cut = text.length();
+		if(cut > room) {
+			cut = room;
+			// don't split a UTF-8 sequence: back up off continuation bytes
+			while(cut > 0 && ((unsigned char)text[cut] & 0xC0) == 0x80)
+				cut--;
+			if(cut == 0)
+				cut = room;
+			// break at a space if there's one in the latter half
+			size_t space = text.rfind(' ', cut);
+			if(space != string::npos && space >= cut / 2)
+				cut = space;
+		}
+		piece._params.back() = head + text.substr(0, cut) + tail;
+		out.push_back(piece.str());
+		if(cut < text.length() && text[cut] == ' ')
+			cut++;
+		text.erase(0, cut);
+	}
+	return out;
+}
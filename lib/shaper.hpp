@@ -0,0 +1,150 @@
+#ifndef SHAPER_HPP
+#define SHAPER_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <utility>
+#include <functional>
+#include <cstdint>
+#include "ircmessage.hpp"
+#include "timerwheel.hpp"
+
+// RecentSet remembers 64 bit hashes for a window of time, in an open
+// addressed table sized to what is live rather than a node per entry.
+struct RecentSet {
+	// Add hash seen at now, returning false if it was already there
+	bool insert(uint64_t hash, TimerWheel::TimePoint now);
+	// forget everything seen before cutoff
+	void expire(TimerWheel::TimePoint cutoff);
+	void clear();
+	size_t size() const;
+
+	protected:
+		size_t _slot(uint64_t hash) const;
+		void _erase(uint64_t hash);
+		void _grow();
+
+	protected:
+		// 0 marks an empty slot, so no hash is ever stored as 0
+		std::vector<uint64_t> _table{};
+		size_t _size{0};
+		// hashes in the order they were seen, for expiring them
+		std::deque<std::pair<TimerWheel::TimePoint, uint64_t>> _order{};
+};
+
+// Shaper sits between the binaries and a network's connection, keeping a
+// runaway binary from flooding the server. PRIVMSGs and NOTICEs are
+//  - dropped if the same line went to the same target within a window
+//  - split to fit in an IRC line, on UTF-8 character boundaries
+//  - queued per target and let out at a steady rate after a burst
+//  - held while their target isn't ready for them (a channel we're
+//    still joining), and dropped if that takes too long
+// Everything else is queued as is. All lines count against a rate for the
+// whole connection, and lines other than PRIVMSGs and NOTICEs keep their
+// place: they go out after the lines queued before them (bar those being
+// held) and before the lines queued after them.
+struct Shaper {
+	struct Limits {
+		// lines a target may get at once, and after that one per interval;
+		// a burst of 0 turns rate limiting off
+		size_t _burst{5};
+		TimerWheel::Duration _interval{std::chrono::seconds(2)};
+		// the same for all lines together, whatever their target
+		size_t _totalBurst{10};
+		TimerWheel::Duration _totalInterval{std::chrono::seconds(1)};
+		// how long a line is remembered to drop repeats; 0 doesn't
+		TimerWheel::Duration _dedupWindow{std::chrono::seconds(10)};
+		// lines waiting for one target, past which the oldest are dropped
+		size_t _maxQueued{64};
+		// the same for all lines waiting, whatever their target
+		size_t _maxTotal{1024};
+		// longest line we send (without "\r\n"), leaving room for the
+		// prefix the server adds when relaying it
+		size_t _maxLength{400};
+		// how long a line may be held for a target that isn't ready; 0
+		// holds it for as long as it takes
+		TimerWheel::Duration _holdTimeout{std::chrono::seconds(120)};
+	};
+	enum class Result { Queued, Duplicate, Overflow, INVALID };
+	// whether lines for a target (as first given) may go out now
+	typedef std::function<bool(const std::string &target)> Ready;
+	// how long the lines let out so far had to wait, and how many were
+	// dropped for waiting too long
+	struct Waits {
+		uint64_t _count{0};
+		TimerWheel::Duration _total{};
+		TimerWheel::Duration _max{};
+		uint64_t _expired{0};
+	};
+
+	void configure(const Limits &limits);
+
+	// Take a line to send. Overflow means it was queued, but only by
+	// dropping the oldest line waiting for the same target, or the oldest
+	// waiting at all.
+	Result push(std::string line, TimerWheel::TimePoint now);
+	// lines which may be sent now, in order, leaving those for targets
+	// which aren't ready
+	std::vector<std::string> pop(TimerWheel::TimePoint now, Ready ready);
+	// when pop will next have something (or drop something held), or
+	// TimePoint::max() if never
+	TimerWheel::TimePoint nextRelease(Ready ready) const;
+	// Count a line sent some other way (replayed from a journal) against
+	// the connection's rate, returning false if it has to wait until
+	// nextTake()
+	bool take(TimerWheel::TimePoint now);
+	TimerWheel::TimePoint nextTake() const;
+	// give the connection's rate a full burst again, for a new connection
+	void restart();
+	const Waits &waits() const;
+	// everything waiting in the order it came, to pass on to a new jitro
+	std::vector<std::string> queued() const;
+	bool empty() const;
+
+	// Split a PRIVMSG or NOTICE into lines of at most maxLength bytes,
+	// preferring spaces, never inside a UTF-8 character, and keeping a
+	// CTCP (such as an ACTION) whole around each piece
+	static std::vector<std::string> split(const IRCMessage &msg,
+			size_t maxLength);
+
+	protected:
+		struct Line {
+			std::string _line;
+			TimerWheel::TimePoint _queued;
+			uint64_t _seq;
+		};
+		struct Target {
+			std::string _name{};
+			std::deque<Line> _lines{};
+			// when the target's next line is due were it sent at the
+			// steady rate; the burst lets it go that much earlier
+			TimerWheel::TimePoint _due{};
+		};
+
+		TimerWheel::TimePoint _release(const Target &target) const;
+		TimerWheel::TimePoint _totalRelease() const;
+		// drop the oldest lines, whatever they wait for, until at most
+		// _maxTotal are left; returns whether any were
+		bool _trim();
+		// let line out now, taking it from the connection's rate
+		void _send(const Line &line, TimerWheel::TimePoint now,
+				std::vector<std::string> &out);
+
+	protected:
+		Limits _limits{};
+		std::map<std::string, Target> _targets{};
+		// lines not shaped per target, in the order they came
+		std::deque<Line> _through{};
+		// numbers lines in the order they came, across targets
+		uint64_t _seq{0};
+		// lines waiting, in _through and for all targets
+		size_t _count{0};
+		// when the connection's next line is due at the steady rate
+		TimerWheel::TimePoint _due{};
+		RecentSet _recent{};
+		Waits _waits{};
+};
+
+#endif // SHAPER_HPP
@@ -0,0 +1,263 @@
+#include "shmring.hpp"
+using std::string;
+using std::to_string;
+
+#include <algorithm>
+using std::min;
+#include <new>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <cstdio>
+#include <cstring>
+
+#include "iobackend.hpp"
+
+// each ring's header gets a region of its own ahead of its data
+static const size_t headerSize = 128;
+static const size_t minRingSize = 4096;
+
+static const char *memEnv = "JITRO_SHM_FD";
+static const char *sizeEnv = "JITRO_SHM_RING_SIZE";
+static const char *parentEnv = "JITRO_SHM_PARENT_FD";
+static const char *childEnv = "JITRO_SHM_CHILD_FD";
+
+ShmRing::ShmRing(Header *header, char *data, uint64_t capacity, int kickFd)
+		: _header(header), _data(data), _capacity(capacity), _kickFd(kickFd) { }
+
+size_t ShmRing::write(const char *data, size_t len) {
+	if(_corrupt)
+		return 0;
+	uint64_t head = _header->_head.load(std::memory_order_relaxed),
+		tail = _header->_tail.load(std::memory_order_acquire),
+		cap = _capacity;
+	size_t used = _buffered(head, tail);
+	if(_corrupt)
+		return 0;
+	size_t n = min((size_t)(cap - used), len);
+	if(n == 0)
+		return 0;
+
+	// copy in, wrapping around the end of the buffer if need be
+	size_t at = head & (cap - 1), first = min(n, (size_t)(cap - at));
+	memcpy(_data + at, data, first);
+	memcpy(_data, data + first, n - first);
+
+	_header->_head.store(head + n);
+	if(_header->_readerWaiting.exchange(0))
+		_kick();
+	return n;
+}
+string ShmRing::read() {
+	if(_corrupt)
+		return "";
+	uint64_t tail = _header->_tail.load(std::memory_order_relaxed),
+		head = _header->_head.load(std::memory_order_acquire),
+		cap = _capacity;
+	size_t n = _buffered(head, tail);
+	if(n == 0)
+		return "";
+
+	string out;
+	out.resize(n);
+	size_t at = tail & (cap - 1), first = min(n, (size_t)(cap - at));
+	memcpy(&out[0], _data + at, first);
+	memcpy(&out[first], _data, n - first);
+
+	_header->_tail.store(tail + n);
+	if(_header->_writerWaiting.exchange(0))
+		_kick();
+	return out;
+}
+
+bool ShmRing::armRead() {
+	_header->_readerWaiting.store(1);
+	// the writer may have got in before seeing the flag
+	if(readable()) {
+		_header->_readerWaiting.store(0);
+		return false;
+	}
+	return true;
+}
+bool ShmRing::armWrite() {
+	_header->_writerWaiting.store(1);
+	if(writable()) {
+		_header->_writerWaiting.store(0);
+		return false;
+	}
+	return true;
+}
+
+size_t ShmRing::readable() const {
+	return _header->_head.load() - _header->_tail.load();
+}
+size_t ShmRing::writable() const {
+	size_t used = readable();
+	return used > _capacity ? 0 : _capacity - used;
+}
+bool ShmRing::corrupt() const {
+	return _corrupt;
+}
+
+size_t ShmRing::_buffered(uint64_t head, uint64_t tail) {
+	if(head - tail <= _capacity)
+		return head - tail;
+	_corrupt = true;
+	return 0;
+}
+
+void ShmRing::_kick() {
+	eventfd_write(_kickFd, 1);
+}
+
+
+ShmTransport::~ShmTransport() {
+	close();
+}
+
+int ShmTransport::create(size_t ringSize) {
+	close();
+	_ringSize = minRingSize;
+	while(_ringSize < ringSize)
+		_ringSize <<= 1;
+	_size = 2 * (headerSize + _ringSize);
+
+	_memfd = memfd_create("jitro-shm", MFD_CLOEXEC);
+	if(_memfd < 0) {
+		perror("ShmTransport::create: memfd_create");
+		return -1;
+	}
+	if(ftruncate(_memfd, _size) != 0) {
+		perror("ShmTransport::create: ftruncate");
+		close();
+		return -1;
+	}
+	_parentFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	_childFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(_parentFd < 0 || _childFd < 0) {
+		perror("ShmTransport::create: eventfd");
+		close();
+		return -1;
+	}
+	return _setup(true, true);
+}
+
+void ShmTransport::exportEnvironment() const {
+	// the child needs these to survive exec
+	for(int fd : { _memfd, _parentFd, _childFd })
+		fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) & ~FD_CLOEXEC);
+	setenv(memEnv, to_string(_memfd).c_str(), 1);
+	setenv(sizeEnv, to_string(_ringSize).c_str(), 1);
+	setenv(parentEnv, to_string(_parentFd).c_str(), 1);
+	setenv(childEnv, to_string(_childFd).c_str(), 1);
+}
+
+int ShmTransport::attach() {
+	close();
+	const char *mem = getenv(memEnv), *size = getenv(sizeEnv),
+		*parent = getenv(parentEnv), *child = getenv(childEnv);
+	if(!mem || !size || !parent || !child)
+		return -1;
+	_memfd = atoi(mem);
+	_ringSize = strtoul(size, nullptr, 10);
+	_parentFd = atoi(parent);
+	_childFd = atoi(child);
+	_size = 2 * (headerSize + _ringSize);
+	return _setup(false, false);
+}
+
+void ShmTransport::handoff(Handoff &state, string prefix) const {
+	if(!valid())
+		return;
+	state.fd(prefix + "memfd", _memfd);
+	state.fd(prefix + "parentfd", _parentFd);
+	state.fd(prefix + "childfd", _childFd);
+	state.set(prefix + "ringsize", to_string(_ringSize));
+}
+int ShmTransport::resume(const Handoff &state, string prefix) {
+	close();
+	if(state.fd(prefix + "memfd") < 0)
+		return -1;
+	_memfd = state.fd(prefix + "memfd");
+	_parentFd = state.fd(prefix + "parentfd");
+	_childFd = state.fd(prefix + "childfd");
+	_ringSize = strtoul(state.get(prefix + "ringsize").c_str(), nullptr, 10);
+	_size = 2 * (headerSize + _ringSize);
+	// the rings are live, with the child still using them
+	return _setup(true, false);
+}
+
+void ShmTransport::close() {
+	if(_mem)
+		munmap(_mem, _size);
+	_mem = nullptr;
+	for(int *fd : { &_memfd, &_parentFd, &_childFd }) {
+		if(*fd >= 0) {
+			IOBackend::closing(*fd);
+			::close(*fd);
+		}
+		*fd = -1;
+	}
+	_rings[0] = _rings[1] = ShmRing();
+}
+
+int ShmTransport::_setup(bool parent, bool init) {
+	_parent = parent;
+	_mem = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _memfd, 0);
+	if(_mem == MAP_FAILED) {
+		perror("ShmTransport: mmap");
+		_mem = nullptr;
+		close();
+		return -1;
+	}
+
+	// ring 0 carries parent to child, ring 1 child to parent
+	char *base = (char *)_mem;
+	ShmRing::Header *headers[2];
+	for(int i = 0; i < 2; ++i) {
+		char *at = base + i * (headerSize + _ringSize);
+		headers[i] = (ShmRing::Header *)at;
+		if(init) {
+			headers[i] = new (at) ShmRing::Header();
+			headers[i]->_head.store(0);
+			headers[i]->_tail.store(0);
+			headers[i]->_readerWaiting.store(0);
+			headers[i]->_writerWaiting.store(0);
+		}
+	}
+
+	// both of our rings kick the other side's eventfd
+	int kick = parent ? _childFd : _parentFd;
+	int txi = parent ? 0 : 1, rxi = 1 - txi;
+	_rings[0] = ShmRing(headers[txi],
+			base + txi * (headerSize + _ringSize) + headerSize, _ringSize, kick);
+	_rings[1] = ShmRing(headers[rxi],
+			base + rxi * (headerSize + _ringSize) + headerSize, _ringSize, kick);
+	return 0;
+}
+
+bool ShmTransport::valid() const {
+	return _mem != nullptr;
+}
+bool ShmTransport::corrupt() const {
+	return _rings[0].corrupt() || _rings[1].corrupt();
+}
+ShmRing &ShmTransport::tx() {
+	return _rings[0];
+}
+ShmRing &ShmTransport::rx() {
+	return _rings[1];
+}
+int ShmTransport::waitFd() const {
+	return _parent ? _parentFd : _childFd;
+}
+void ShmTransport::drain() {
+	eventfd_t value;
+	eventfd_read(waitFd(), &value);
+}
+void ShmTransport::wake() {
+	eventfd_write(waitFd(), 1);
+}
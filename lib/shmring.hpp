@@ -0,0 +1,107 @@
+#ifndef SHMRING_HPP
+#define SHMRING_HPP
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <sys/types.h>
+#include "handoff.hpp"
+
+// ShmRing is one direction of a single producer, single consumer byte ring
+// in shared memory. It carries the same byte stream a pipe would, but
+// without a syscall per write: the peer's eventfd is only kicked when the
+// other side has said it is idle (reader with nothing to read, or writer
+// with no room to write).
+//
+// The header is shared with the peer, which may scribble over it; a ring
+// whose head and tail are further apart than it is big is corrupt, and
+// nothing more is read from or written to it.
+struct ShmRing {
+	struct Header {
+		// total bytes ever written and read; the difference is what's buffered
+		std::atomic<uint64_t> _head{0};
+		std::atomic<uint64_t> _tail{0};
+		std::atomic<uint32_t> _readerWaiting{0};
+		std::atomic<uint32_t> _writerWaiting{0};
+	};
+
+	ShmRing() = default;
+	ShmRing(Header *header, char *data, uint64_t capacity, int kickFd);
+
+	// Producer: copy in as much of data as fits, returning how much did
+	size_t write(const char *data, size_t len);
+	// Consumer: take everything that is buffered
+	std::string read();
+
+	// Going idle; these return false (and don't wait) if there is already
+	// something to do, otherwise the peer will kick us when there is
+	bool armRead();
+	bool armWrite();
+
+	size_t readable() const;
+	size_t writable() const;
+	bool corrupt() const;
+
+	protected:
+		// how much is buffered between tail and head, or flag the ring
+		// corrupt if that can't be
+		size_t _buffered(uint64_t head, uint64_t tail);
+		void _kick();
+
+	protected:
+		Header *_header{nullptr};
+		char *_data{nullptr};
+		// ours, not the header's, so the peer can't make us overrun _data
+		uint64_t _capacity{0};
+		int _kickFd{-1};
+		bool _corrupt{false};
+};
+
+// ShmTransport is the pair of rings shared between jitro and one child, in
+// a single memfd, plus an eventfd for each side to sleep on.
+struct ShmTransport {
+	ShmTransport() = default;
+	~ShmTransport();
+
+	ShmTransport(const ShmTransport &rhs) = delete;
+	ShmTransport &operator=(const ShmTransport &rhs) = delete;
+
+	// Parent: create the memory and eventfds, ringSize rounded up to a power
+	// of two. Call exportEnvironment() in the child between fork and exec.
+	int create(size_t ringSize);
+	void exportEnvironment() const;
+	// Child: attach to the transport described by our environment
+	int attach();
+	void close();
+	// Parent: pass the transport on to a new jitro, and pick it up there
+	void handoff(Handoff &state, std::string prefix) const;
+	int resume(const Handoff &state, std::string prefix);
+
+	bool valid() const;
+	// whether the peer has left either ring in a state we can't trust
+	bool corrupt() const;
+	// the ring we write to and the ring we read from
+	ShmRing &tx();
+	ShmRing &rx();
+	// the descriptor to poll for POLLIN while waiting on the peer
+	int waitFd() const;
+	// clear pending wakeups after waitFd() was readable
+	void drain();
+	// make waitFd() readable ourselves, to not sleep with work pending
+	void wake();
+
+	protected:
+		int _setup(bool parent, bool init);
+
+	protected:
+		bool _parent{true};
+		void *_mem{nullptr};
+		size_t _size{0};
+		size_t _ringSize{0};
+		int _memfd{-1};
+		int _parentFd{-1};
+		int _childFd{-1};
+		ShmRing _rings[2]{};
+};
+
+#endif // SHMRING_HPP
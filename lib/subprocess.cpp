@@ -1,5 +1,6 @@
 #include "subprocess.hpp"
 using std::string;
+using std::to_string;
 using std::vector;
 
 #include <sys/wait.h>
@@ -8,8 +9,11 @@ using std::vector;
 #include <fcntl.h>
 #include <string.h>
 
+#include "iobackend.hpp"
+#include "probes.hpp"
 #include "util.hpp"
 using util::executable;
+using util::fromString;
 
 #include <iostream>
 using std::cerr;
@@ -29,7 +33,7 @@ Pipe::~Pipe() { close(); }
 int Pipe::operator()() { return _fd; }
 int Pipe::steal() {
 	int fd = _fd;
-	_fd = 0;
+	_fd = -1;
 	return fd;
 }
 void Pipe::close() {
@@ -56,6 +60,13 @@ Subprocess::~Subprocess() {
 		kill();
 }
 
+void Subprocess::sharedMemory(size_t ringSize) {
+	_ringSize = ringSize;
+}
+void Subprocess::placement(const Placement &placement) {
+	_placement = placement;
+}
+
 int Subprocess::run() {
 	// if we're not in the before exec phase, abort
 	if(_status != SubprocessStatus::BeforeExec) {
@@ -79,6 +90,10 @@ int Subprocess::run() {
 	if(int fail = Pipe::make(right))
 		return fail;
 
+	// shared memory is an optimization, so fall back to pipes without it
+	if(_ringSize && _shm.create(_ringSize) != 0)
+		cerr << "Subprocess::run: no shared memory, using pipes" << endl;
+
 	// if we can't fork, abort
 	_pid = ::fork();
 	if(_pid == -1) {
@@ -96,6 +111,10 @@ int Subprocess::run() {
 		left[1].close();
 		right[0].close();
 
+		if(_shm.valid())
+			_shm.exportEnvironment();
+		_placement.applyProcess();
+
 		char *bstr = (char *)_binary.c_str();
 		char **argv = new char*[_args.size() + 2];
 		argv[0] = ::strdup(_binary.c_str());
@@ -114,6 +133,8 @@ int Subprocess::run() {
 	_pipe[0] = right[0].steal();
 	_pipe[1] = left[1].steal();
 	_br.setup(_pipe[0], "\n");
+	// a binary which stops reading must not stop us with it
+	fcntl(_pipe[1], F_SETFL, fcntl(_pipe[1], F_GETFL) | O_NONBLOCK);
 
 	_status = SubprocessStatus::Exec;
 	return 0;
@@ -148,10 +169,18 @@ int Subprocess::kill() {
 	if(_status != SubprocessStatus::Exec)
 		return -1;
 	int ret = ::kill(_pid, SIGKILL);
+	// it can't ignore that, so this doesn't wait long
+	if(ret == 0)
+		waitpid(_pid, &_value, 0);
 	_status = SubprocessStatus::BeforeExec;
 	close();
 	return ret;
 }
+int Subprocess::terminate() {
+	if(status() != SubprocessStatus::Exec)
+		return -1;
+	return ::kill(_pid, SIGTERM);
+}
 
 	//return fdopen(subproc->pipe[1], "w");
 ssize_t Subprocess::write(string str) {
@@ -163,6 +192,18 @@ ssize_t Subprocess::write(string str) {
 
 	if(status() != SubprocessStatus::Exec)
 		return 0;
+	// after closeInput, there's nobody listening
+	if(!_shm.valid() && _pipe[1] < 0) {
+		_wbuf.clear();
+		return 0;
+	}
+
+	if(_shm.valid()) {
+		size_t wamount = _shm.tx().write(_wbuf.data(), _wbuf.length());
+		_wbuf.erase(0, wamount);
+		_written += wamount;
+		return wamount;
+	}
 
 	ssize_t wamount = ::write(_pipe[1], _wbuf.c_str(), _wbuf.length());
 	if((wamount < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
@@ -173,37 +214,113 @@ ssize_t Subprocess::write(string str) {
 		return wamount;
 	} else if(wamount > 0) {
 		_wbuf = _wbuf.substr(wamount);
+		_written += wamount;
+		PROBE2(pipe_write, _binary.c_str(), wamount);
 	}
 
 	return wamount;
 }
 string Subprocess::read() {
+	_pull();
 	return _br.read();
 }
+ssize_t Subprocess::writeRaw(string data) {
+	_wbuf += data;
+	return write();
+}
+string Subprocess::readRaw() {
+	_pull();
+	return _br.take();
+}
+void Subprocess::closeInput() {
+	_wbuf.clear();
+	if(_pipe[1] < 0)
+		return;
+	IOBackend::closing(_pipe[1]);
+	::close(_pipe[1]);
+	_pipe[1] = -1;
+}
+
+void Subprocess::_pull() {
+	if(!_shm.valid())
+		return;
+	_shm.drain();
+	string data = _shm.rx().read();
+	if(!data.empty())
+		_br.suffix(data);
+}
 
 BufReader &Subprocess::br() {
 	return _br;
 }
 
-void Subprocess::flush() {
-	if(status() != SubprocessStatus::Exec)
-		return;
-
-	while(!_wbuf.empty())
-		write();
-	::syncfs(_pipe[1]);
+int Subprocess::fd() const {
+	return _pipe[0];
+}
+int Subprocess::writeFd() const {
+	return _shm.valid() ? -1 : _pipe[1];
+}
+bool Subprocess::wantsWrite() const {
+	return !_wbuf.empty();
+}
+uint64_t Subprocess::written() const {
+	return _written;
+}
+int Subprocess::waitFd() {
+	if(!_shm.valid())
+		return -1;
+	// sleep only if the subprocess has nothing for us and, if we're waiting
+	// to write, still hasn't made room
+	bool idle = _shm.rx().armRead();
+	if(!_wbuf.empty())
+		idle = _shm.tx().armWrite() && idle;
+	if(!idle)
+		_shm.wake();
+	return _shm.waitFd();
+}
+bool Subprocess::corrupt() const {
+	return _shm.valid() && _shm.corrupt();
 }
 
 string Subprocess::binary() const {
 	return _binary;
 }
 
+void Subprocess::handoff(Handoff &state, string prefix) const {
+	if(_status != SubprocessStatus::Exec)
+		return;
+	state.set(prefix + "pid", to_string(_pid));
+	state.fd(prefix + "stdout", _pipe[0]);
+	state.fd(prefix + "stdin", _pipe[1]);
+	state.set(prefix + "wbuf", _wbuf);
+	state.set(prefix + "rbuf", _br.buffered());
+	_shm.handoff(state, prefix + "shm.");
+}
+int Subprocess::resume(const Handoff &state, string prefix) {
+	if(_status != SubprocessStatus::BeforeExec || !state.has(prefix + "pid"))
+		return -1;
+	_pid = fromString<pid_t>(state.get(prefix + "pid"));
+	_pipe[0] = state.fd(prefix + "stdout");
+	_pipe[1] = state.fd(prefix + "stdin");
+	_wbuf = state.get(prefix + "wbuf");
+	_br.setup(_pipe[0], "\n");
+	// (older jitros left it blocking)
+	fcntl(_pipe[1], F_SETFL, fcntl(_pipe[1], F_GETFL) | O_NONBLOCK);
+	_br.suffix(state.get(prefix + "rbuf"));
+	_shm.resume(state, prefix + "shm.");
+
+	_status = SubprocessStatus::Exec;
+	return 0;
+}
+
 void Subprocess::close() {
-	if(_pipe[0] >= 0)
-		::close(_pipe[0]);
-	_pipe[0] = -1;
-	if(_pipe[1] >= 0)
-		::close(_pipe[1]);
-	_pipe[1] = -1;
+	_shm.close();
+	for(int &fd : _pipe) {
+		if(fd >= 0) {
+			IOBackend::closing(fd);
+			::close(fd);
+		}
+		fd = -1;
+	}
 }
 
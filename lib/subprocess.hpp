@@ -3,8 +3,12 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 #include <sys/types.h>
 #include "bufreader.hpp"
+#include "shmring.hpp"
+#include "handoff.hpp"
+#include "placement.hpp"
 
 enum class SubprocessStatus { BeforeExec, Exec, AfterExec, INVALID };
 std::string toString(SubprocessStatus sstatus);
@@ -30,41 +34,85 @@ struct Subprocess {
 	// Free memory associated with a subproc
 	~Subprocess();
 
+	// Talk over shared memory rings of ringSize bytes instead of pipes. The
+	// pipes stay open, so exits are still noticed. Call before run().
+	void sharedMemory(size_t ringSize);
+	// Run the binary where placement says (by default, wherever jitro
+	// itself could when it started). Call before run().
+	void placement(const Placement &placement);
+
 	// Actually execute the configured binary
 	int run();
 	// Attempts to update the status and returns the new one
 	SubprocessStatus status();
 	// Attempts to return the status code of an AfterExec process
 	int statusCode() const;
-	// Send the SIGKILL signal to the running subprocess
+	// Send the SIGKILL signal to the running subprocess, and reap it
 	int kill();
+	// Ask the running subprocess to exit with SIGTERM; status() says when
+	// it has
+	int terminate();
 
-	// Write a string into the stdin of the subprocess
+	// Queue a string for the stdin of the subprocess, and write as much of
+	// what is queued as it has room for without waiting. Returns how much
+	// was written.
 	ssize_t write(std::string str = "");
 	// Returns a valid line read from cout, or blank if nothing was available
 	std::string read();
+	// Write bytes as is, and read whatever bytes are available
+	ssize_t writeRaw(std::string data);
+	std::string readRaw();
+	// Close the subprocess's stdin, so it reads EOF once it has read what
+	// was written (anything still queued is dropped)
+	void closeInput();
 
 	BufReader &br();
 
-	void flush();
+	// our end of the subprocess's stdout and stdin pipes; writeFd is -1
+	// when writes go over shared memory
+	int fd() const;
+	int writeFd() const;
+	// whether there is buffered input still to be written, and how much has
+	// been written in all
+	bool wantsWrite() const;
+	uint64_t written() const;
+	// when using shared memory, the descriptor which becomes readable when
+	// the subprocess has written or made room (-1 otherwise). This arms the
+	// wakeup, so call it right before waiting.
+	int waitFd();
+	// whether the subprocess has corrupted the shared memory rings, after
+	// which nothing more goes over them
+	bool corrupt() const;
 
 	// get binary name
 	std::string binary() const;
 
+	// Pass a running subprocess on to a new jitro, and pick it up there.
+	// It stays our child across exec, so it can still be waited on.
+	void handoff(Handoff &state, std::string prefix) const;
+	int resume(const Handoff &state, std::string prefix);
+
 	protected:
 		void close();
+		// move whatever is in the shared memory ring into _br
+		void _pull();
 
 	protected:
 		std::string _binary{};
 		std::vector<std::string> _args{};
 
-		int _pipe[2]{};
+		int _pipe[2]{ -1, -1 };
 		std::string _wbuf{};
+		uint64_t _written{0};
 		SubprocessStatus _status{SubprocessStatus::BeforeExec};
 		pid_t _pid{};
 		int _value{};
 
 		BufReader _br{};
+
+		size_t _ringSize{0};
+		ShmTransport _shm{};
+		Placement _placement{};
 };
 
 #endif // SUBPROCESS_HPP
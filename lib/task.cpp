@@ -0,0 +1,129 @@
+#include "task.hpp"
+
+Task Task::promise_type::get_return_object() {
+	return Task(Handle::from_promise(*this));
+}
+Task::promise_type::Final Task::promise_type::final_suspend() noexcept {
+	_running = false;
+	return Final{_orphaned};
+}
+
+Task::Task(Handle handle) : _handle(handle) { }
+Task::Task(Task &&rhs) : _handle(rhs._handle) {
+	rhs._handle = {};
+}
+Task &Task::operator=(Task &&rhs) {
+	if(this == &rhs)
+		return *this;
+	cancel();
+	_handle = rhs._handle;
+	rhs._handle = {};
+	return *this;
+}
+Task::~Task() {
+	cancel();
+}
+
+void Task::cancel() {
+	if(!_handle)
+		return;
+	// a coroutine can't be destroyed from inside itself; it's left to
+	// destroy itself as it finishes instead
+	if(_handle.promise()._running)
+		_handle.promise()._orphaned = true;
+	else
+		_handle.destroy();
+	_handle = {};
+}
+bool Task::active() const {
+	return _handle && !_handle.done();
+}
+
+void Task::resume(Handle handle) {
+	handle.promise()._running = true;
+	handle.resume();
+}
+void Task::suspending(Handle handle) {
+	handle.promise()._running = false;
+}
+bool Task::discard(Handle handle) {
+	if(!handle.promise()._orphaned)
+		return false;
+	handle.destroy();
+	return true;
+}
+
+
+Sleep::Sleep(TimerWheel &timers, TimerWheel::TimePoint when)
+		: _timers(&timers), _when(when) { }
+Sleep::~Sleep() {
+	_timers->cancel(_timer);
+}
+
+bool Sleep::await_ready() const {
+	return _when <= TimerWheel::now();
+}
+void Sleep::await_suspend(Task::Handle handle) {
+	// (we went with the coroutine's frame)
+	if(Task::discard(handle))
+		return;
+	Task::suspending(handle);
+	_timer = _timers->schedule(_when, [this, handle]() {
+		_timer = TimerWheel::None;
+		Task::resume(handle);
+	});
+}
+
+
+Trigger::Wait::Wait(Trigger &trigger, TimerWheel &timers,
+		TimerWheel::Duration timeout)
+		: _trigger(&trigger), _timers(&timers), _timeout(timeout) { }
+Trigger::Wait::~Wait() {
+	_timers->cancel(_timer);
+	if(_trigger && _trigger->_wait == this)
+		_trigger->_wait = nullptr;
+}
+
+void Trigger::Wait::await_suspend(Task::Handle handle) {
+	if(Task::discard(handle))
+		return;
+	Task::suspending(handle);
+	_handle = handle;
+	// only one may wait at a time; whoever was is told it wasn't fired
+	if(_trigger->_wait)
+		_trigger->_wait->_finish(false);
+	_trigger->_wait = this;
+	_timer = _timers->after(_timeout, [this]() {
+		_timer = TimerWheel::None;
+		_finish(false);
+	});
+}
+
+void Trigger::Wait::_finish(bool fired) {
+	_timers->cancel(_timer);
+	if(_trigger && _trigger->_wait == this)
+		_trigger->_wait = nullptr;
+	_fired = fired;
+	Task::Handle handle = _handle;
+	_handle = {};
+	// the coroutine may well be done with us (and its frame) once resumed
+	if(handle)
+		Task::resume(handle);
+}
+
+Trigger::~Trigger() {
+	// whoever's waiting is left to time out
+	if(_wait)
+		_wait->_trigger = nullptr;
+}
+
+Trigger::Wait Trigger::wait(TimerWheel &timers, TimerWheel::Duration timeout) {
+	return Wait(*this, timers, timeout);
+}
+bool Trigger::waiting() const {
+	return _wait != nullptr;
+}
+void Trigger::fire() {
+	if(_wait)
+		_wait->_finish(true);
+}
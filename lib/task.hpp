@@ -0,0 +1,124 @@
+#ifndef TASK_HPP
+#define TASK_HPP
+
+#include <coroutine>
+#include <exception>
+#include "timerwheel.hpp"
+
+// Task is a coroutine run on the main loop. It starts running as soon as
+// it's called and goes until it first waits on something (a Sleep or a
+// Trigger), to be picked up again by the timer or whoever fires the
+// trigger, without anything polling it meanwhile.
+//
+// The Task owns the coroutine: cancelling or destroying it destroys the
+// coroutine wherever it's waiting, which cancels what it was waiting on. A
+// Task may cancel itself (by way of whatever it calls); it then goes on
+// until it returns or next waits, where it's destroyed instead, so it
+// should touch nothing its owner held on the way.
+struct Task {
+	struct promise_type {
+		Task get_return_object();
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		// a finished coroutine stays about for its Task to destroy, unless
+		// that's already been let go of
+		struct Final {
+			bool await_ready() const noexcept { return _orphaned; }
+			void await_suspend(std::coroutine_handle<>) const noexcept { }
+			void await_resume() const noexcept { }
+			bool _orphaned;
+		};
+		Final final_suspend() noexcept;
+		void return_void() { }
+		void unhandled_exception() { std::terminate(); }
+
+		bool _running{true};
+		bool _orphaned{false};
+	};
+	typedef std::coroutine_handle<promise_type> Handle;
+
+	Task() = default;
+	Task(Handle handle);
+	Task(Task &&rhs);
+	Task &operator=(Task &&rhs);
+	~Task();
+
+	Task(const Task &rhs) = delete;
+	Task &operator=(const Task &rhs) = delete;
+
+	void cancel();
+	// whether there's a coroutine which hasn't returned yet
+	bool active() const;
+
+	// pick up a waiting coroutine where it left off
+	static void resume(Handle handle);
+	// note that the coroutine is about to wait
+	static void suspending(Handle handle);
+	// destroy a coroutine about to wait if its Task was cancelled, as
+	// nothing is left to resume it for; true if it was
+	static bool discard(Handle handle);
+
+	protected:
+		Handle _handle{};
+};
+
+// co_await Sleep(timers, when) waits until the wheel reaches when
+struct Sleep {
+	Sleep(TimerWheel &timers, TimerWheel::TimePoint when);
+	~Sleep();
+
+	Sleep(const Sleep &rhs) = delete;
+	Sleep &operator=(const Sleep &rhs) = delete;
+
+	bool await_ready() const;
+	void await_suspend(Task::Handle handle);
+	void await_resume() const { }
+
+	protected:
+		TimerWheel *_timers{nullptr};
+		TimerWheel::TimePoint _when{};
+		TimerWheel::TimerId _timer{TimerWheel::None};
+};
+
+// A Trigger is something one Task at a time waits on for a while:
+// co_await trigger.wait(timers, timeout) is true if fire() was called
+// before the timeout, false if not.
+struct Trigger {
+	struct Wait {
+		Wait(Trigger &trigger, TimerWheel &timers, TimerWheel::Duration timeout);
+		~Wait();
+
+		Wait(const Wait &rhs) = delete;
+		Wait &operator=(const Wait &rhs) = delete;
+
+		bool await_ready() const { return false; }
+		void await_suspend(Task::Handle handle);
+		bool await_resume() const { return _fired; }
+
+		// stop waiting, saying whether it was fired
+		void _finish(bool fired);
+
+		Trigger *_trigger{nullptr};
+		TimerWheel *_timers{nullptr};
+		TimerWheel::Duration _timeout{};
+		TimerWheel::TimerId _timer{TimerWheel::None};
+		Task::Handle _handle{};
+		bool _fired{false};
+	};
+
+	Trigger() = default;
+	~Trigger();
+
+	Trigger(const Trigger &rhs) = delete;
+	Trigger &operator=(const Trigger &rhs) = delete;
+
+	Wait wait(TimerWheel &timers, TimerWheel::Duration timeout);
+	// whether a Task is waiting on it
+	bool waiting() const;
+	// resume the waiting Task, if there is one
+	void fire();
+
+	protected:
+		Wait *_wait{nullptr};
+};
+
+#endif // TASK_HPP
@@ -0,0 +1,165 @@
+#include "timerwheel.hpp"
+using std::vector;
+
+#include <limits>
+using std::numeric_limits;
+
+TimerWheel::TimerWheel(Duration tick) : _tick(tick), _epoch(Clock::now()) { }
+
+TimerWheel::TimerId TimerWheel::schedule(TimePoint deadline, Callback cb) {
+	uint64_t tick = _toTick(deadline);
+	if(tick < _current)
+		tick = _current;
+
+	TimerId id = _nextId++;
+	Timer &timer = _timers[id];
+	timer._tick = tick;
+	timer._cb = cb;
+	_place(id, tick);
+	return id;
+}
+TimerWheel::TimerId TimerWheel::after(Duration delay, Callback cb) {
+	return schedule(Clock::now() + delay, cb);
+}
+void TimerWheel::cancel(TimerId &id) {
+	if(id != None)
+		_timers.erase(id);
+	id = None;
+}
+bool TimerWheel::pending(TimerId id) const {
+	return _timers.find(id) != _timers.end();
+}
+
+size_t TimerWheel::advance(TimePoint now) {
+	if(now < _epoch)
+		return 0;
+	// the last tick whose time has fully passed
+	uint64_t target = (now - _epoch) / _tick;
+	size_t fired = 0;
+
+	while(_current <= target) {
+		if(_timers.empty()) {
+			for(auto &level : _wheel)
+				for(auto &slot : level)
+					slot.clear();
+			_overflow.clear();
+			_current = target + 1;
+			break;
+		}
+
+		// pull timers down from any level whose boundary we are on
+		for(unsigned level = Levels; level-- > 1; )
+			if((_current & ((1ull << (SlotBits * level)) - 1)) == 0)
+				_cascade(level);
+
+		// fire everything in this slot; callbacks may add to it
+		vector<TimerId> &slot = _wheel[0][_current & (Slots - 1)];
+		while(!slot.empty()) {
+			vector<TimerId> due;
+			due.swap(slot);
+			for(auto id : due) {
+				auto it = _timers.find(id);
+				if(it == _timers.end())
+					continue;
+				Callback cb = it->second._cb;
+				_timers.erase(it);
+				cb();
+				fired++;
+			}
+		}
+		_current++;
+
+		// skip runs of empty slots up to the next cascade boundary
+		while((_current & (Slots - 1)) != 0 && _current <= target
+				&& _wheel[0][_current & (Slots - 1)].empty())
+			_current++;
+	}
+
+	return fired;
+}
+
+TimerWheel::TimePoint TimerWheel::nextDeadline() const {
+	if(_timers.empty())
+		return TimePoint::max();
+
+	uint64_t best = numeric_limits<uint64_t>::max();
+	for(unsigned level = 0; level < Levels; ++level) {
+		uint64_t base = _current >> (SlotBits * level);
+		// the slot under the cursor on a higher level has already been
+		// cascaded and only holds timers a full turn away, unless we are
+		// sitting on its boundary and it is yet to be cascaded
+		bool onBoundary = (_current & ((1ull << (SlotBits * level)) - 1)) == 0;
+		unsigned first = onBoundary ? 0 : 1, last = onBoundary ? Slots - 1 : Slots;
+		for(unsigned i = first; i <= last; ++i) {
+			const vector<TimerId> &slot = _wheel[level][(base + i) & (Slots - 1)];
+			bool found = false;
+			for(auto id : slot) {
+				auto it = _timers.find(id);
+				if(it == _timers.end())
+					continue;
+				found = true;
+				if(it->second._tick < best)
+					best = it->second._tick;
+			}
+			if(found)
+				break;
+		}
+	}
+	for(auto id : _overflow) {
+		auto it = _timers.find(id);
+		if(it != _timers.end() && it->second._tick < best)
+			best = it->second._tick;
+	}
+
+	if(best == numeric_limits<uint64_t>::max())
+		return TimePoint::max();
+	return _fromTick(best);
+}
+
+size_t TimerWheel::size() const {
+	return _timers.size();
+}
+
+TimerWheel::TimePoint TimerWheel::now() {
+	return Clock::now();
+}
+
+uint64_t TimerWheel::_toTick(TimePoint tp) const {
+	if(tp <= _epoch)
+		return 0;
+	if(tp == TimePoint::max())
+		return numeric_limits<uint64_t>::max() / 2;
+	// round up so a timer never fires before its deadline
+	Duration since = tp - _epoch;
+	return (since + _tick - Duration(1)) / _tick;
+}
+TimerWheel::TimePoint TimerWheel::_fromTick(uint64_t tick) const {
+	return _epoch + _tick * tick;
+}
+
+void TimerWheel::_place(TimerId id, uint64_t tick) {
+	uint64_t delta = tick - _current;
+	for(unsigned level = 0; level < Levels; ++level) {
+		if(delta < (1ull << (SlotBits * (level + 1)))) {
+			unsigned slot = (tick >> (SlotBits * level)) & (Slots - 1);
+			_wheel[level][slot].push_back(id);
+			return;
+		}
+	}
+	_overflow.push_back(id);
+}
+
+void TimerWheel::_cascade(unsigned level) {
+	vector<TimerId> moving;
+	moving.swap(_wheel[level][(_current >> (SlotBits * level)) & (Slots - 1)]);
+	// the overflow list is only ever close enough to move at the top
+	if(level == Levels - 1) {
+		moving.insert(moving.end(), _overflow.begin(), _overflow.end());
+		_overflow.clear();
+	}
+	for(auto id : moving) {
+		auto it = _timers.find(id);
+		if(it != _timers.end())
+			_place(id, it->second._tick);
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef TIMERWHEEL_HPP
+#define TIMERWHEEL_HPP
+
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+// TimerWheel is a hierarchical timing wheel of monotonic clock deadlines.
+// Scheduling and cancelling are O(1); advance() fires whatever is due and
+// nextDeadline() says how long the owner may sleep before calling it again.
+//
+// There are four levels of 64 slots each; a timer lives on the lowest level
+// whose span covers it and is cascaded down as the wheel turns. Anything
+// further out than the top level waits on an overflow list.
+struct TimerWheel {
+	typedef std::chrono::steady_clock Clock;
+	typedef Clock::time_point TimePoint;
+	typedef Clock::duration Duration;
+	typedef uint64_t TimerId;
+	typedef std::function<void()> Callback;
+
+	// 0 is never handed out, so it can be used as "no timer"
+	static const TimerId None = 0;
+
+	TimerWheel(Duration tick = std::chrono::milliseconds(10));
+
+	TimerId schedule(TimePoint deadline, Callback cb);
+	TimerId after(Duration delay, Callback cb);
+	// Cancel a timer; cancelling None or a fired timer is a no-op
+	void cancel(TimerId &id);
+	bool pending(TimerId id) const;
+
+	// Fire every timer due at or before now, returning how many fired
+	size_t advance(TimePoint now = Clock::now());
+	// The earliest pending deadline, or TimePoint::max() if there is none
+	TimePoint nextDeadline() const;
+	size_t size() const;
+
+	static TimePoint now();
+
+	protected:
+		struct Timer {
+			uint64_t _tick{0};
+			Callback _cb{};
+		};
+
+		uint64_t _toTick(TimePoint tp) const;
+		TimePoint _fromTick(uint64_t tick) const;
+		void _place(TimerId id, uint64_t tick);
+		void _cascade(unsigned level);
+
+	protected:
+		static const unsigned Levels = 4;
+		static const unsigned SlotBits = 6;
+		static const unsigned Slots = 1 << SlotBits;
+
+		Duration _tick;
+		TimePoint _epoch;
+		// the next tick which has not been processed yet
+		uint64_t _current{0};
+		TimerId _nextId{1};
+
+		std::unordered_map<TimerId, Timer> _timers{};
+		// slots hold ids; cancelled ids are dropped lazily
+		std::vector<TimerId> _wheel[Levels][Slots]{};
+		std::vector<TimerId> _overflow{};
+};
+
+#endif // TIMERWHEEL_HPP
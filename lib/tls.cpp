@@ -0,0 +1,220 @@
+#include "tls.hpp"
+using std::string;
+using std::map;
+
+#include <iostream>
+using std::cerr;
+using std::endl;
+#include <map>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <arpa/inet.h>
+#include <cerrno>
+
+#include "util.hpp"
+using util::split;
+
+// sessions servers gave us, by host:port
+static map<string, SSL_SESSION *> sessions;
+
+static int newSession(SSL *ssl, SSL_SESSION *session);
+int newSession(SSL *ssl, SSL_SESSION *session) {
+	// the connection's cache key rides along as its app data
+	string *key = (string *)SSL_get_app_data(ssl);
+	if(!key)
+		return 0;
+	SSL_SESSION *&cached = sessions[*key];
+	if(cached)
+		SSL_SESSION_free(cached);
+	cached = session;
+	// we keep the reference we were given
+	return 1;
+}
+
+static SSL_CTX *context();
+SSL_CTX *context() {
+	static SSL_CTX *ctx = nullptr;
+	if(ctx)
+		return ctx;
+	ctx = SSL_CTX_new(TLS_client_method());
+	if(!ctx) {
+		ERR_print_errors_fp(stderr);
+		return nullptr;
+	}
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+	// servers hang up without close_notify all the time; that's just EOF
+	SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+	SSL_CTX_set_default_verify_paths(ctx);
+	// writes come out of a buffer that moves as it grows, a bit at a time
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE
+			| SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	// TLS 1.3 tickets arrive after the handshake, so take them as they come
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT
+			| SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, newSession);
+	return ctx;
+}
+
+Tls::~Tls() {
+	close();
+}
+
+int Tls::open(int fd, string host, string key, bool verify) {
+	close();
+	SSL_CTX *ctx = context();
+	if(!ctx)
+		return -1;
+	_ssl = SSL_new(ctx);
+	if(!_ssl || SSL_set_fd(_ssl, fd) != 1) {
+		ERR_print_errors_fp(stderr);
+		close();
+		return -1;
+	}
+	_key = key;
+	SSL_set_app_data(_ssl, &_key);
+
+	// SNI is for names only, not address literals
+	unsigned char addr[16];
+	if(inet_pton(AF_INET, host.c_str(), addr) != 1
+			&& inet_pton(AF_INET6, host.c_str(), addr) != 1)
+		SSL_set_tlsext_host_name(_ssl, host.c_str());
+	if(verify) {
+		SSL_set_verify(_ssl, SSL_VERIFY_PEER, nullptr);
+		SSL_set1_host(_ssl, host.c_str());
+	} else
+		SSL_set_verify(_ssl, SSL_VERIFY_NONE, nullptr);
+
+	auto it = sessions.find(key);
+	if(it != sessions.end())
+		SSL_set_session(_ssl, it->second);
+
+	SSL_set_connect_state(_ssl);
+	return 0;
+}
+
+void Tls::close() {
+	if(_ssl) {
+		// best effort; the socket is about to go either way
+		if(_established)
+			SSL_shutdown(_ssl);
+		SSL_free(_ssl);
+	}
+	_ssl = nullptr;
+	_established = _wantsWrite = false;
+}
+
+int Tls::handshake() {
+	if(!_ssl)
+		return -1;
+	if(_established)
+		return 1;
+	int res = SSL_connect(_ssl);
+	if(res == 1) {
+		_established = true;
+		_wantsWrite = false;
+		cerr << "Tls::handshake: " << SSL_get_version(_ssl) << " with " << _key
+			<< (SSL_session_reused(_ssl) ? " (resumed)" : "") << endl;
+		return 1;
+	}
+	if(_result(res, "Tls::handshake") < 0 && errno == EAGAIN)
+		return 0;
+	return -1;
+}
+
+bool Tls::established() const {
+	return _established;
+}
+
+ssize_t Tls::read(char *buf, size_t len) {
+	if(!_ssl) {
+		errno = EBADF;
+		return -1;
+	}
+	int res = SSL_read(_ssl, buf, (int)len);
+	if(res > 0) {
+		_wantsWrite = false;
+		return res;
+	}
+	return _result(res, "Tls::read");
+}
+
+ssize_t Tls::write(const char *buf, size_t len) {
+	if(!_ssl) {
+		errno = EBADF;
+		return -1;
+	}
+	int res = SSL_write(_ssl, buf, (int)len);
+	if(res > 0) {
+		_wantsWrite = false;
+		return res;
+	}
+	return _result(res, "Tls::write");
+}
+
+bool Tls::wantsWrite() const {
+	return _wantsWrite;
+}
+
+size_t Tls::pending() const {
+	return _ssl ? (size_t)SSL_pending(_ssl) : 0;
+}
+
+ssize_t Tls::_result(int res, const char *what) {
+	switch(SSL_get_error(_ssl, res)) {
+		case SSL_ERROR_WANT_READ:
+			_wantsWrite = false;
+			errno = EAGAIN;
+			return -1;
+		case SSL_ERROR_WANT_WRITE:
+			_wantsWrite = true;
+			errno = EAGAIN;
+			return -1;
+		// the peer closed the connection, cleanly or not
+		case SSL_ERROR_ZERO_RETURN:
+			return 0;
+		case SSL_ERROR_SYSCALL:
+			if(errno == 0 || errno == EPIPE)
+				return 0;
+			perror(what);
+			return -1;
+		default:
+			cerr << what << ": failed" << endl;
+			ERR_print_errors_fp(stderr);
+			errno = EPROTO;
+			return -1;
+	}
+}
+
+void Tls::handoff(Handoff &state) {
+	string keys;
+	for(auto &session : sessions) {
+		int len = i2d_SSL_SESSION(session.second, nullptr);
+		if(len <= 0)
+			continue;
+		string der(len, '\0');
+		unsigned char *out = (unsigned char *)&der[0];
+		i2d_SSL_SESSION(session.second, &out);
+		keys += (keys.empty() ? "" : " ") + session.first;
+		state.set("tls.session." + session.first, der);
+	}
+	state.set("tls.sessions", keys);
+}
+
+void Tls::resume(const Handoff &state) {
+	if(!context())
+		return;
+	for(auto &key : split(state.get("tls.sessions"), " ")) {
+		string der = state.get("tls.session." + key);
+		const unsigned char *in = (const unsigned char *)der.data();
+		SSL_SESSION *session = d2i_SSL_SESSION(nullptr, &in, (long)der.length());
+		if(!session)
+			continue;
+		SSL_SESSION *&cached = sessions[key];
+		if(cached)
+			SSL_SESSION_free(cached);
+		cached = session;
+	}
+}
@@ -0,0 +1,59 @@
+#ifndef TLS_HPP
+#define TLS_HPP
+
+#include <string>
+#include <sys/types.h>
+#include "handoff.hpp"
+
+typedef struct ssl_st SSL;
+
+// Tls is the client end of a TLS connection over a connected, non-blocking
+// socket. The handshake is driven a step at a time from the event loop, and
+// read and write then behave like read(2) and write(2) on the socket
+// (-1 with errno EAGAIN when they would block).
+//
+// Sessions are cached per server as the server hands them out, and offered
+// again on the next connection to it, so reconnecting after a netsplit
+// resumes with an abbreviated handshake.
+struct Tls {
+	Tls() = default;
+	~Tls();
+
+	Tls(const Tls &rhs) = delete;
+	Tls &operator=(const Tls &rhs) = delete;
+
+	// Start a session on fd with host, resuming the one cached under key
+	// (host:port) if there is one. Unless verify is false, the server must
+	// have a certificate for host that we trust.
+	int open(int fd, std::string host, std::string key, bool verify);
+	// send close_notify if we can, and free the session
+	void close();
+
+	// Push the handshake along: 1 when done, 0 if it's waiting on the
+	// socket, -1 if it failed
+	int handshake();
+	bool established() const;
+
+	ssize_t read(char *buf, size_t len);
+	ssize_t write(const char *buf, size_t len);
+	// whether we need the socket to be writable to make progress
+	bool wantsWrite() const;
+	// decrypted bytes read off the socket but not yet taken by read
+	size_t pending() const;
+
+	// pass cached sessions on to a new jitro, and pick them up there
+	static void handoff(Handoff &state);
+	static void resume(const Handoff &state);
+
+	protected:
+		// map an SSL_get_error result to a return value and errno
+		ssize_t _result(int res, const char *what);
+
+	protected:
+		SSL *_ssl{nullptr};
+		std::string _key{};
+		bool _established{false};
+		bool _wantsWrite{false};
+};
+
+#endif // TLS_HPP
@@ -0,0 +1,261 @@
+#include "iobackend.hpp"
+using std::string;
+using std::vector;
+using std::unordered_map;
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+// user_data of what isn't a poll; polls carry generation << 32 | fd
+static const uint64_t timeoutTag = ~(uint64_t)0;
+static const uint64_t removeTag = timeoutTag - 1;
+
+static uint64_t pollTag(int fd, uint32_t generation);
+uint64_t pollTag(int fd, uint32_t generation) {
+	return ((uint64_t)generation << 32) | (uint32_t)fd;
+}
+
+UringBackend::~UringBackend() {
+	_close();
+}
+
+int UringBackend::open(unsigned entries) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+	if(_fd < 0) {
+		perror("UringBackend::open: io_uring_setup");
+		return -1;
+	}
+
+	_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	_cqRingSize = params.cq_off.cqes
+		+ params.cq_entries * sizeof(struct io_uring_cqe);
+	// newer kernels map both rings at once
+	bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+	if(single && _cqRingSize > _sqRingSize)
+		_sqRingSize = _cqRingSize;
+
+	_sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+	if(_sqRing == MAP_FAILED) {
+		_sqRing = nullptr;
+		perror("UringBackend::open: mmap");
+		_close();
+		return -1;
+	}
+	if(single)
+		_cqRing = _sqRing;
+	else {
+		_cqRing = mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+		if(_cqRing == MAP_FAILED) {
+			_cqRing = nullptr;
+			perror("UringBackend::open: mmap");
+			_close();
+			return -1;
+		}
+	}
+	_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	void *sqes = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+	if(sqes == MAP_FAILED) {
+		perror("UringBackend::open: mmap");
+		_close();
+		return -1;
+	}
+	_sqes = (struct io_uring_sqe *)sqes;
+
+	char *sq = (char *)_sqRing, *cq = (char *)_cqRing;
+	_sqHead = (unsigned *)(sq + params.sq_off.head);
+	_sqTail = (unsigned *)(sq + params.sq_off.tail);
+	_sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+	_sqArray = (unsigned *)(sq + params.sq_off.array);
+	_sqEntries = params.sq_entries;
+	_cqHead = (unsigned *)(cq + params.cq_off.head);
+	_cqTail = (unsigned *)(cq + params.cq_off.tail);
+	_cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+	_cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	return 0;
+}
+
+void UringBackend::_close() {
+	if(_sqes)
+		munmap(_sqes, _sqesSize);
+	if(_cqRing && _cqRing != _sqRing)
+		munmap(_cqRing, _cqRingSize);
+	if(_sqRing)
+		munmap(_sqRing, _sqRingSize);
+	_sqes = nullptr;
+	_sqRing = _cqRing = nullptr;
+	if(_fd >= 0)
+		close(_fd);
+	_fd = -1;
+}
+
+struct io_uring_sqe *UringBackend::_sqe() {
+	unsigned tail = *_sqTail;
+	if(tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) >= _sqEntries) {
+		_enter(0);
+		if(tail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE) >= _sqEntries)
+			return nullptr;
+	}
+	unsigned index = tail & *_sqMask;
+	struct io_uring_sqe *sqe = &_sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	_sqArray[index] = index;
+	// the kernel only takes entries when we enter, so the caller has
+	// filled this in by the time it's looked at
+	__atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+int UringBackend::_enter(unsigned wait) {
+	unsigned pending = *_sqTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+	if(!pending && !wait)
+		return 0;
+	int res = (int)syscall(__NR_io_uring_enter, _fd, pending, wait,
+			wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+	return res < 0 ? -errno : res;
+}
+
+void UringBackend::_arm(int fd, short events) {
+	struct io_uring_sqe *sqe = _sqe();
+	if(!sqe)
+		return;
+	Armed armed;
+	armed._events = events;
+	armed._generation = ++_generation;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = (uint16_t)events;
+	sqe->user_data = pollTag(fd, armed._generation);
+	_armed[fd] = armed;
+}
+
+void UringBackend::_disarm(int fd) {
+	auto it = _armed.find(fd);
+	if(it == _armed.end())
+		return;
+	struct io_uring_sqe *sqe = _sqe();
+	if(sqe) {
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = pollTag(fd, it->second._generation);
+		sqe->user_data = removeTag;
+	}
+	_armed.erase(it);
+}
+
+void UringBackend::_reap() {
+	unsigned head = *_cqHead;
+	unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+	for(; head != tail; ++head) {
+		struct io_uring_cqe *cqe = &_cqes[head & *_cqMask];
+		if(cqe->user_data == timeoutTag || cqe->user_data == removeTag)
+			continue;
+		int fd = (int)(uint32_t)cqe->user_data;
+		uint32_t generation = (uint32_t)(cqe->user_data >> 32);
+		auto it = _armed.find(fd);
+		// a poll removed or replaced since it was armed
+		if(it == _armed.end() || it->second._generation != generation)
+			continue;
+		_armed.erase(it);
+		if(cqe->res >= 0)
+			_ready[fd] |= (short)cqe->res;
+		else if(cqe->res != -ECANCELED)
+			_ready[fd] |= POLLNVAL;
+	}
+	__atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+}
+
+int UringBackend::wait(vector<struct pollfd> &fds, int timeout) {
+	_reap();
+
+	// drop polls nobody wants any more, and arm those not yet armed
+	unordered_map<int, short> wanted;
+	for(auto &pfd : fds)
+		wanted[pfd.fd] = pfd.events;
+	vector<int> stale;
+	for(auto &armed : _armed) {
+		auto it = wanted.find(armed.first);
+		if(it == wanted.end() || it->second != armed.second._events)
+			stale.push_back(armed.first);
+	}
+	for(int fd : stale)
+		_disarm(fd);
+	for(auto it = _ready.begin(); it != _ready.end(); )
+		if(wanted.count(it->first))
+			++it;
+		else
+			it = _ready.erase(it);
+
+	bool ready = false;
+	for(auto &want : wanted) {
+		if(_ready.count(want.first))
+			ready = true;
+		else if(!_armed.count(want.first))
+			_arm(want.first, want.second);
+	}
+
+	// submit and wait in one go, with a timeout that's gone as soon as
+	// anything else completes
+	int res;
+	if(ready || timeout == 0)
+		res = _enter(0);
+	else {
+		if(timeout > 0) {
+			struct io_uring_sqe *sqe = _sqe();
+			if(sqe) {
+				_timeout.tv_sec = timeout / 1000;
+				_timeout.tv_nsec = (long long)(timeout % 1000) * 1000000;
+				sqe->opcode = IORING_OP_TIMEOUT;
+				sqe->fd = -1;
+				sqe->addr = (uint64_t)(uintptr_t)&_timeout;
+				sqe->len = 1;
+				sqe->off = 1;
+				sqe->user_data = timeoutTag;
+			}
+		}
+		res = _enter(1);
+	}
+	_reap();
+	if(res < 0 && res != -EINTR && res != -EBUSY && res != -EAGAIN) {
+		errno = -res;
+		return -1;
+	}
+
+	int count = 0;
+	for(auto &pfd : fds) {
+		pfd.revents = 0;
+		auto it = _ready.find(pfd.fd);
+		if(it == _ready.end())
+			continue;
+		pfd.revents = it->second & (pfd.events | POLLERR | POLLHUP | POLLNVAL);
+		_ready.erase(it);
+		count += pfd.revents != 0;
+	}
+	if(!count && res == -EINTR) {
+		errno = EINTR;
+		return -1;
+	}
+	return count;
+}
+
+void UringBackend::forget(int fd) {
+	_ready.erase(fd);
+	if(!_armed.count(fd))
+		return;
+	// an armed poll holds the file open, so let go of it right away
+	_disarm(fd);
+	_enter(0);
+}
+
+string UringBackend::name() const {
+	return "io_uring";
+}
@@ -50,6 +50,26 @@ bool util::executable(std::string path) {
 	return (access(path.c_str(), X_OK) == 0);
 }
 
+string util::base64(string data) {
+	static const char *digits =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	string out;
+	out.reserve((data.length() + 2) / 3 * 4);
+	for(size_t i = 0; i < data.length(); i += 3) {
+		size_t n = data.length() - i < 3 ? data.length() - i : 3;
+		unsigned long bits = (unsigned long)(unsigned char)data[i] << 16;
+		if(n > 1)
+			bits |= (unsigned long)(unsigned char)data[i + 1] << 8;
+		if(n > 2)
+			bits |= (unsigned char)data[i + 2];
+		out += digits[(bits >> 18) & 63];
+		out += digits[(bits >> 12) & 63];
+		out += n > 1 ? digits[(bits >> 6) & 63] : '=';
+		out += n > 2 ? digits[bits & 63] : '=';
+	}
+	return out;
+}
+
 bool util::contains(string &str, string key) {
 	return (str.find(key) != string::npos);
 }
@@ -22,6 +22,9 @@ namespace util {
 	bool readable(std::string path);
 	bool executable(std::string path);
 
+	// standard base64, with padding
+	std::string base64(std::string data);
+
 	bool contains(std::string &str, std::string key);
 	template<typename T> bool contains(std::vector<T> &vector, T key);
 	template<typename K, typename V> bool contains(std::map<K, V> &map, K key);
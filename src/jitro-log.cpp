@@ -0,0 +1,82 @@
+#include <iostream>
+using std::cout;
+using std::cerr;
+using std::endl;
+#include <string>
+using std::string;
+
+#include <unistd.h>
+#include <time.h>
+#include <cstdlib>
+#include <cstring>
+
+#include "logstore.hpp"
+
+// jitro-log looks up what was said in the logs jitro keeps (core.log_dir),
+// printing the matching lines as they are stored:
+//
+//     jitro-log [-d dir] [-n network] [-c channel] [-f from] [-t to]
+//
+// Times are in UTC, as seconds since the epoch or "YYYY-MM-DD[ HH:MM[:SS]]".
+
+static void usage(const char *name);
+void usage(const char *name) {
+	cerr << "usage: " << name << " [-d dir] [-n network] [-c channel]"
+		<< " [-f from] [-t to]" << endl
+		<< "  times are UTC, as unix times or YYYY-MM-DD[ HH:MM[:SS]]" << endl;
+}
+
+// parse a time given on the command line, false if it isn't one
+static bool parseTime(const char *str, time_t &when);
+bool parseTime(const char *str, time_t &when) {
+	char *end = nullptr;
+	long long seconds = strtoll(str, &end, 10);
+	if(end != str && *end == '\0') {
+		when = (time_t)seconds;
+		return true;
+	}
+	for(const char *format : { "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M",
+			"%Y-%m-%d" }) {
+		struct tm tm;
+		memset(&tm, 0, sizeof(tm));
+		end = strptime(str, format, &tm);
+		if(end && *end == '\0') {
+			when = timegm(&tm);
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char **argv) {
+	string dir = "logs";
+	LogStore::Query query;
+	for(int opt; (opt = getopt(argc, argv, "d:n:c:f:t:h")) != -1; ) {
+		switch(opt) {
+			case 'd': dir = optarg; break;
+			case 'n': query._network = optarg; break;
+			case 'c': query._channel = optarg; break;
+			case 'f':
+			case 't':
+				if(!parseTime(optarg, opt == 'f' ? query._from : query._to)) {
+					cerr << "jitro-log: \"" << optarg << "\" isn't a time" << endl;
+					return 1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(optind != argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	LogStore store(dir);
+	if(store.find(query, [](const string &line) { cout << line << '\n'; }) != 0) {
+		cerr << "jitro-log: unable to read " << dir << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -8,118 +8,435 @@ using std::string;
 using std::vector;
 #include <map>
 using std::map;
+#include <utility>
+using std::pair;
+#include <list>
+using std::list;
+#include <deque>
+using std::deque;
 #include <memory>
 using std::move;
+using std::shared_ptr;
+#include <chrono>
+using std::chrono::seconds;
+using std::chrono::milliseconds;
+using std::chrono::duration_cast;
+#include <algorithm>
+using std::min;
+#include <functional>
+using std::hash;
+#include <sstream>
+using std::istringstream;
 
 #include <unistd.h>
+#include <string.h>
 #include <time.h>
+#include <poll.h>
+#include <climits>
+#include <cerrno>
+#include <csignal>
 
 #include "ircsock.hpp"
 #include "subprocess.hpp"
 #include "config.hpp"
+#include "timerwheel.hpp"
+#include "framing.hpp"
+#include "listener.hpp"
+#include "filewatch.hpp"
+#include "handoff.hpp"
+#include "settings.hpp"
+#include "journal.hpp"
+#include "shaper.hpp"
+#include "broadcast.hpp"
+#include "logger.hpp"
+#include "placement.hpp"
+#include "probes.hpp"
+#include "iobackend.hpp"
+#include "tls.hpp"
 #include "util.hpp"
 using util::contains;
 using util::split;
 using util::executable;
 using util::startsWith;
 using util::fromString;
+using util::toString;
 
-bool done = false;
 static string configFile = "jitro.conf";
-Config conf;
+// set by a binary's QUIT, SIGTERM or SIGINT; the main loop then shuts down
+// (see stepShutdown), saying quitMessage to every network
+static volatile sig_atomic_t shutdownRequested = 0;
+static string quitMessage = "goodbye";
+// set by SIGHUP; the main loop reloads the configuration when it sees it
+static volatile sig_atomic_t reloadRequested = 0;
+// set by SIGUSR2; the main loop execs a new jitro, handing everything over
+static volatile sig_atomic_t upgradeRequested = 0;
+// where our executable was when we started, which is where an upgraded one
+// will have been installed
+static string selfPath;
+// every timeout, backoff and retry in jitro is scheduled on this
+TimerWheel timers;
+// everything the networks say, read by every binary and endpoint
+Broadcast inbound;
+// networks in configuration order, which is also their framed protocol id
+vector<string> networkNames;
 
-vector<string> getChannelsForNetwork(string network);
+uint16_t networkId(string name);
+string networkName(uint16_t id);
 
-vector<string> getChannelsForNetwork(string network) {
-	string netscope = "irc." + network + ".";
-
-	vector<string> channels = split(conf[netscope + "channels"]);
-	if(channels.empty()) {
-		cerr << "jitro: " + network + " has no defined channels" << endl;
-		throw 0;
-	}
-
-	return channels;
+uint16_t networkId(string name) {
+	for(size_t i = 0; i < networkNames.size(); ++i)
+		if(networkNames[i] == name)
+			return (uint16_t)i;
+	return framing::Control;
+}
+string networkName(uint16_t id) {
+	if(id >= networkNames.size())
+		return "";
+	return networkNames[id];
 }
 
 struct ConnectionManager {
-	ConnectionManager(string inetwork);
+	ConnectionManager(const NetworkSettings &settings);
 	~ConnectionManager();
 
 	ConnectionManager(ConnectionManager &&rhs);
 	ConnectionManager(const ConnectionManager &rhs) = delete;
 	ConnectionManager &operator=(const ConnectionManager &rhs) = delete;
 
-	void manage();
+	bool manage();
+	// add the descriptors we are waiting on to fds, and see what they were
+	// found ready for once waited on
+	void watch(vector<struct pollfd> &fds);
+	void ready(const vector<struct pollfd> &fds);
 
 	void write(string line);
 	vector<string> read();
 
+	// answer a membership query about this network
+	string query(string what, vector<string> args);
+
+	// pick up new settings, returning false if they can't be made without
+	// connecting again
+	bool reconfigure(const NetworkSettings &settings);
+
+	// pass our connection on to a new jitro, and pick it up there
+	void handoff(Handoff &state);
+	void resume(const Handoff &state);
+
+	// for shutting down: whether everything queued has gone out, then
+	// QUIT, and whether the server has hung up on us since
+	bool idle();
+	void quit(string message);
+	bool closed() const;
+
 	string name();
 
+	protected:
+		void _applyLagPolicy();
+		void _applyShaping();
+		// wake up when the shaper next lets a line go
+		void _scheduleShaping();
+		// whether the shaper may let lines for target go
+		bool _ready(const string &target);
+		void _openJournal();
+		// note which journaled lines have gone out, and resend the rest once
+		// a new connection is registered
+		void _acknowledge();
+		void _replay();
+
 	protected:
 		IRCSock *_isock{nullptr};
 		vector<string> _out{};
 		vector<string> _in{};
 		string _network{};
+		// what we were configured with, to tell what a reload changed
+		NetworkSettings _settings{};
+
+		// journaled lines handed to the socket but not yet written out
+		struct InFlight {
+			Journal::Seq _seq;
+			unsigned _connection;
+			uint64_t _queued;
+		};
+		Journal *_journal{nullptr};
+		deque<InFlight> _inFlight{};
+		// the connection the journal was last replayed on, and what's still
+		// to be replayed there
+		unsigned _replayed{0};
+		deque<Journal::Entry> _replaying{};
+
+		Shaper _shaper{};
+		// the connection the shaper's rate was last started over for
+		unsigned _registered{0};
+		TimerWheel::TimerId _shapeTimer{TimerWheel::None};
+		TimerWheel::TimePoint _shapeAt{};
+		// held lines dropped so far, as last reported
+		uint64_t _expired{0};
+		// where our socket is in what was last waited on
+		size_t _watched{SIZE_MAX};
 };
 
 ConnectionManager::~ConnectionManager() {
 	if(_isock) {
 		_isock->quit();
 		_isock->process();
+		_acknowledge();
 		delete _isock;
 	}
+	delete _journal;
+	timers.cancel(_shapeTimer);
 }
 ConnectionManager::ConnectionManager(ConnectionManager &&rhs) :
-		_isock(rhs._isock), _out(rhs._out), _in(rhs._in), _network(rhs._network) {
+		_isock(rhs._isock), _out(rhs._out), _in(rhs._in), _network(rhs._network),
+		_settings(rhs._settings), _journal(rhs._journal),
+		_inFlight(rhs._inFlight), _replayed(rhs._replayed),
+		_replaying(rhs._replaying),
+		_shaper(rhs._shaper), _registered(rhs._registered),
+		_expired(rhs._expired) {
 	rhs._isock = nullptr;
+	rhs._journal = nullptr;
+	timers.cancel(rhs._shapeTimer);
 }
 
-ConnectionManager::ConnectionManager(string inetwork) : _network(inetwork) {
-	string netscope = "irc." + _network + ".", server = conf[netscope + "server"];
-	if(server.empty()) {
-		cerr << "jitro: " + _network + " has no defined server" << endl;
-		throw 0;
+ConnectionManager::ConnectionManager(const NetworkSettings &settings)
+		: _network(settings._name), _settings(settings) {
+	vector<IRCSock::Server> servers;
+	for(auto &ss : settings._servers) {
+		IRCSock::Server server;
+		server._host = ss._host;
+		server._port = ss._port;
+		server._tls = settings._tls;
+		server._verify = settings._tlsVerify;
+		servers.push_back(server);
 	}
 
-	string sport = conf[netscope + "port"];
-	if(sport.empty()) sport = "6667";
+	string nick = settings._nicks[0], password;
+	if(settings._passwords.count(nick))
+		password = settings._passwords.at(nick);
 
-	int port = fromString<int>(sport);
+	cout << "jitro: connecting to " << _network
+		<< " (" << servers[0]._host << ":" << servers[0]._port
+		<< (settings._tls ? ", TLS" : "") << ")"
+		<< " as " << nick << " "
+		<< (password.empty() ? "" : "(has password)") << endl;
+
+	_isock = new IRCSock(timers, servers, settings._nicks, settings._passwords);
+	_isock->logAs(_network);
 
-	vector<string> nicks = split(conf[netscope + "nicks"]);
-	if(nicks.empty()) {
-		cerr << "jitro: " + _network + " has no defined nicks" << endl;
-		throw 0;
+	_applyLagPolicy();
+	_applyShaping();
+	_openJournal();
+	for(auto &chan : settings._channels) {
+		cerr << "jitro: joining " << chan << " on " << _network << endl;
+		_isock->join(chan);
 	}
+}
+
+void ConnectionManager::_applyLagPolicy() {
+	// lag probing, and switching servers when it stays too high
+	_isock->lagPolicy(_settings._probeInterval, _settings._lagThreshold,
+			_settings._lagWindow);
+	// not lag, but likewise only read as the connection goes along
+	_isock->capabilities(_settings._caps, _settings._sasl);
+	_isock->nicks(_settings._nicks, _settings._passwords);
+}
+
+void ConnectionManager::_applyShaping() {
+	Shaper::Limits limits;
+	limits._burst = _settings._sendBurst;
+	limits._interval = milliseconds(_settings._sendInterval);
+	limits._totalBurst = _settings._sendTotalBurst;
+	limits._totalInterval = milliseconds(_settings._sendTotalInterval);
+	limits._dedupWindow = seconds(_settings._dedupWindow);
+	limits._maxQueued = _settings._sendQueue;
+	limits._maxTotal = _settings._sendQueueTotal;
+	limits._holdTimeout = seconds(_settings._holdTimeout);
+	// servers relay our lines prefixed with "nick!user@host", which must
+	// fit in their 512 bytes as well; whichever nick we end up with, made
+	// up fallbacks being at most three longer than the first
+	size_t nickLength = 0;
+	for(auto &nick : _settings._nicks)
+		nickLength = std::max(nickLength, nick.length());
+	limits._maxLength = 512 - 2 - (nickLength + 3 + 77);
+	_shaper.configure(limits);
+}
 
-	map<string, string> passwords;
-	for(auto nick : nicks)
-		passwords[nick] = conf[netscope + nick + ".password"];
+void ConnectionManager::_scheduleShaping() {
+	TimerWheel::TimePoint next = _shaper.nextRelease(
+			[this](const string &target) { return _ready(target); });
+	if(!_replaying.empty())
+		next = min(next, _shaper.nextTake());
+	if(next == _shapeAt && timers.pending(_shapeTimer))
+		return;
+	timers.cancel(_shapeTimer);
+	_shapeAt = next;
+	if(next == TimerWheel::TimePoint::max())
+		return;
+	// firing is enough to have manage() look again
+	_shapeTimer = timers.schedule(next, [this]() {
+		_shapeTimer = TimerWheel::None;
+	});
+}
 
-	vector<string> channels = split(conf[netscope + "channels"]);
-	if(channels.empty()) {
-		cerr << "jitro: " + _network + " has no defined channels" << endl;
-		throw 0;
+bool ConnectionManager::_ready(const string &target) {
+	// until we're registered lines can only go into the journal, and none
+	// may go to a channel before we're in it
+	return (_isock->registered() || _journal) && !_isock->joining(target);
+}
+
+void ConnectionManager::_openJournal() {
+	delete _journal;
+	_journal = nullptr;
+	_inFlight.clear();
+	if(_settings._journal.empty())
+		return;
+	_journal = new Journal();
+	if(_journal->open(_settings._journal, _settings._journalSize) != 0) {
+		cerr << "jitro: not journaling " << _network << ": can't open \""
+			<< _settings._journal << "\"" << endl;
+		delete _journal;
+		_journal = nullptr;
 	}
+}
 
-	cout << "jitro: connecting to " << _network
-		<< " (" << server << ":" << port << ")" << " as " << nicks[0] << " "
-		<< (passwords[nicks[0]].empty() ? "" : "(has password)") << endl;
+void ConnectionManager::_acknowledge() {
+	if(!_journal)
+		return;
+	while(!_inFlight.empty()) {
+		InFlight &line = _inFlight.front();
+		// lines lost with an old connection stay in the journal to replay
+		if(line._connection == _isock->connection()
+				&& line._queued > _isock->written())
+			break;
+		if(line._connection == _isock->connection())
+			_journal->ack(line._seq);
+		_inFlight.pop_front();
+	}
+	_journal->commit();
+}
 
-	_isock = new IRCSock(server, port, nicks[0], passwords[nicks[0]]);
-	for(auto &chan : channels) {
-		cerr << "jitro: joining " << chan << " on " << _network << endl;
-		_isock->join(chan);
+void ConnectionManager::_replay() {
+	// wait for our channels too, which most journaled lines are for
+	if(!_journal || !_isock->registered() || _isock->joining())
+		return;
+	if(_replayed != _isock->connection()) {
+		_replayed = _isock->connection();
+		_replaying.clear();
+
+		size_t expired = 0;
+		vector<Journal::Entry> entries = _journal->pending(
+				_settings._journalMaxAge, expired);
+		if(expired)
+			cerr << "jitro: dropped " << expired << " journaled lines for "
+				<< _network << " as too old to send" << endl;
+		for(auto &entry : entries) {
+			bool sending = false;
+			for(auto &line : _inFlight)
+				sending |= line._seq == entry._seq
+					&& line._connection == _isock->connection();
+			if(!sending)
+				_replaying.push_back(entry);
+		}
+		if(!_replaying.empty())
+			cerr << "jitro: replaying " << _replaying.size()
+				<< " journaled lines to " << _network << endl;
+	}
+
+	// they go out no faster than the shaper lets anything else
+	TimerWheel::TimePoint now = TimerWheel::now();
+	while(!_replaying.empty() && _shaper.take(now)) {
+		Journal::Entry &entry = _replaying.front();
+		_isock->send(entry._line);
+		_inFlight.push_back({ entry._seq, _isock->connection(), _isock->queued() });
+		_replaying.pop_front();
 	}
+	if(!_replaying.empty())
+		_scheduleShaping();
+}
+
+bool ConnectionManager::reconfigure(const NetworkSettings &settings) {
+	if(!settings.sameConnection(_settings))
+		return false;
+
+	vector<string> channels = settings._channels, old = _settings._channels;
+	for(auto &chan : old)
+		if(!contains(channels, chan)) {
+			cerr << "jitro: parting " << chan << " on " << _network << endl;
+			_isock->part(chan);
+		}
+	for(auto &chan : channels)
+		if(!contains(old, chan)) {
+			cerr << "jitro: joining " << chan << " on " << _network << endl;
+			_isock->join(chan);
+		}
+	bool journal = settings._journal != _settings._journal
+		|| settings._journalSize != _settings._journalSize;
+	_settings = settings;
+
+	_applyLagPolicy();
+	_applyShaping();
+	if(journal) {
+		_openJournal();
+		// anything a new journal holds is sent as if we just registered
+		_replayed = 0;
+		_replaying.clear();
+	}
+	return true;
+}
+
+void ConnectionManager::handoff(Handoff &state) {
+	string prefix = "net." + _network + ".";
+	_isock->handoff(state, prefix);
+	// the journal itself is on disk, but not what's already been sent
+	// what's left to replay is picked up from the journal again there
+	state.set(prefix + "replayed",
+			toString(_replaying.empty() ? _replayed : 0));
+	string inFlight;
+	for(auto &line : _inFlight)
+		inFlight += toString(line._seq) + " " + toString(line._connection) + " "
+			+ toString(line._queued) + "\n";
+	state.set(prefix + "inflight", inFlight);
+	string shaped;
+	for(auto &line : _shaper.queued())
+		shaped += line + "\n";
+	state.set(prefix + "shaped", shaped);
+}
+void ConnectionManager::resume(const Handoff &state) {
+	string prefix = "net." + _network + ".";
+	string shaped = state.get(prefix + "shaped");
+	for(size_t pos = 0, nl; (nl = shaped.find('\n', pos)) != string::npos;
+			pos = nl + 1)
+		_shaper.push(shaped.substr(pos, nl - pos), TimerWheel::now());
+	if(!_isock->resume(state, prefix))
+		return;
+	cout << "jitro: resumed our connection to " << _network << endl;
+	_replayed = fromString<unsigned>(state.get(prefix + "replayed"));
+	if(!_journal)
+		return;
+	istringstream inFlight(state.get(prefix + "inflight"));
+	InFlight line;
+	while(inFlight >> line._seq >> line._connection >> line._queued)
+		_inFlight.push_back(line);
 }
 
 string ConnectionManager::name() {
 	return _network;
 }
 void ConnectionManager::write(string msg) {
-	_in.push_back(msg);
+	switch(_shaper.push(msg, TimerWheel::now())) {
+		case Shaper::Result::Duplicate:
+			cerr << "jitro: not sending repeated \"" << msg << "\" to "
+				<< _network << endl;
+			break;
+		case Shaper::Result::Overflow:
+			cerr << "jitro: too much queued for " << _network
+				<< ", dropped the oldest to take \"" << msg << "\"" << endl;
+			break;
+		case Shaper::Result::Queued:
+		case Shaper::Result::INVALID:
+		default:
+			break;
+	}
 }
 vector<string> ConnectionManager::read() {
 	vector<string> out = _out;
@@ -127,15 +444,124 @@ vector<string> ConnectionManager::read() {
 	return out;
 }
 
-void ConnectionManager::manage() {
-	_isock->process();
+string ConnectionManager::query(string what, vector<string> args) {
+	const Membership &members = _isock->members();
+	vector<string> res;
+	if(what == "members" && args.size() == 1)
+		res = members.members(args[0]);
+	else if(what == "channels" && args.size() == 1)
+		res = members.channels(args[0]);
+	else if(what == "modes" && args.size() == 2)
+		return members.modes(args[0], args[1]);
+	else if(what == "waits" && args.empty()) {
+		// lines let out, their average and longest wait in ms, and how many
+		// were dropped after waiting too long
+		const Shaper::Waits &waits = _shaper.waits();
+		TimerWheel::Duration average = waits._count
+			? waits._total / (long)waits._count
+			: TimerWheel::Duration::zero();
+		return toString(waits._count)
+			+ " " + toString(duration_cast<milliseconds>(average).count())
+			+ " " + toString(duration_cast<milliseconds>(waits._max).count())
+			+ " " + toString(waits._expired);
+	} else if(what == "nick" && args.empty())
+		// which may not be the first configured one
+		return _isock->nick();
+	else if(what == "lag" && args.empty())
+		// average and last round trip in ms, who it was measured against, and
+		// how late the server's own timestamps reach us (with server-time)
+		return toString(duration_cast<milliseconds>(_isock->averageLag()).count())
+			+ " " + toString(duration_cast<milliseconds>(_isock->lag()).count())
+			+ " " + _isock->server()
+			+ " " + toString(duration_cast<milliseconds>(_isock->delay()).count());
+	else
+		cerr << "jitro: unknown query \"" << what << "\" on " << _network << endl;
+
+	string answer;
+	for(auto &r : res)
+		answer += (answer.empty() ? "" : " ") + r;
+	return answer;
+}
+
+bool ConnectionManager::idle() {
+	// without a connection, nothing is going anywhere (the journal, if
+	// there is one, keeps it for next time)
+	if(_isock->fd() < 0 || _isock->connecting())
+		return true;
+	return _shaper.empty() && _in.empty() && !_isock->wantsWrite();
+}
+void ConnectionManager::quit(string message) {
+	_isock->quit(message);
+}
+bool ConnectionManager::closed() const {
+	return _isock->closed();
+}
 
-	// dispatch all waiting messages
+void ConnectionManager::watch(vector<struct pollfd> &fds) {
+	_watched = SIZE_MAX;
+	int fd = _isock->fd();
+	if(fd < 0)
+		return;
+	short events = POLLIN;
+	if(_isock->wantsWrite())
+		events |= POLLOUT;
+	_watched = fds.size();
+	fds.push_back({ fd, events, 0 });
+}
+void ConnectionManager::ready(const vector<struct pollfd> &fds) {
+	// an idle connection isn't read from until there's something to read
+	if(_watched < fds.size()
+			&& (fds[_watched].revents & (POLLIN | POLLHUP | POLLERR)))
+		_isock->readable();
+	// and writable, which is how a connection attempt ends either way
+	if(_watched < fds.size()
+			&& (fds[_watched].revents & (POLLOUT | POLLHUP | POLLERR)))
+		_isock->writable();
+}
+
+bool ConnectionManager::manage() {
+	// a new connection gets a full burst; lines let out while we weren't
+	// registered only went into the journal
+	if(_isock->registered() && _registered != _isock->connection()) {
+		_registered = _isock->connection();
+		_shaper.restart();
+	}
+	// what the journal has left to resend goes ahead of anything new
+	_replay();
+	// lines wait in the shaper until there's somewhere to put them
+	vector<string> released = _shaper.pop(TimerWheel::now(),
+			[this](const string &target) { return _ready(target); });
+	_in.insert(_in.end(), released.begin(), released.end());
+	_scheduleShaping();
+	if(_shaper.waits()._expired != _expired) {
+		cerr << "jitro: dropped " << _shaper.waits()._expired - _expired
+			<< " lines for " << _network << " after waiting "
+			<< _settings._holdTimeout << "s to join their channels" << endl;
+		_expired = _shaper.waits()._expired;
+	}
+
+	bool didSomething = !_in.empty();
+
+	// dispatch all waiting messages, journaling them first if we can; until
+	// we're registered journaled lines wait there to be replayed
 	for(auto msg : _in) {
 		cerr << "jitro: sent \"" << msg << "\" to " << _network << endl;
-		_isock->send(msg);
+		Journal::Seq seq = 0;
+		if(_journal && !startsWith(msg, "QUIT"))
+			seq = _journal->append(msg);
+		if(seq && !_isock->registered())
+			continue;
+		if(_isock->send(msg) && seq)
+			_inFlight.push_back({ seq, _isock->connection(), _isock->queued() });
 	}
 	_in.clear();
+	// one sync for everything appended, before any of it is written out
+	if(_journal)
+		_journal->commit();
+
+	didSomething |= _isock->process();
+	_acknowledge();
+	_replay();
 
 	vector<string> out = _isock->read();
 	_out.reserve(_out.size() + out.size());
@@ -145,82 +571,594 @@ void ConnectionManager::manage() {
 			continue;
 		_out.push_back(line);
 	}
+	return didSomething;
 }
 
 
 
 struct BinaryManager {
-	BinaryManager(string binary);
+	BinaryManager(const BinarySettings &settings);
+	~BinaryManager();
 
 	BinaryManager(BinaryManager &&rhs);
 	BinaryManager(const BinaryManager &rhs) = delete;
 	BinaryManager &operator=(const BinaryManager &rhs) = delete;
 
-	void manage();
+	bool manage();
+	// add the descriptors we are waiting on to fds
+	void watch(vector<struct pollfd> &fds);
 
-	void write(string line);
-	vector<string> read();
+	// queue the answer to a query the binary made
+	void answer(string query, string answer);
+	// lines the binary wants sent, as (destination, line)
+	vector<pair<string, string>> read();
+
+	// whether settings can be taken on without starting the binary over
+	bool reconfigure(const BinarySettings &settings);
+	// networks came or went, which framed binaries need to be told
+	void networksChanged();
+
+	// pass our running binary on to a new jitro, and pick it up there
+	void handoff(Handoff &state);
+	void resume(const Handoff &state);
+
+	// For shutting down: give the binary what's left for it, then close
+	// its stdin and let it finish up and exit (it isn't restarted). Once
+	// it's gone it's finished. terminate sends SIGTERM if it's still
+	// running, returning whether it was, and kill SIGKILL.
+	void finish();
+	bool finished();
+	bool terminate();
+	void kill();
 
 	string name();
 
+	protected:
+		void _start();
+		void _hello();
+		void _readLines();
+		// false if the binary sent something corrupt and is being restarted
+		bool _readFrames();
+		void _scheduleRestart();
+		void _armRestart();
+		// take what the networks said, as much as the binary keeps up with,
+		// returning false if it fell too far behind to keep running
+		bool _consume(size_t &taken);
+		// the watchdog: note what the binary read and said, wake up when it
+		// would be stalled, and deal with it if it is
+		void _track(size_t outBefore);
+		void _watch();
+		void _checkStall();
+		void _armKill();
+
 	protected:
 		Subprocess *_sproc{nullptr};
 		bool _failed{false};
-		vector<string> _out{};
+		bool _finishing{false};
+		vector<pair<string, string>> _out{};
+		// answers to queries, and lines picked up from an older jitro
 		vector<string> _in{};
+
+		// where we are in inbound, what we'd lost there as last reported,
+		// and whether we were last seen far behind
+		Broadcast::Reader _reader{Broadcast::None};
+		uint64_t _dropped{0};
+		bool _behind{false};
+
+		// binaries speaking the framed protocol get batches of frames
+		bool _framed{false};
+		vector<framing::Frame> _frames{};
+		string _rbuf{};
+
+		// binaries which keep dying are restarted less and less eagerly
+		int _restarts{0};
+		TimerWheel::TimePoint _started{};
+		TimerWheel::TimePoint _restartAt{};
+		TimerWheel::TimerId _restartTimer{TimerWheel::None};
+
+		// since when what we wrote it has gone unread, and since when lines
+		// it was given have gone unanswered (TimePoint() if they haven't);
+		// how long it takes to answer on average; and what it'd read as of
+		// the last pass
+		TimerWheel::TimePoint _unreadSince{};
+		TimerWheel::TimePoint _unansweredSince{};
+		TimerWheel::Duration _latency{};
+		uint64_t _written{0};
+		bool _stalled{false};
+		TimerWheel::TimePoint _watchAt{};
+		TimerWheel::TimerId _watchTimer{TimerWheel::None};
+		// a stalled binary gets SIGTERM, then SIGKILL if it's still there
+		TimerWheel::TimePoint _killAt{};
+		TimerWheel::TimerId _killTimer{TimerWheel::None};
+
+		BinarySettings _settings{};
 };
 
-BinaryManager::BinaryManager(string binary) : _sproc(new Subprocess(binary)) { }
+// restart delay doubles from 1s up to this, and resets once a binary has
+// stayed up for stableRuntime
+static const int maxRestartDelay = 300;
+static const int stableRuntime = 60;
+// seconds a stalled binary has to exit after SIGTERM
+static const int killGrace = 5;
+
+BinaryManager::BinaryManager(const BinarySettings &settings)
+		: _sproc(new Subprocess(settings._path)), _framed(settings._framed),
+		_settings(settings) {
+	_reader = inbound.subscribe();
+	// high volume binaries may trade their pipes for shared memory rings
+	if(settings._ringSize)
+		_sproc->sharedMemory(settings._ringSize);
+	_sproc->placement(settings._placement);
+}
+BinaryManager::~BinaryManager() {
+	timers.cancel(_restartTimer);
+	timers.cancel(_watchTimer);
+	timers.cancel(_killTimer);
+	inbound.unsubscribe(_reader);
+	delete _sproc;
+}
 BinaryManager::BinaryManager(BinaryManager &&rhs) : _sproc(rhs._sproc),
-		_failed(rhs._failed), _out(rhs._out), _in(rhs._in) {
+		_failed(rhs._failed), _finishing(rhs._finishing), _out(rhs._out),
+		_in(rhs._in),
+		_reader(rhs._reader), _dropped(rhs._dropped), _behind(rhs._behind),
+		_framed(rhs._framed), _frames(rhs._frames), _rbuf(rhs._rbuf),
+		_restarts(rhs._restarts), _started(rhs._started),
+		_restartAt(rhs._restartAt), _unreadSince(rhs._unreadSince),
+		_unansweredSince(rhs._unansweredSince), _latency(rhs._latency),
+		_written(rhs._written), _stalled(rhs._stalled), _killAt(rhs._killAt),
+		_settings(rhs._settings) {
 	rhs._sproc = nullptr;
+	rhs._reader = Broadcast::None;
+	// pending timers refer to rhs, so take them over
+	if(timers.pending(rhs._restartTimer)) {
+		timers.cancel(rhs._restartTimer);
+		_armRestart();
+	}
+	if(timers.pending(rhs._killTimer)) {
+		timers.cancel(rhs._killTimer);
+		_armKill();
+	}
+	timers.cancel(rhs._watchTimer);
+	_watch();
 }
 
-void BinaryManager::manage() {
-	if(_failed)
+void BinaryManager::_start() {
+	cout << "jitro: creating subprocess \"" << _sproc->binary()
+		<< "\"" << endl;
+	if(_sproc->run() != 0) {
+		cerr << "jitro: unable to run subprocess!?" << endl;
+		_failed = true;
+	}
+	_started = TimerWheel::now();
+	_unreadSince = _unansweredSince = TimerWheel::TimePoint();
+	_written = _sproc->written();
+	// what went by while it wasn't running doesn't make it slow
+	if(inbound.dropped(_reader) != _dropped)
+		cerr << "jitro: \"" << _sproc->binary() << "\" missed "
+			<< inbound.dropped(_reader) - _dropped << " lines while stopped"
+			<< endl;
+	_dropped = inbound.dropped(_reader);
+
+	// framed binaries are told which network ids mean what up front
+	if(_framed) {
+		_rbuf.clear();
+		_hello();
+	}
+}
+
+void BinaryManager::_hello() {
+	framing::Frame hello;
+	hello._network = framing::Control;
+	hello._msg._prefix = "jitro";
+	hello._msg._command = "NETWORKS";
+	hello._msg._params = networkNames;
+	_frames.insert(_frames.begin(), hello);
+}
+
+void BinaryManager::handoff(Handoff &state) {
+	string prefix = "bin." + _sproc->binary() + ".";
+	_sproc->handoff(state, prefix);
+	state.set(prefix + "restarts", toString(_restarts));
+	// what we've yet to read from inbound goes along with what's queued
+	vector<framing::Frame> frames = _frames;
+	string in;
+	for(auto &line : _in)
+		in += line + "\n";
+	for(auto msg : inbound.unread(_reader)) {
+		if(!_framed) {
+			in += msg->_prefixed + "\n";
+			continue;
+		}
+		framing::Frame frame;
+		frame._network = networkId(msg->_network);
+		frame._msg = msg->_msg;
+		frames.push_back(frame);
+	}
+	state.set(prefix + "in", in);
+	state.set(prefix + "frames", frames.empty() ? "" : framing::encode(frames));
+	state.set(prefix + "rframes", _rbuf);
+}
+void BinaryManager::resume(const Handoff &state) {
+	string prefix = "bin." + _sproc->binary() + ".";
+	if(_sproc->resume(state, prefix) != 0)
+		return;
+	cout << "jitro: resumed subprocess \"" << _sproc->binary() << "\"" << endl;
+	_started = TimerWheel::now();
+	_restarts = fromString<int>(state.get(prefix + "restarts"));
+	for(auto &line : split(state.get(prefix + "in"), "\n"))
+		_in.push_back(line);
+	string frames = state.get(prefix + "frames");
+	framing::decode(frames, _frames);
+	_rbuf = state.get(prefix + "rframes");
+}
+
+bool BinaryManager::reconfigure(const BinarySettings &settings) {
+	if(!settings.sameProcess(_settings))
+		return false;
+	_settings = settings;
+	_watch();
+	return true;
+}
+void BinaryManager::networksChanged() {
+	if(_framed)
+		_hello();
+}
+
+void BinaryManager::_scheduleRestart() {
+	// the watchdog starts over with the binary
+	timers.cancel(_watchTimer);
+	timers.cancel(_killTimer);
+	_stalled = false;
+	if(_finishing)
 		return;
 
+	if(TimerWheel::now() - _started >= seconds(stableRuntime))
+		_restarts = 0;
+	int delay = min(1 << min(_restarts, 16), maxRestartDelay);
+	_restartAt = TimerWheel::now() + seconds(delay);
+	_restarts++;
+	cout << "jitro: restarting \"" << _sproc->binary() << "\" in "
+		<< delay << "s" << endl;
+	_armRestart();
+}
+void BinaryManager::_armRestart() {
+	timers.cancel(_restartTimer);
+	_restartTimer = timers.schedule(_restartAt, [this]() {
+		_restartTimer = TimerWheel::None;
+		_start();
+	});
+}
+
+void BinaryManager::watch(vector<struct pollfd> &fds) {
+	// one which has just exited is watched too, so its stdout (at EOF) wakes
+	// us to deal with it
+	SubprocessStatus status = _sproc->status();
+	if(_failed || (status != SubprocessStatus::Exec
+				&& status != SubprocessStatus::AfterExec))
+		return;
+	fds.push_back({ _sproc->fd(), POLLIN, 0 });
+	if(_sproc->wantsWrite() && _sproc->writeFd() >= 0)
+		fds.push_back({ _sproc->writeFd(), POLLOUT, 0 });
+	if(_sproc->waitFd() >= 0)
+		fds.push_back({ _sproc->waitFd(), POLLIN, 0 });
+}
+
+bool BinaryManager::manage() {
+	if(_failed)
+		return false;
+
 	if(_sproc->status() == SubprocessStatus::AfterExec) {
 		cout << "jitro: subproccess \"" << _sproc->binary()
 			<< "\" returned: " << _sproc->statusCode() << endl;
-		_sproc->kill();
+		// what it said on its way out still goes out
+		if(_framed) {
+			if(!_readFrames())
+				return true;
+		} else
+			_readLines();
+		if(_sproc->status() == SubprocessStatus::AfterExec) {
+			_sproc->kill();
+			_scheduleRestart();
+		}
+		return true;
 	}
 
 	if(_sproc->status() != SubprocessStatus::Exec) {
-		cout << "jitro: creating subprocess \"" << _sproc->binary()
-			<< "\"" << endl;
-		if(_sproc->run() != 0) {
-			cerr << "jitro: unable to run subprocess!?" << endl;
-			_failed = true;
+		// the first start is immediate, restarts happen on _restartTimer
+		if(_restartTimer == TimerWheel::None && _restarts == 0
+				&& !_finishing) {
+			_start();
+			return true;
 		}
-		return;
+		return false;
 	}
+	// nothing more for a binary we're waiting on to exit
+	if(_killTimer != TimerWheel::None)
+		return false;
 
-	for(auto &l : _in) {
-		_sproc->write(l);
-		_sproc->flush();
+	size_t taken = 0;
+	if(!_consume(taken)) {
+		_sproc->kill();
+		_scheduleRestart();
+		return true;
 	}
-	_in.clear();
+	bool didSomething = !_in.empty() || !_frames.empty() || taken;
+	size_t outBefore = _out.size();
 
-	for(string line = _sproc->read(); !line.empty(); line = _sproc->read()) {
-		_out.push_back(line);
+	if(_framed) {
+		// everything queued goes over as a single batch
+		if(!_frames.empty()) {
+			_sproc->writeRaw(framing::encode(_frames));
+			_frames.clear();
+		}
+		if(!_readFrames())
+			return true;
+	} else {
+		// whatever doesn't fit waits until the pipe has room
+		_sproc->write();
+		_readLines();
+	}
+	// the rings can't be trusted any more, so neither can the binary
+	if(_sproc->corrupt()) {
+		cerr << "jitro: \"" << _sproc->binary() << "\" corrupted its shared"
+			" memory, restarting it" << endl;
+		_sproc->kill();
+		_scheduleRestart();
+		return true;
 	}
+	didSomething |= _out.size() != outBefore;
+	_track(outBefore);
+
+	// once it has everything there is for it, it's told there's no more
+	if(_finishing && !_sproc->wantsWrite() && _in.empty() && _frames.empty()
+			&& inbound.lag(_reader) == 0)
+		_sproc->closeInput();
 
 	// if the subprocess has closed it's stdout, close it down
 	if(_sproc->br().eof()) {
 		cout << "jitro: subproc \"" << _sproc->binary()
 			<< "\" has returned EOF" << endl;
 		_sproc->kill();
+		_scheduleRestart();
+		return true;
 	}
+	return didSomething;
 }
 
-vector<string> BinaryManager::read() {
-	vector<string> out = _out;
+bool BinaryManager::_consume(size_t &taken) {
+	uint64_t dropped = inbound.dropped(_reader);
+	if(dropped != _dropped) {
+		cerr << "jitro: \"" << _sproc->binary() << "\" fell behind and missed "
+			<< dropped - _dropped << " lines" << endl;
+		_dropped = dropped;
+		if(_settings._restartSlow) {
+			cerr << "jitro: restarting \"" << _sproc->binary()
+				<< "\" for being too slow" << endl;
+			inbound.skip(_reader);
+			return false;
+		}
+	}
+	bool behind = inbound.lag(_reader) > inbound.capacity() / 2;
+	if(behind != _behind)
+		cerr << "jitro: \"" << _sproc->binary() << "\" is " << (behind
+				? "falling behind the networks" : "keeping up again") << endl;
+	_behind = behind;
+
+	// take no more until what we took last is out; whatever the binary
+	// hasn't room for waits in inbound, where it shows up as our lag
+	if(_sproc->wantsWrite())
+		return true;
+	string lines;
+	for(auto &line : _in)
+		lines += line + "\n";
+	_in.clear();
+	for(const Broadcast::Message *msg; (msg = inbound.next(_reader)); ++taken) {
+		if(!_framed) {
+			lines += msg->_prefixed + "\n";
+			continue;
+		}
+		framing::Frame frame;
+		frame._network = networkId(msg->_network);
+		frame._msg = msg->_msg;
+		_frames.push_back(frame);
+	}
+	if(!lines.empty())
+		_sproc->writeRaw(lines);
+	return true;
+}
+
+void BinaryManager::_track(size_t outBefore) {
+	TimerWheel::TimePoint now = TimerWheel::now(), never{};
+	bool read = _sproc->written() != _written;
+	_written = _sproc->written();
+
+	if(!_sproc->wantsWrite())
+		_unreadSince = never;
+	else if(read || _unreadSince == never)
+		_unreadSince = now;
+	if(read && _stalled) {
+		cerr << "jitro: \"" << _sproc->binary() << "\" is reading again" << endl;
+		_stalled = false;
+	}
+
+	if(_out.size() != outBefore) {
+		if(_unansweredSince != never) {
+			TimerWheel::Duration took = now - _unansweredSince;
+			_latency = _latency == TimerWheel::Duration::zero() ? took
+				: _latency + (took - _latency) / 4;
+		}
+		_unansweredSince = never;
+	} else if(read && _unansweredSince == never)
+		_unansweredSince = now;
+	_watch();
+}
+
+void BinaryManager::_watch() {
+	TimerWheel::TimePoint never{}, deadline = TimerWheel::TimePoint::max();
+	if(_settings._stallInput && _unreadSince != never)
+		deadline = _unreadSince + seconds(_settings._stallInput);
+	if(_settings._stallOutput && _unansweredSince != never)
+		deadline = min(deadline,
+				_unansweredSince + seconds(_settings._stallOutput));
+	if(deadline == TimerWheel::TimePoint::max()) {
+		timers.cancel(_watchTimer);
+		return;
+	}
+	// deadlines only move out as the binary gets on, so a timer already set
+	// for sooner just checks again when it fires
+	if(timers.pending(_watchTimer) && _watchAt <= deadline)
+		return;
+	timers.cancel(_watchTimer);
+	_watchAt = deadline;
+	_watchTimer = timers.schedule(deadline, [this]() {
+		_watchTimer = TimerWheel::None;
+		_checkStall();
+	});
+}
+
+void BinaryManager::_checkStall() {
+	if(_sproc->status() != SubprocessStatus::Exec
+			|| _killTimer != TimerWheel::None)
+		return;
+	TimerWheel::TimePoint now = TimerWheel::now(), never{};
+	string why;
+	if(_settings._stallInput && _unreadSince != never
+			&& now - _unreadSince >= seconds(_settings._stallInput))
+		why = "hasn't read anything in " + toString(_settings._stallInput) + "s";
+	else if(_settings._stallOutput && _unansweredSince != never
+			&& now - _unansweredSince >= seconds(_settings._stallOutput))
+		why = "hasn't said anything in " + toString(_settings._stallOutput)
+			+ "s";
+	if(why.empty()) {
+		_watch();
+		return;
+	}
+
+	cerr << "jitro: \"" << _sproc->binary() << "\" is stalled: " << why
+		<< ", with " << inbound.lag(_reader) << " lines waiting (it usually"
+		" answers in " << duration_cast<milliseconds>(_latency).count() << "ms)"
+		<< endl;
+	_stalled = true;
+	if(_settings._shedStalled) {
+		// it keeps running, but starts over at what's new whenever it's back
+		inbound.skip(_reader);
+		_unreadSince = _unreadSince == never ? never : now;
+		_unansweredSince = _unansweredSince == never ? never : now;
+		_watch();
+		return;
+	}
+	_sproc->terminate();
+	_killAt = now + seconds(killGrace);
+	_armKill();
+}
+
+void BinaryManager::_armKill() {
+	timers.cancel(_killTimer);
+	_killTimer = timers.schedule(_killAt, [this]() {
+		_killTimer = TimerWheel::None;
+		if(_sproc->status() != SubprocessStatus::Exec)
+			return;
+		cerr << "jitro: \"" << _sproc->binary() << "\" ignored SIGTERM, killing it"
+			<< endl;
+		_sproc->kill();
+		_scheduleRestart();
+	});
+}
+
+void BinaryManager::_readLines() {
+	for(string line = _sproc->read(); !line.empty(); line = _sproc->read()) {
+		size_t space = line.find(" ");
+		if(space == string::npos)
+			_out.push_back({ line, "" });
+		else
+			_out.push_back({ line.substr(0, space), line.substr(space + 1) });
+	}
+}
+
+bool BinaryManager::_readFrames() {
+	_rbuf += _sproc->readRaw();
+
+	vector<framing::Frame> frames;
+	framing::DecodeStatus status;
+	while((status = framing::decode(_rbuf, frames)) == framing::DecodeStatus::Ok)
+		;
+	// what came before the corrupt batch still goes out
+	if(status == framing::DecodeStatus::Corrupt) {
+		cerr << "jitro: corrupt batch from \"" << _sproc->binary()
+			<< "\", restarting it" << endl;
+		_rbuf.clear();
+		_sproc->kill();
+		_scheduleRestart();
+	}
+
+	for(auto &frame : frames) {
+		IRCMessage &msg = frame._msg;
+		string network = networkName(frame._network);
+		if(frame._network == framing::Broadcast)
+			network = "broadcast";
+		else if(network.empty()) {
+			cerr << "jitro: \"" << _sproc->binary() << "\" sent to unknown network "
+				<< frame._network << endl;
+			continue;
+		}
+
+		if(msg._command == "QUERY") {
+			string query = network;
+			for(auto &param : msg._params)
+				query += " " + param;
+			_out.push_back({ "query", query });
+			continue;
+		}
+		_out.push_back({ network, msg.str() });
+	}
+	return status != framing::DecodeStatus::Corrupt;
+}
+
+vector<pair<string, string>> BinaryManager::read() {
+	vector<pair<string, string>> out = _out;
 	_out.clear();
 	return out;
 }
-void BinaryManager::write(string line) {
-	_in.push_back(line);
+void BinaryManager::answer(string query, string answer) {
+	if(!_framed) {
+		_in.push_back("query " + query + " :" + answer);
+		return;
+	}
+	vector<string> fields = split(query, " ");
+	if(fields.empty())
+		return;
+	framing::Frame frame;
+	frame._network = networkId(fields[0]);
+	frame._msg._prefix = "jitro";
+	frame._msg._command = "QUERY";
+	frame._msg._params.assign(fields.begin() + 1, fields.end());
+	frame._msg._params.push_back(answer);
+	_frames.push_back(frame);
+}
+
+void BinaryManager::finish() {
+	_finishing = true;
+	timers.cancel(_restartTimer);
+}
+bool BinaryManager::finished() {
+	// exits are dealt with (and what was said on the way out read) in
+	// manage, which leaves it BeforeExec
+	return _failed || _sproc->status() == SubprocessStatus::BeforeExec;
+}
+bool BinaryManager::terminate() {
+	if(finished())
+		return false;
+	cerr << "jitro: \"" << _sproc->binary() << "\" is still running, sending"
+		" SIGTERM" << endl;
+	_sproc->terminate();
+	return true;
+}
+void BinaryManager::kill() {
+	if(finished())
+		return;
+	cerr << "jitro: \"" << _sproc->binary() << "\" is still running, killing"
+		" it" << endl;
+	_sproc->kill();
 }
 
 string BinaryManager::name() {
@@ -228,90 +1166,883 @@ string BinaryManager::name() {
 }
 
 
+// EndpointManager stands in for a binary whose workers connect to us over a
+// Unix or TCP socket rather than being forked by us. A worker sends
+// "AUTH <secret>" (unless no secret is configured, which only unix sockets
+// allow) and "HANDLES <network...>" ("*" for all of them), is answered "OK"
+// or "ERROR <reason>", and from then on speaks the same line protocol as a
+// binary does on stdin/stdout.
+//
+// Each line from a network goes to one of the workers handling it; lines
+// about the same channel or nick always pick the same worker while the set
+// of workers is unchanged, so their order is kept. With no worker around,
+// lines are held (up to a limit) until one connects, and whatever a worker
+// leaves unsent when it drops is handed to the others.
+struct EndpointManager {
+	EndpointManager(const EndpointSettings &settings);
+	~EndpointManager();
+
+	EndpointManager(const EndpointManager &rhs) = delete;
+	EndpointManager &operator=(const EndpointManager &rhs) = delete;
+
+	bool manage();
+	// add the descriptors we are waiting on to fds
+	void watch(vector<struct pollfd> &fds);
+
+	// queue a line received from network for a worker (those from inbound
+	// are picked up by manage)
+	void write(string network, string line);
+	// queue the answer to a query, for the worker which made it
+	void answer(string query, string answer);
+	// lines the workers want sent, as (destination, line)
+	vector<pair<string, string>> read();
+
+	// whether settings are the ones we were set up with
+	bool reconfigure(const EndpointSettings &settings);
+
+	// pass our listening socket and held lines on to a new jitro, and pick
+	// them up there; workers connect to the new jitro again
+	void handoff(Handoff &state);
+	void resume(const Handoff &state);
+
+	// For shutting down: stop listening, give workers what's left for them
+	// and then shut our side of their connections, so they finish up and
+	// hang up. Once they all have, we're finished.
+	void finish();
+	bool finished() const;
+
+	string name();
+
+	protected:
+		struct Worker {
+			Worker(int fd, unsigned id) : _peer(fd), _id(id) { }
+
+			Peer _peer;
+			unsigned _id;
+			bool _authed{false};
+			bool _ready{false};
+			vector<string> _handles{};
+			TimerWheel::TimerId _authTimer{TimerWheel::None};
+			// since when what we wrote it has gone unread, and whether its
+			// lines go to the others until it has room again
+			TimerWheel::TimePoint _unreadSince{};
+			bool _stalled{false};
+		};
+
+		void _listen();
+		bool _handshake(Worker &worker, string line);
+		bool _handles(const Worker &worker, string network) const;
+		void _drop(list<Worker>::iterator worker);
+		// hand what a worker hasn't read to the others
+		void _divert(Worker &worker);
+
+	protected:
+		string _name{};
+		EndpointSettings _settings{};
+		bool _failed{false};
+		bool _finishing{false};
+
+		Listener _listener{};
+		list<Worker> _workers{};
+		unsigned _nextId{0};
+
+		// "<network> <line>"s waiting for a worker to handle them
+		deque<string> _backlog{};
+		size_t _dropped{0};
+		// workers whose queries are waiting on answer(), in order
+		deque<unsigned> _askers{};
+		vector<pair<string, string>> _out{};
+		// where we are in inbound; workers have buffers of their own, so we
+		// always read everything
+		Broadcast::Reader _reader{Broadcast::None};
+};
+
+// how long a worker has to authenticate and say what it handles
+static const int workerHandshakeTimeout = 10;
+
+EndpointManager::EndpointManager(const EndpointSettings &settings)
+		: _name(settings._name), _settings(settings),
+		_reader(inbound.subscribe()) { }
+
+void EndpointManager::_listen() {
+	cout << "jitro: listening for \"" << _name << "\" workers on "
+		<< _settings._listen << endl;
+	if(_listener.listen(_settings._listen) != 0) {
+		cerr << "jitro: unable to listen on \"" << _settings._listen << "\""
+			<< endl;
+		_failed = true;
+	}
+}
+
+void EndpointManager::handoff(Handoff &state) {
+	string prefix = "end." + _name + ".";
+	_listener.handoff(state, prefix + "listener.");
+	// what workers were never sent is held for the next ones
+	string backlog;
+	for(auto &worker : _workers)
+		if(worker._ready)
+			backlog += worker._peer.unsent();
+	for(auto &line : _backlog)
+		backlog += line + "\n";
+	for(auto msg : inbound.unread(_reader))
+		backlog += msg->_prefixed + "\n";
+	state.set(prefix + "backlog", backlog);
+}
+void EndpointManager::resume(const Handoff &state) {
+	string prefix = "end." + _name + ".";
+	if(state.get(prefix + "listener.address") != _settings._listen
+			|| _listener.resume(state, prefix + "listener.") != 0)
+		return;
+	cout << "jitro: resumed listening for \"" << _name << "\" workers on "
+		<< _settings._listen << endl;
+	for(auto &line : split(state.get(prefix + "backlog"), "\n"))
+		_backlog.push_back(line);
+}
+EndpointManager::~EndpointManager() {
+	for(auto &worker : _workers)
+		timers.cancel(worker._authTimer);
+	inbound.unsubscribe(_reader);
+}
+
+void EndpointManager::watch(vector<struct pollfd> &fds) {
+	if(_failed)
+		return;
+	if(_listener.fd() >= 0)
+		fds.push_back({ _listener.fd(), POLLIN, 0 });
+	for(auto &worker : _workers) {
+		short events = POLLIN;
+		if(worker._peer.wantsWrite())
+			events |= POLLOUT;
+		fds.push_back({ worker._peer.fd(), events, 0 });
+	}
+}
+
+bool EndpointManager::manage() {
+	if(_failed)
+		return false;
+	// like binaries, we start on the first pass, after any resume
+	if(_listener.fd() < 0 && !_finishing) {
+		_listen();
+		return true;
+	}
+	bool didSomething = false;
+
+	for(int fd = _listener.accept(); fd >= 0; fd = _listener.accept()) {
+		_workers.emplace_back(fd, _nextId++);
+		Worker *worker = &_workers.back();
+		cout << "jitro: worker " << worker->_id << " connected to \""
+			<< _name << "\"" << endl;
+		worker->_authed = _settings._secret.empty();
+		worker->_authTimer = timers.after(seconds(workerHandshakeTimeout),
+				[worker]() {
+			worker->_authTimer = TimerWheel::None;
+			cerr << "jitro: worker " << worker->_id << " took too long to"
+				" introduce itself" << endl;
+			worker->_peer.close();
+		});
+		didSomething = true;
+	}
+
+	for(const Broadcast::Message *msg; (msg = inbound.next(_reader)); ) {
+		write(msg->_network, msg->_line);
+		didSomething = true;
+	}
+
+	size_t outBefore = _out.size();
+	TimerWheel::TimePoint now = TimerWheel::now(), never{};
+	for(auto it = _workers.begin(); it != _workers.end(); ) {
+		Worker &worker = *it;
+		bool read = worker._peer.flush() > 0;
+		didSomething |= read;
+
+		// a worker which stops reading loses its lines to the others
+		if(!worker._peer.wantsWrite() || read)
+			worker._unreadSince = worker._peer.wantsWrite() ? now : never;
+		else if(worker._unreadSince == never)
+			worker._unreadSince = now;
+		if(worker._stalled && worker._peer.writable()) {
+			cerr << "jitro: worker " << worker._id << " of \"" << _name
+				<< "\" is reading again" << endl;
+			worker._stalled = false;
+		}
+		if(worker._ready && !worker._stalled && _settings._stallInput
+				&& worker._unreadSince != never
+				&& now - worker._unreadSince >= seconds(_settings._stallInput)) {
+			_divert(worker);
+			didSomething = true;
+		}
+
+		for(string line = worker._peer.read(); !line.empty();
+				line = worker._peer.read()) {
+			if(!worker._ready) {
+				if(!_handshake(worker, line))
+					break;
+				continue;
+			}
+
+			size_t space = line.find(" ");
+			string destination = line.substr(0, space),
+				msg = space == string::npos ? "" : line.substr(space + 1);
+			if(destination == "query")
+				_askers.push_back(worker._id);
+			_out.push_back({ destination, msg });
+		}
+
+		if(worker._peer.closed()) {
+			auto dead = it++;
+			_drop(dead);
+			didSomething = true;
+			continue;
+		}
+		++it;
+	}
+	didSomething |= _out.size() != outBefore;
+
+	return didSomething;
+}
+
+bool EndpointManager::_handshake(Worker &worker, string line) {
+	vector<string> fields = split(line, " ");
+	string command = fields.empty() ? "" : fields[0];
+
+	if(command == "AUTH" && fields.size() == 2 && !_settings._secret.empty()) {
+		// compare all of it, so the time taken doesn't give the secret away
+		const string &given = fields[1];
+		unsigned char diff = given.length() != _settings._secret.length();
+		for(size_t i = 0; i < given.length(); ++i)
+			diff |= given[i] ^ _settings._secret[i % _settings._secret.length()];
+		if(diff) {
+			cerr << "jitro: worker " << worker._id << " failed to authenticate"
+				<< endl;
+			worker._peer.write("ERROR bad secret");
+			worker._peer.close();
+			return false;
+		}
+		worker._authed = true;
+		worker._peer.write("OK");
+		return true;
+	}
+
+	if(command == "HANDLES" && fields.size() >= 2 && worker._authed) {
+		worker._handles.assign(fields.begin() + 1, fields.end());
+		worker._ready = true;
+		timers.cancel(worker._authTimer);
+		worker._peer.write("OK");
+		cout << "jitro: worker " << worker._id << " handles " << line.substr(8)
+			<< " for \"" << _name << "\"" << endl;
+
+		// it may be able to take some of what has been waiting
+		deque<string> backlog;
+		backlog.swap(_backlog);
+		for(auto &held : backlog) {
+			size_t space = held.find(" ");
+			write(held.substr(0, space), held.substr(space + 1));
+		}
+		return true;
+	}
+
+	worker._peer.write(worker._authed ? "ERROR expected HANDLES"
+			: "ERROR expected AUTH");
+	worker._peer.close();
+	return false;
+}
+
+bool EndpointManager::_handles(const Worker &worker, string network) const {
+	if(!worker._ready || worker._stalled || worker._peer.closed())
+		return false;
+	for(auto &handled : worker._handles)
+		if(handled == "*" || handled == network)
+			return true;
+	return false;
+}
+
+void EndpointManager::_drop(list<Worker>::iterator worker) {
+	cout << "jitro: worker " << worker->_id << " left \"" << _name << "\""
+		<< endl;
+	timers.cancel(worker->_authTimer);
+
+	// whatever it never got goes to the others, or waits for a replacement
+	vector<string> unsent;
+	if(worker->_ready)
+		unsent = split(worker->_peer.unsent(), "\n");
+	_workers.erase(worker);
+	for(auto &line : unsent) {
+		size_t space = line.find(" ");
+		if(space != string::npos)
+			write(line.substr(0, space), line.substr(space + 1));
+	}
+}
+
+void EndpointManager::_divert(Worker &worker) {
+	vector<string> unsent = split(worker._peer.unstarted(), "\n");
+	cerr << "jitro: worker " << worker._id << " of \"" << _name << "\" is"
+		" stalled, hasn't read anything in " << _settings._stallInput
+		<< "s; diverting " << unsent.size() << " lines" << endl;
+	worker._stalled = true;
+	worker._unreadSince = TimerWheel::TimePoint();
+	for(auto &line : unsent) {
+		size_t space = line.find(" ");
+		if(space != string::npos)
+			write(line.substr(0, space), line.substr(space + 1));
+	}
+}
+
+void EndpointManager::write(string network, string line) {
+	vector<Worker *> candidates;
+	for(auto &worker : _workers)
+		if(_handles(worker, network))
+			candidates.push_back(&worker);
+
+	if(candidates.empty()) {
+		if(_settings._backlog == 0)
+			return;
+		if(_backlog.size() >= _settings._backlog) {
+			_backlog.pop_front();
+			if(_dropped++ % 1000 == 0)
+				cerr << "jitro: no workers for \"" << _name << "\", dropped "
+					<< _dropped << " lines so far" << endl;
+		}
+		_backlog.push_back(network + " " + line);
+		return;
+	}
+
+	// keep everything about one channel (or nick) on one worker
+	IRCMessage msg = IRCMessage::parse(line);
+	string target = msg.param(0);
+	if(target.empty() || (target[0] != '#' && target[0] != '&'))
+		target = msg.nick();
+	for(auto &c : target)
+		c = (char)tolower((unsigned char)c);
+	size_t pick = hash<string>()(network + " " + target) % candidates.size();
+	candidates[pick]->_peer.write(network + " " + line);
+}
+
+void EndpointManager::answer(string query, string answer) {
+	if(_askers.empty())
+		return;
+	unsigned id = _askers.front();
+	_askers.pop_front();
+	for(auto &worker : _workers)
+		if(worker._id == id)
+			worker._peer.write("query " + query + " :" + answer);
+}
+
+vector<pair<string, string>> EndpointManager::read() {
+	vector<pair<string, string>> out = _out;
+	_out.clear();
+	return out;
+}
+
+bool EndpointManager::reconfigure(const EndpointSettings &settings) {
+	if(!settings.sameProcess(_settings))
+		return false;
+	_settings = settings;
+	return true;
+}
+
+void EndpointManager::finish() {
+	_finishing = true;
+	_listener.close();
+	// what's still in inbound for workers goes out before we stop
+	for(const Broadcast::Message *msg; (msg = inbound.next(_reader)); )
+		write(msg->_network, msg->_line);
+	for(auto &worker : _workers) {
+		if(worker._ready)
+			worker._peer.finish();
+		else
+			worker._peer.close();
+	}
+}
+bool EndpointManager::finished() const {
+	return _failed || _workers.empty();
+}
+
+string EndpointManager::name() {
+	return _name;
+}
+
+
+shared_ptr<const Settings> compileSettings(Config &conf);
+void requestReload(int signal);
+void requestUpgrade(int signal);
+void requestShutdown(int signal);
+void ignoreSignal(int signal);
+void beginShutdown(list<BinaryManager> &bins, list<EndpointManager> &ends);
+// move shutting down along, returning whether it moved on to a new phase
+bool stepShutdown(list<BinaryManager> &bins, list<EndpointManager> &ends,
+		list<ConnectionManager> &conns, bool busy);
+void upgrade(char **argv, list<BinaryManager> &bins,
+		list<EndpointManager> &ends, list<ConnectionManager> &conns);
+void reload(list<BinaryManager> &bins, list<EndpointManager> &ends,
+		list<ConnectionManager> &conns);
+
+// check conf, saying what is wrong with it; nothing is returned if jitro
+// can't run with it
+shared_ptr<const Settings> compileSettings(Config &conf) {
+	vector<string> errors;
+	shared_ptr<const Settings> settings = Settings::compile(conf, errors);
+	for(auto &error : errors)
+		cerr << "jitro: " << configFile << ": " << error << endl;
+	return settings;
+}
+
+void requestReload(int) {
+	reloadRequested = 1;
+}
+void requestUpgrade(int) {
+	upgradeRequested = 1;
+}
+void requestShutdown(int) {
+	shutdownRequested = 1;
+}
+// unlike SIG_IGN, a handler doesn't carry over into the binaries we exec
+void ignoreSignal(int) {
+}
+
+// Shutting down goes through these in turn, each moving on once it's done
+// or its time is up: binaries and workers are given what's left for them
+// and told there's no more, and what they say meanwhile is sent on (while
+// nothing new from the networks is taken); every network is sent QUIT at
+// once, and we wait for them to hang up; binaries still running are sent
+// SIGTERM, then SIGKILL.
+enum class Phase { Running, Draining, Quitting, Reaping, Done, INVALID };
+static Phase phase = Phase::Running;
+// when the current phase has to be over by, and a timer to wake us then
+static TimerWheel::TimePoint phaseEnds{};
+static TimerWheel::TimerId phaseTimer{TimerWheel::None};
+// seconds networks always get to see our QUIT off
+static const int quitGrace = 2;
+
+static void endPhaseAt(TimerWheel::TimePoint at);
+void endPhaseAt(TimerWheel::TimePoint at) {
+	timers.cancel(phaseTimer);
+	phaseEnds = at;
+	phaseTimer = timers.schedule(at, []() { phaseTimer = TimerWheel::None; });
+}
+
+void beginShutdown(list<BinaryManager> &bins, list<EndpointManager> &ends) {
+	int timeout = currentSettings()->_shutdownTimeout;
+	cout << "jitro: shutting down, giving everything " << timeout
+		<< "s to finish" << endl;
+	phase = Phase::Draining;
+	endPhaseAt(TimerWheel::now() + seconds(timeout));
+	for(auto &bin : bins)
+		bin.finish();
+	for(auto &end : ends)
+		end.finish();
+}
+
+bool stepShutdown(list<BinaryManager> &bins, list<EndpointManager> &ends,
+		list<ConnectionManager> &conns, bool busy) {
+	TimerWheel::TimePoint now = TimerWheel::now();
+	bool late = now >= phaseEnds;
+	switch(phase) {
+		case Phase::Draining: {
+			bool drained = !busy;
+			for(auto &bin : bins)
+				drained &= bin.finished();
+			for(auto &end : ends)
+				drained &= end.finished();
+			for(auto &conn : conns)
+				drained &= conn.idle();
+			if(!drained && !late)
+				return false;
+			if(!drained)
+				cerr << "jitro: not everything finished in time, quitting anyway"
+					<< endl;
+			for(auto &conn : conns)
+				conn.quit(quitMessage);
+			phase = Phase::Quitting;
+			endPhaseAt(std::max(phaseEnds, now + seconds(quitGrace)));
+			return true;
+		}
+		case Phase::Quitting: {
+			bool closed = true;
+			for(auto &conn : conns)
+				closed &= conn.closed();
+			if(!closed && !late)
+				return false;
+			bool running = false;
+			for(auto &bin : bins)
+				running |= bin.terminate();
+			phase = running ? Phase::Reaping : Phase::Done;
+			endPhaseAt(now + seconds(killGrace));
+			return true;
+		}
+		case Phase::Reaping: {
+			bool reaped = true;
+			for(auto &bin : bins)
+				reaped &= bin.finished();
+			if(!reaped && !late)
+				return false;
+			for(auto &bin : bins)
+				bin.kill();
+			phase = Phase::Done;
+			return true;
+		}
+		case Phase::Running:
+		case Phase::Done:
+		case Phase::INVALID:
+		default:
+			return false;
+	}
+}
+
+// Exec whatever is installed at selfPath, handing it our connections,
+// binaries and listeners so that nobody on the other end notices. Nothing
+// is torn down here, so if the exec fails we take back what we passed on
+// and carry on as we were.
+void upgrade(char **argv, list<BinaryManager> &bins,
+		list<EndpointManager> &ends, list<ConnectionManager> &conns) {
+	cout << "jitro: upgrading to " << selfPath << endl;
+
+	Handoff state;
+	string names;
+	for(auto &name : networkNames)
+		names += name + "\n";
+	state.set("networks", names);
+	for(auto &conn : conns)
+		conn.handoff(state);
+	for(auto &bin : bins)
+		bin.handoff(state);
+	for(auto &end : ends)
+		end.handoff(state);
+	Tls::handoff(state);
+
+	if(state.save() != 0) {
+		cerr << "jitro: unable to save our state, not upgrading" << endl;
+		state.abandon();
+		return;
+	}
+	cout.flush();
+	// the log thread writes out what it has; the next jitro starts another
+	logger::stop();
+	execv(selfPath.c_str(), argv);
+	perror("jitro: upgrade: execv");
+	state.abandon();
+	logger::start(currentSettings()->_logger);
+}
+
+// Reread the configuration file and bring everything in line with it.
+// Connections, binaries and endpoints whose own settings didn't change are
+// left alone; connections only join and part the channels that did. Network
+// ids stay the same across reloads, removed networks leaving a blank name.
+void reload(list<BinaryManager> &bins, list<EndpointManager> &ends,
+		list<ConnectionManager> &conns) {
+	Config conf;
+	if(conf.load(configFile) < 0) {
+		cerr << "jitro: unable to reload " << configFile
+			<< ", keeping the current configuration" << endl;
+		return;
+	}
+	shared_ptr<const Settings> settings = compileSettings(conf);
+	if(!settings) {
+		cerr << "jitro: keeping the current configuration" << endl;
+		return;
+	}
+	cout << "jitro: reloading " << configFile << endl;
+	publishSettings(settings);
+	inbound.resize(settings->_inbound);
+
+	bool networksChanged = false;
+	for(auto it = conns.begin(); it != conns.end(); ) {
+		string network = it->name();
+		const NetworkSettings *ns = settings->network(network);
+		if(!ns) {
+			cout << "jitro: disconnecting from " << network << endl;
+			networkNames[networkId(network)].clear();
+			it = conns.erase(it);
+			networksChanged = true;
+			continue;
+		}
+		if(!it->reconfigure(*ns)) {
+			cout << "jitro: reconnecting to " << network
+				<< ", its settings changed" << endl;
+			it = conns.erase(it);
+			conns.emplace(it, *ns);
+			continue;
+		}
+		++it;
+	}
+	for(auto &ns : settings->_networks) {
+		bool have = false;
+		for(auto &conn : conns)
+			have |= conn.name() == ns._name;
+		if(have)
+			continue;
+		conns.emplace_back(ns);
+		if(networkId(ns._name) == framing::Control) {
+			networkNames.push_back(ns._name);
+			networksChanged = true;
+		}
+	}
+
+	for(auto it = bins.begin(); it != bins.end(); ) {
+		const BinarySettings *bs = settings->binary(it->name());
+		if(!bs || !it->reconfigure(*bs)) {
+			cout << "jitro: stopping \"" << it->name() << "\"" << endl;
+			it = bins.erase(it);
+			continue;
+		}
+		if(networksChanged)
+			it->networksChanged();
+		++it;
+	}
+	for(auto &bs : settings->_binaries) {
+		bool have = false;
+		for(auto &bin : bins)
+			have |= bin.name() == bs._path;
+		if(!have)
+			bins.emplace_back(bs);
+	}
+
+	for(auto it = ends.begin(); it != ends.end(); ) {
+		const EndpointSettings *es = settings->endpoint(it->name());
+		if(!es || !it->reconfigure(*es)) {
+			cout << "jitro: closing \"" << it->name() << "\"" << endl;
+			it = ends.erase(it);
+			continue;
+		}
+		++it;
+	}
+	for(auto &es : settings->_endpoints) {
+		bool have = false;
+		for(auto &end : ends)
+			have |= end.name() == es._name;
+		if(!have)
+			ends.emplace_back(es);
+	}
+}
+
+// pass on what a binary or endpoint has to say: queries are answered on
+// the spot, everything else goes to the networks it names
+template<typename Manager>
+void route(Manager &bin, list<ConnectionManager> &conns) {
+	vector<pair<string, string>> lines = bin.read();
+	for(auto &line : lines) {
+		string destination = line.first, msg = line.second;
+		cerr << "jitro: read \"" << destination << " " << msg << "\" from "
+			<< bin.name() << endl;
+		PROBE2(route, bin.name().c_str(), destination.c_str());
+
+		// binaries may ask what we know about a network, which we answer
+		// inline as "query <network> <what> <args...> :<answer>"
+		if(destination == "query") {
+			vector<string> fields = split(msg, " ");
+			string answer;
+			if(fields.size() >= 2)
+				for(auto &conn : conns)
+					if(conn.name() == fields[0])
+						answer = conn.query(fields[1],
+								vector<string>(fields.begin() + 2, fields.end()));
+			bin.answer(msg, answer);
+			continue;
+		}
+
+		// a binary quitting has us all shut down, with its message
+		if(startsWith(msg, "QUIT")) {
+			cerr << "jitro: read QUIT message" << endl;
+			string message = IRCMessage::parse(msg).param(0);
+			if(!message.empty())
+				quitMessage = message;
+			shutdownRequested = 1;
+			continue;
+		}
+
+		bool broadcast = destination == "broadcast";
+
+		for(auto &conn : conns)
+			if(broadcast || conn.name() == destination)
+				conn.write(msg);
+	}
+}
+
+
 int main(int argc, char **argv) {
 	vector<string> args;
 	for(unsigned arg = 1; arg < (unsigned)argc; ++arg)
 		args.push_back(argv[arg]);
 
-	conf.load(configFile);
+	Config conf;
+	if(conf.load(configFile) < 0) {
+		cerr << "jitro: unable to read " << configFile << endl;
+		return 1;
+	}
 
 	if(contains(args, (string)"--dump-config"))
 		for(auto i : conf)
 			cout << i.first << " = " << i.second << endl;
 
-	vector<string> allBinaries = split(conf["core.binary"]), binaries;
-	for(auto binary : allBinaries) {
-		if(!executable(binary)) {
-			cerr << "jitro: configured binary not executable: \"" << binary
-				<< "\"" << endl;
-		} else {
-			binaries.push_back(binary);
-		}
-	}
-	if(binaries.empty()) {
-		cerr << "jitro: error: no executable binaries found" << endl;
-		return 1;
-	}
+	// the executable we were started from, for upgrading later
+	char self[PATH_MAX];
+	ssize_t selfLength = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	selfPath = selfLength > 0 ? string(self, selfLength) : argv[0];
 
-	if(!conf.has("irc.networks")) {
-		cerr << "jitro: no IRC networks defined." << endl;
+	// everything else works from the checked, typed form of conf
+	shared_ptr<const Settings> settings = compileSettings(conf);
+	if(!settings)
 		return 1;
-	}
+	publishSettings(settings);
+	inbound.resize(settings->_inbound);
 
-	vector<string> networks = split(conf["irc.networks"]);
-	if(networks.empty()) {
-		cerr << "jitro: IRC networks does not contain any networks?" << endl;
-		return 1;
+	// we're the router: pin ourselves down before the log thread and
+	// binaries, which otherwise inherit it, are started
+	Placement::remember();
+	if(!settings->_router.empty())
+		settings->_router.apply("");
+	logger::storeIn(settings->_logDir, settings->_logSegment);
+	logger::start(settings->_logger);
+
+	for(auto &ns : settings->_networks)
+		networkNames.push_back(ns._name);
+
+	// if an older jitro exec'd us, it left us everything it had going
+	Handoff state;
+	if(state.load() == 0) {
+		cout << "jitro: resuming from a previous jitro" << endl;
+		Tls::resume(state);
+		// network ids must not change under binaries that survived
+		string names = state.get("networks");
+		networkNames.clear();
+		for(size_t pos = 0, nl; (nl = names.find('\n', pos)) != string::npos;
+				pos = nl + 1)
+			networkNames.push_back(names.substr(pos, nl - pos));
+		for(auto &ns : settings->_networks)
+			if(networkId(ns._name) == framing::Control)
+				networkNames.push_back(ns._name);
 	}
 
-	vector<BinaryManager> bins;
-	for(auto binary : binaries)
-		bins.emplace_back(binary);
+	// managers hand their addresses to timers, so they must stay put
+	list<BinaryManager> bins;
+	for(auto &bs : settings->_binaries)
+		bins.emplace_back(bs);
+	list<EndpointManager> ends;
+	for(auto &es : settings->_endpoints)
+		ends.emplace_back(es);
 
-	vector<ConnectionManager> conns;
-	for(auto network : networks)
-		conns.emplace_back(network);
+	list<ConnectionManager> conns;
+	for(auto &ns : settings->_networks)
+		conns.emplace_back(ns);
 
-	int ms = 1000;
+	if(!state.empty()) {
+		for(auto &conn : conns)
+			conn.resume(state);
+		for(auto &bin : bins)
+			bin.resume(state);
+		for(auto &end : ends)
+			end.resume(state);
+	}
 
-	// keep main thread alive
-	while(!done) {
-		for(auto &bin : bins) {
-			bin.manage();
+	// the configuration is reloaded on SIGHUP, or when the file is rewritten
+	struct sigaction hup;
+	memset(&hup, 0, sizeof(hup));
+	hup.sa_handler = requestReload;
+	sigaction(SIGHUP, &hup, nullptr);
+	struct sigaction usr2;
+	memset(&usr2, 0, sizeof(usr2));
+	usr2.sa_handler = requestUpgrade;
+	sigaction(SIGUSR2, &usr2, nullptr);
+	struct sigaction term;
+	memset(&term, 0, sizeof(term));
+	term.sa_handler = requestShutdown;
+	sigaction(SIGTERM, &term, nullptr);
+	sigaction(SIGINT, &term, nullptr);
+	// a peer hanging up shows up as EPIPE where we write, not as a signal
+	struct sigaction sigpipe;
+	memset(&sigpipe, 0, sizeof(sigpipe));
+	sigpipe.sa_handler = ignoreSignal;
+	sigaction(SIGPIPE, &sigpipe, nullptr);
+	FileWatch configWatch;
+	configWatch.watch(configFile);
+	bool configChanged = false;
 
-			// copy from subprocesses stdout to the IRC socket
-			vector<string> lines = bin.read();
-			for(auto &line : lines) {
-				cerr << "jitro: read \"" << line << "\" from " << bin.name() << endl;
-				string destination = line.substr(0, line.find(" ")),
-					msg = line.substr(line.find(" ") + 1);
+	IOBackend *io = IOBackend::create(settings->_io);
+	cerr << "jitro: waiting on I/O with " << io->name() << endl;
 
-				bool broadcast = destination == "broadcast";
-				if(startsWith(msg, "QUIT")) {
-					cerr << "jitro: read QUIT message" << endl;
-					done = true;
-				}
+	// keep main thread alive
+	while(phase != Phase::Done) {
+		if(shutdownRequested && phase == Phase::Running)
+			beginShutdown(bins, ends);
+		// once shutting down, neither can happen any more
+		if((reloadRequested || configChanged) && phase == Phase::Running) {
+			reloadRequested = 0;
+			configChanged = false;
+			reload(bins, ends, conns);
+		}
+		if(upgradeRequested && phase == Phase::Running) {
+			upgradeRequested = 0;
+			upgrade(argv, bins, ends, conns);
+		}
 
-				for(auto &conn : conns)
-					if(broadcast || conn.name() == destination)
-						conn.write(msg);
-			}
+		timers.advance();
+		// whether something was handed off which needs another pass
+		bool busy = false;
+
+		// copy from subprocesses stdout (and workers) to the IRC sockets
+		for(auto &bin : bins) {
+			busy |= bin.manage();
+			route(bin, conns);
+		}
+		for(auto &end : ends) {
+			busy |= end.manage();
+			route(end, conns);
 		}
 
 		for(auto &conn : conns) {
-			conn.manage();
+			busy |= conn.manage();
 
-			// copy from irc to binaries
+			// copy from irc to binaries, which read it from inbound (until
+			// we're shutting down and they're told that's all)
 			vector<string> lines = conn.read();
-			for(auto &line : lines) {
-				for(auto &bin : bins)
-					bin.write(conn.name() + " " + line);
-			}
+			if(phase != Phase::Running)
+				continue;
+			for(auto &line : lines)
+				inbound.publish(conn.name(), line);
+			busy |= !lines.empty();
+		}
+
+		if(phase != Phase::Running) {
+			busy |= stepShutdown(bins, ends, conns, busy);
+			if(phase == Phase::Done)
+				break;
 		}
 
-		usleep(10 * ms);
+		// sleep until there is I/O to do or the next timer is due
+		vector<struct pollfd> fds;
+		for(auto &bin : bins)
+			bin.watch(fds);
+		for(auto &end : ends)
+			end.watch(fds);
+		for(auto &conn : conns)
+			conn.watch(fds);
+		size_t watchIndex = fds.size();
+		if(configWatch.fd() >= 0)
+			fds.push_back({ configWatch.fd(), POLLIN, 0 });
+
+		int timeout = -1;
+		TimerWheel::TimePoint deadline = timers.nextDeadline();
+		if(busy)
+			timeout = 0;
+		else if(deadline != TimerWheel::TimePoint::max()) {
+			auto wait = deadline - TimerWheel::now();
+			// round up so we don't wake just short of the deadline
+			long long ms = duration_cast<milliseconds>(wait).count() + 1;
+			timeout = (int)std::max(0LL, min(ms, (long long)INT_MAX));
+		}
+
+		if(io->wait(fds, timeout) < 0) {
+			if(errno != EINTR)
+				perror("jitro: wait");
+			continue;
+		}
+		for(auto &conn : conns)
+			conn.ready(fds);
+		if(watchIndex < fds.size() && fds[watchIndex].revents)
+			configChanged = configWatch.changed();
 	}
 
+	delete io;
+	logger::stop();
 	return 0;
 }
 